@@ -0,0 +1,495 @@
+#include <iostream>
+
+#include "src/renderer.h"
+#include "src/imageio.h"
+#include "src/parallel.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <limits>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+
+using nlohmann::json;
+
+/* Renders a fixed set of scenes with every integrator and writes throughput and convergence to a JSON file,
+ * so runs of different versions can be compared. */
+
+struct BenchOptions {
+    std::string cornell = ROULETTE_SOURCE_DIR "/scene.json";
+    std::string references = ROULETTE_SOURCE_DIR "/bench/references";
+    std::string output = "bench.json";
+    std::string label;
+    std::vector<std::string> scenes{ "cornell", "many-quads", "many-lights", "deep-bounce" };
+    std::vector<std::string> integrators{ "path", "adaptive", "oidn", "ears" };
+    std::vector<int> spp{ 1, 4, 16 };
+    int resolution = 128;
+    int earsIterations = 8;
+    int earsSpp = 2;
+    int referenceSpp = 1024;
+    float adaptiveThreshold = AdaptiveSampler::Configuration().errorThreshold;
+    bool makeReferences = false;
+    float efficiencyBudget = 0; /// seconds per technique, 0 runs the regular benchmark
+    int efficiencyPoints = 10;  /// error measurements over the budget
+    std::vector<std::string> techniques{ "classic", "gwtw", "adrrs", "ears", "mixed" };
+};
+
+struct BenchPoint {
+    int iteration{-1}; /// EARS iteration the snapshot was taken after, -1 for a finished render
+    int spp{0};
+    float seconds{0};
+    double mse{-1};    /// -1 without a reference
+    double relMse{-1};
+};
+
+static void usage(const char* program) {
+    printf("Usage: %s [options]\n"
+           "  --out <path>             JSON results (default bench.json)\n"
+           "  --label <text>           stored with the results, e.g. the commit being measured\n"
+           "  --scenes <a,b,..>        cornell, many-quads, many-lights, deep-bounce (default all)\n"
+           "  --integrators <a,b,..>   path, adaptive, oidn, ears (default all), adaptive is the path tracer with\n"
+           "                           adaptive sampling, spending the same average spp where pixels are noisy\n"
+           "  --spp <n,n,..>           sample counts the path, adaptive and oidn integrators are timed at (default 1,4,16)\n"
+           "  --adaptive-threshold <e> relative error at which adaptive sampling leaves a pixel (default 0.02)\n"
+           "  --ears-iterations <n>    EARS iterations, every one is a point on the convergence curve (default 8)\n"
+           "  --resolution <n>         width and height of the images (default 128)\n"
+           "  --cornell <path>         the bundled Cornell box all scenes are derived from\n"
+           "  --references <dir>       where references are looked up (default bench/references)\n"
+           "  --make-references        render missing references with the path tracer first. None are committed,\n"
+           "                           without one a scene's runs record timings but no MSE, relMSE or efficiency\n"
+           "  --reference-spp <n>      samples per pixel of new references (default 1024)\n"
+           "  --efficiency <seconds>   instead, give every RR/splitting technique the same time with EARS and\n"
+           "                           record relMSE and efficiency, 1 / (time * relMSE), along the way\n"
+           "  --efficiency-points <n>  measurements within the budget (default 10)\n"
+           "  --techniques <a,b,..>    none, classic, gwtw, adrrs, ears, mixed (default all but none)\n", program);
+}
+
+static std::vector<std::string> splitList(const char* list) {
+    std::vector<std::string> items;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+/* Deterministic numbers in [0, 1) for placing procedural geometry. */
+static float hashToUnit(uint32 i) {
+    i ^= i >> 16;
+    i *= 0x7feb352dU;
+    i ^= i >> 15;
+    i *= 0x846ca68bU;
+    i ^= i >> 16;
+    return float(i >> 8) / float(1 << 24);
+}
+
+static json lambert(const std::string& name, Vec3f albedo) {
+    return { { "name", name }, { "type", "lambert" }, { "albedo", { albedo.x(), albedo.y(), albedo.z() } } };
+}
+
+static json quad(const std::string& bsdf, Vec3f pos, Vec3f scale, Vec3f rot) {
+    return {
+        { "type", "quad" }, { "bsdf", bsdf },
+        { "transform", {
+            { "position", { pos.x(), pos.y(), pos.z() } },
+            { "scale", { scale.x(), scale.y(), scale.z() } },
+            { "rotation", { rot.x(), rot.y(), rot.z() } }
+        } }
+    };
+}
+
+/**
+ * Derives the benchmark scene called name from the Cornell box. Primitives are looked up by their bsdf name,
+ * so every added primitive gets a bsdf of its own. Only the primitive called Light is sampled directly,
+ * the additional lamps of many-lights are found by BSDF sampling alone.
+ */
+static bool makeScene(const std::string& name, json scene, int resolution, json& result) {
+    scene["camera"]["resolution"] = { resolution, resolution };
+
+    if (name == "many-quads") {
+        /// a cloud of small tilted tiles filling the box
+        for (int i = 0; i < 512; i++) {
+            std::string bsdf = "Tile" + std::to_string(i);
+            Vec3f albedo(0.3f + 0.6f * hashToUnit(8 * i), 0.3f + 0.6f * hashToUnit(8 * i + 1), 0.5f);
+            Vec3f pos(1.8f * hashToUnit(8 * i + 2) - 0.9f, 0.1f + 1.7f * hashToUnit(8 * i + 3), 1.8f * hashToUnit(8 * i + 4) - 0.9f);
+            Vec3f rot(360 * hashToUnit(8 * i + 5), 360 * hashToUnit(8 * i + 6), 0);
+            scene["bsdfs"].push_back(lambert(bsdf, albedo));
+            scene["primitives"].push_back(quad(bsdf, pos, Vec3f(0.06f, 1, 0.06f), rot));
+        }
+    } else if (name == "many-lights") {
+        /// small lamps under the ceiling next to the main light
+        for (int i = 0; i < 16; i++) {
+            std::string bsdf = "Lamp" + std::to_string(i);
+            Vec3f pos(-0.8f + 0.5f * float(i % 4) + 0.05f, 1.97f, -0.8f + 0.5f * float(i / 4) + 0.05f);
+            json lamp = quad(bsdf, pos, Vec3f(0.1f, 1, 0.1f), Vec3f(0, 180, 180));
+            lamp["emission"] = { 6, 5, 4 };
+            scene["bsdfs"].push_back({ { "name", bsdf }, { "type", "null" }, { "albedo", 1 } });
+            scene["primitives"].push_back(lamp);
+        }
+    } else if (name == "deep-bounce") {
+        /// bright walls and a small, strong light, so most of the energy arrives over long paths
+        for (auto& bsdf : scene["bsdfs"]) {
+            if (bsdf["type"] != "lambert")
+                continue;
+            Vec3f albedo(bsdf["albedo"][0], bsdf["albedo"][1], bsdf["albedo"][2]);
+            albedo *= 0.95f / albedo.max();
+            bsdf["albedo"] = { albedo.x(), albedo.y(), albedo.z() };
+        }
+        for (auto& primitive : scene["primitives"]) {
+            if (primitive["bsdf"] != "Light")
+                continue;
+            primitive["transform"]["scale"] = { 0.1, 1, 0.1 };
+            primitive["emission"] = { 425, 300, 100 };
+        }
+    } else if (name != "cornell") {
+        printf("Error: unknown scene %s\n", name.c_str());
+        return false;
+    }
+
+    result = std::move(scene);
+    return true;
+}
+
+static double meanSquaredError(const std::vector<Vec3f>& image, const std::vector<Vec3f>& reference) {
+    if (reference.empty() || image.size() != reference.size())
+        return -1;
+    double sum = 0;
+    for (size_t i = 0; i < image.size(); i++) {
+        Vec3f d = image[i] - reference[i];
+        sum += (d * d).avg();
+    }
+    return sum / double(image.size());
+}
+
+/* Squared error relative to the reference, so dark and bright regions weigh alike. */
+static double relativeMeanSquaredError(const std::vector<Vec3f>& image, const std::vector<Vec3f>& reference) {
+    if (reference.empty() || image.size() != reference.size())
+        return -1;
+    double sum = 0;
+    for (size_t i = 0; i < image.size(); i++) {
+        Vec3f d = image[i] - reference[i];
+        sum += (d * d / (reference[i] * reference[i] + Vec3f(1e-2f))).avg();
+    }
+    return sum / double(image.size());
+}
+
+static float secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+}
+
+static AdaptiveSampler::Configuration uniformSpp(int spp) {
+    AdaptiveSampler::Configuration adaptive;
+    adaptive.enabled = true;
+    adaptive.spp = spp;
+    adaptive.minSpp = spp;
+    adaptive.maxSpp = spp;
+    adaptive.sppStep = 1;
+    adaptive.errorThreshold = 0;
+    return adaptive;
+}
+
+/* The same average spp, of which every pixel takes a quarter before the rest goes to the noisy ones. */
+static AdaptiveSampler::Configuration adaptiveSpp(int spp, float errorThreshold) {
+    AdaptiveSampler::Configuration adaptive;
+    adaptive.enabled = true;
+    adaptive.spp = spp;
+    adaptive.minSpp = std::max(spp / 4, std::min(spp, 2));
+    adaptive.maxSpp = 8 * spp;
+    adaptive.sppStep = std::max(spp / 8, 1);
+    adaptive.errorThreshold = errorThreshold;
+    return adaptive;
+}
+
+static json pointsToJson(const std::vector<BenchPoint>& points) {
+    json result = json::array();
+    for (const BenchPoint& point : points) {
+        json entry = { { "spp", point.spp }, { "seconds", point.seconds } };
+        if (point.iteration >= 0)
+            entry["iteration"] = point.iteration;
+        if (point.mse >= 0)
+            entry["mse"] = point.mse;
+        if (point.relMse >= 0) {
+            entry["relMse"] = point.relMse;
+            entry["efficiency"] = point.relMse > 0 && point.seconds > 0 ? 1 / (point.seconds * point.relMse) : 0.0;
+        }
+        result.push_back(entry);
+    }
+    return result;
+}
+
+static json runJson(const std::string& scene, const std::string& integrator, int spp, float seconds,
+                    const RenderCounters& counters, const std::vector<BenchPoint>& points, bool hasReference) {
+    return {
+        { "scene", scene },
+        { "integrator", integrator },
+        { "reference", hasReference },
+        { "spp", spp },
+        { "seconds", seconds },
+        { "samplesPerSecond", seconds > 0 ? double(counters.cameraRays) / seconds : 0.0 },
+        { "mraysPerSecond", seconds > 0 ? double(counters.rays()) / seconds * 1e-6 : 0.0 },
+        { "rays", counters.rays() },
+        { "averagePathLength", counters.averagePathLength() },
+        { "mse", points.empty() || points.back().mse < 0 ? json() : json(points.back().mse) },
+        { "curve", pointsToJson(points) }
+    };
+}
+
+/* Renders with the path tracer at the sampling configuration, returning the image, its time and the counters. */
+static void renderPath(const Scene& scene, const AdaptiveSampler::Configuration& sampling, std::vector<Vec3f>& image,
+                       float& seconds, RenderCounters& counters) {
+    PathTraceIntegrator integrator;
+    integrator.adaptive = sampling;
+    FrameBuffer frame(scene.camera.resx, scene.camera.resy);
+    auto start = std::chrono::steady_clock::now();
+    integrator.render(scene, frame);
+    seconds = secondsSince(start);
+    counters = integrator.counters;
+    image = frame.color;
+}
+
+static void renderOidn(const Scene& scene, int spp, std::vector<Vec3f>& image, float& seconds, RenderCounters& counters) {
+    OIDNIntegrator integrator;
+    integrator.debugImages = false;
+    FrameBuffer frame(scene.camera.resx, scene.camera.resy, spp);
+    auto start = std::chrono::steady_clock::now();
+    integrator.render(scene, frame);
+    seconds = secondsSince(start);
+    counters = integrator.counters;
+    image = frame.oidn;
+}
+
+/**
+ * Renders with EARS using rrs, measuring the error of the merged image on the side: after every iteration
+ * without a budget, or every budget / efficiencyPoints seconds with one. A budget ends the render before an
+ * iteration that would not finish within it. All points are timed from the start of the render, auxiliaries
+ * included, like the final one.
+ */
+static void renderEars(const Scene& scene, const BenchOptions& options, const EARS::RRSMethod& rrs, float budget,
+                       const std::vector<Vec3f>& reference, std::vector<BenchPoint>& points, float& seconds,
+                       RenderCounters& counters) {
+    EARSIntegrator integrator;
+    integrator.configuration.iterations = budget > 0 ? std::numeric_limits<int>::max() : options.earsIterations;
+    integrator.configuration.spp = options.earsSpp;
+    integrator.configuration.debugImages = false;
+    integrator.configuration.rrs = rrs;
+    integrator.configuration.timeBudget = budget;
+
+    PreviewStream stream(budget > 0 ? budget / float(std::max(options.efficiencyPoints, 1)) : 0.0f);
+    integrator.preview = &stream;
+    std::atomic<bool> done{false};
+    auto start = std::chrono::steady_clock::now();
+    std::thread curve([&]() {
+        while (true) {
+            bool last = done.load(std::memory_order_acquire);
+            if (const PreviewFrame* snapshot = stream.acquire()) {
+                BenchPoint point;
+                point.iteration = snapshot->iteration;
+                point.spp = snapshot->spp;
+                point.seconds = std::chrono::duration<float>(snapshot->published - start).count();
+                point.mse = meanSquaredError(snapshot->hdr, reference);
+                point.relMse = relativeMeanSquaredError(snapshot->hdr, reference);
+                points.push_back(point);
+            }
+            if (last)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    FrameBuffer frame(scene.camera.resx, scene.camera.resy);
+    integrator.render(scene, frame);
+    seconds = secondsSince(start);
+    done.store(true, std::memory_order_release);
+    curve.join();
+    counters = integrator.counters;
+
+    BenchPoint final;
+    final.spp = points.empty() ? 0 : points.back().spp;
+    final.seconds = seconds;
+    final.mse = meanSquaredError(frame.color, reference);
+    final.relMse = relativeMeanSquaredError(frame.color, reference);
+    points.push_back(final);
+}
+
+static bool loadReference(const BenchOptions& options, const std::string& name, const Scene& scene,
+                          std::vector<Vec3f>& reference) {
+    namespace fs = std::filesystem;
+    std::string path = options.references + "/" + name + "_" + std::to_string(options.resolution) + ".pfm";
+
+    int resx = 0, resy = 0;
+    if (fs::exists(path))
+        return ImageIO::readPfm(path.c_str(), reference, resx, resy) && resx == scene.camera.resx && resy == scene.camera.resy;
+    if (!options.makeReferences) {
+        printf("No reference for %s at %s, run with --make-references to render one\n", name.c_str(), path.c_str());
+        return false;
+    }
+
+    printf("Rendering the reference for %s with %d spp\n", name.c_str(), options.referenceSpp);
+    std::error_code error;
+    fs::create_directories(options.references, error);
+    float seconds;
+    RenderCounters counters;
+    renderPath(scene, uniformSpp(options.referenceSpp), reference, seconds, counters);
+    return ImageIO::writePfm(path.c_str(), reference.data(), scene.camera.resx, scene.camera.resy);
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            options.output = argv[++i];
+        else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc)
+            options.label = argv[++i];
+        else if (strcmp(argv[i], "--scenes") == 0 && i + 1 < argc)
+            options.scenes = splitList(argv[++i]);
+        else if (strcmp(argv[i], "--integrators") == 0 && i + 1 < argc)
+            options.integrators = splitList(argv[++i]);
+        else if (strcmp(argv[i], "--spp") == 0 && i + 1 < argc) {
+            options.spp.clear();
+            for (const auto& spp : splitList(argv[++i]))
+                options.spp.push_back(std::max(atoi(spp.c_str()), 1));
+        } else if (strcmp(argv[i], "--ears-iterations") == 0 && i + 1 < argc)
+            options.earsIterations = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc)
+            options.resolution = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--cornell") == 0 && i + 1 < argc)
+            options.cornell = argv[++i];
+        else if (strcmp(argv[i], "--references") == 0 && i + 1 < argc)
+            options.references = argv[++i];
+        else if (strcmp(argv[i], "--make-references") == 0)
+            options.makeReferences = true;
+        else if (strcmp(argv[i], "--adaptive-threshold") == 0 && i + 1 < argc)
+            options.adaptiveThreshold = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--reference-spp") == 0 && i + 1 < argc)
+            options.referenceSpp = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--efficiency") == 0 && i + 1 < argc)
+            options.efficiencyBudget = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--efficiency-points") == 0 && i + 1 < argc)
+            options.efficiencyPoints = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--techniques") == 0 && i + 1 < argc)
+            options.techniques = splitList(argv[++i]);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::ifstream cornellFile(options.cornell);
+    if (!cornellFile) {
+        printf("Error: could not open %s\n", options.cornell.c_str());
+        return 1;
+    }
+    json cornell = json::parse(cornellFile);
+
+    /// the parser reads scenes from files, the derived ones are written next to each other in the temp directory
+    std::error_code error;
+    std::filesystem::path sceneDir = std::filesystem::temp_directory_path(error) / "roulette_bench";
+    std::filesystem::create_directories(sceneDir, error);
+
+    json runs = json::array();
+    std::vector<std::string> missingReferences;
+    for (const std::string& name : options.scenes) {
+        json sceneJson;
+        if (!makeScene(name, cornell, options.resolution, sceneJson))
+            continue;
+        std::string scenePath = (sceneDir / (name + ".json")).string();
+        std::ofstream(scenePath) << sceneJson.dump(2);
+
+        Renderer renderer;
+        renderer.loadTungstenJSON(scenePath.c_str());
+        const Scene& scene = renderer.scene;
+
+        std::vector<Vec3f> reference;
+        if (!loadReference(options, name, scene, reference))
+            reference.clear();
+        const bool hasReference = !reference.empty();
+        if (!hasReference)
+            missingReferences.push_back(name);
+
+        if (options.efficiencyBudget > 0) {
+            for (const std::string& technique : options.techniques) {
+                EARS::RRSMethod rrs;
+                if (!EARS::RRSMethod::fromName(technique, rrs)) {
+                    printf("Error: unknown RR/splitting technique %s\n", technique.c_str());
+                    continue;
+                }
+                std::cout << "Running " << technique << " on " << name << " for "
+                          << options.efficiencyBudget << "s" << std::endl;
+                std::vector<BenchPoint> points;
+                float seconds;
+                RenderCounters counters;
+                renderEars(scene, options, rrs, options.efficiencyBudget, reference, points, seconds, counters);
+                json run = runJson(name, "ears", points.back().spp, seconds, counters, points, hasReference);
+                run["technique"] = technique;
+                run["budget"] = options.efficiencyBudget;
+                if (points.back().relMse > 0)
+                    run["efficiency"] = 1 / (seconds * points.back().relMse);
+                runs.push_back(run);
+            }
+            continue;
+        }
+
+        for (const std::string& integrator : options.integrators) {
+            std::cout << "Benchmarking " << integrator << " on " << name << std::endl;
+            if (integrator == "path" || integrator == "adaptive" || integrator == "oidn") {
+                /// every sample count is a render of its own, together they make the convergence curve
+                /// throughput is that of the largest one
+                std::vector<BenchPoint> points;
+                RenderCounters counters;
+                for (int spp : options.spp) {
+                    std::vector<Vec3f> image;
+                    BenchPoint point;
+                    point.spp = spp;
+                    if (integrator == "path")
+                        renderPath(scene, uniformSpp(spp), image, point.seconds, counters);
+                    else if (integrator == "adaptive")
+                        renderPath(scene, adaptiveSpp(spp, options.adaptiveThreshold), image, point.seconds, counters);
+                    else
+                        renderOidn(scene, spp, image, point.seconds, counters);
+                    point.mse = meanSquaredError(image, reference);
+                    point.relMse = relativeMeanSquaredError(image, reference);
+                    points.push_back(point);
+                }
+                runs.push_back(runJson(name, integrator, points.back().spp, points.back().seconds, counters, points, hasReference));
+            } else if (integrator == "ears") {
+                std::vector<BenchPoint> points;
+                float seconds;
+                RenderCounters counters;
+                renderEars(scene, options, EARS::RRSMethod::ADRRS(), 0, reference, points, seconds, counters);
+                runs.push_back(runJson(name, integrator, options.earsSpp * options.earsIterations, seconds, counters, points,
+                                       hasReference));
+            } else {
+                printf("Error: unknown integrator %s\n", integrator.c_str());
+            }
+        }
+    }
+
+    json results = {
+        { "label", options.label },
+        { "time", long(std::time(nullptr)) },
+        { "resolution", options.resolution },
+        { "threads", threadCount() },
+        { "missingReferences", missingReferences },
+        { "runs", runs }
+    };
+    std::ofstream out(options.output);
+    out << results.dump(2) << std::endl;
+    if (!out) {
+        printf("Error: could not write %s\n", options.output.c_str());
+        return 1;
+    }
+    printf("Results written to %s\n", options.output.c_str());
+    if (!missingReferences.empty()) {
+        std::string names;
+        for (const std::string& name : missingReferences)
+            names += (names.empty() ? "" : ", ") + name;
+        printf("No reference for %s, their runs have no MSE, relMSE or efficiency. "
+               "Render references once with --make-references\n", names.c_str());
+    }
+    return 0;
+}
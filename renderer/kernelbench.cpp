@@ -0,0 +1,287 @@
+#include <iostream>
+
+#include "src/material.h"
+#include "src/octtree.h"
+#include "src/outlierrejectedaverage.h"
+#include "src/sampler.h"
+#include "src/shape.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+#include <nlohmann/json.hpp>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using nlohmann::json;
+
+/* Times the small kernels everything else is built from in isolation, on randomised inputs, so that
+ * low-level changes to them can be measured without the noise of a full render. */
+
+struct KernelOptions {
+    std::string output;         /// JSON results, none if empty
+    std::string label;
+    std::string filter;         /// only kernels whose name contains this
+    float warmupSeconds = 0.1f;
+    float minSeconds = 0.2f;    /// per repetition
+    int repetitions = 7;
+};
+
+struct KernelResult {
+    std::string name;
+    double nsPerOp;    /// median over the repetitions
+    double minNsPerOp;
+    double maxNsPerOp;
+    long long ops;     /// per repetition
+};
+
+/* Keeps the compiler from optimising away a result that is never used. */
+template<typename T>
+static inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+    _ReadWriteBarrier();
+#endif
+}
+
+/// inputs are drawn once and cycled through, a power of two that comfortably fits into L1 along with the kernel's data
+static constexpr int INPUT_COUNT = 1024;
+
+/**
+ * Runs op(i) for i = 0, 1, ... with i wrapping around INPUT_COUNT. After a warm-up the number of calls that fills
+ * minSeconds is found, then that many calls are timed for every repetition. op is a template parameter so the
+ * calls are inlined rather than measured along with an indirect call.
+ */
+template<typename Op>
+static KernelResult measure(const KernelOptions& options, const std::string& name, const Op& op) {
+    using clock = std::chrono::steady_clock;
+    auto run = [&](long long count) {
+        auto start = clock::now();
+        for (long long i = 0; i < count; i++)
+            op(int(i & (INPUT_COUNT - 1)));
+        return std::chrono::duration<double>(clock::now() - start).count();
+    };
+
+    long long count = INPUT_COUNT;
+    double seconds = 0;
+    auto warmupStart = clock::now();
+    while (std::chrono::duration<double>(clock::now() - warmupStart).count() < options.warmupSeconds)
+        seconds = run(count);
+    while ((seconds = run(count)) < options.minSeconds)
+        count *= seconds > 0 ? std::clamp((long long)(options.minSeconds / seconds * 1.2), 2LL, 16LL) : 16;
+
+    std::vector<double> nsPerOp;
+    for (int r = 0; r < std::max(options.repetitions, 1); r++)
+        nsPerOp.push_back(run(count) * 1e9 / double(count));
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    return { name, nsPerOp[nsPerOp.size() / 2], nsPerOp.front(), nsPerOp.back(), count };
+}
+
+static Vec3f randomVec3(UniformSampler& random, float lo, float hi) {
+    return Vec3f(random.next1D(), random.next1D(), random.next1D()) * (hi - lo) + Vec3f(lo);
+}
+
+static void usage(const char* program) {
+    printf("Usage: %s [options]\n"
+           "  --out <path>             also write the results as JSON\n"
+           "  --label <text>           stored with the results, e.g. the commit being measured\n"
+           "  --filter <text>          only run kernels whose name contains text\n"
+           "  --warmup <seconds>       untimed runs before measuring (default 0.1)\n"
+           "  --min-time <seconds>     length of each timed repetition (default 0.2)\n"
+           "  --repetitions <n>        timed repetitions, the median is reported (default 7)\n", program);
+}
+
+int main(int argc, char* argv[]) {
+    KernelOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            options.output = argv[++i];
+        else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc)
+            options.label = argv[++i];
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            options.filter = argv[++i];
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            options.warmupSeconds = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+            options.minSeconds = std::max((float)atof(argv[++i]), 1e-3f);
+        else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+            options.repetitions = std::max(atoi(argv[++i]), 1);
+        else {
+            usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    /// every kernel sees the same inputs from run to run
+    UniformSampler random(0x5EED);
+    std::vector<KernelResult> results;
+    auto bench = [&](const std::string& name, const auto& op) {
+        if (!options.filter.empty() && name.find(options.filter) == std::string::npos)
+            return;
+        results.push_back(measure(options, name, op));
+        const KernelResult& result = results.back();
+        printf("%-28s %9.2f ns/op %9.2f Mops/s  [%.2f, %.2f]\n", name.c_str(), result.nsPerOp,
+               1e3 / result.nsPerOp, result.minNsPerOp, result.maxNsPerOp);
+        fflush(stdout);
+    };
+
+    /// rays from above aimed at twice the area of the shapes, so roughly half of them hit
+    std::vector<Ray> rays(INPUT_COUNT);
+    for (Ray& ray : rays) {
+        Vec3f origin = randomVec3(random, -2, 2) + Vec3f(0, 4, 0);
+        Vec3f target = randomVec3(random, -1, 1) * Vec3f(1.4f, 0, 1.4f);
+        ray = Ray(origin, (target - origin).normalized());
+    }
+
+    Rectangle rectangle(Vec3f(0.0f), Vec3f(2.0f), Vec3f(0.0f, 0.3f, 0.0f));
+    bench("Rectangle::intersect", [&](int i) {
+        Ray ray = rays[i];
+        Intersection intersection;
+        doNotOptimize(rectangle.intersect(ray, intersection));
+    });
+
+    Cube cube(Vec3f(0.0f), Vec3f(2.0f), Vec3f(0.0f, 0.3f, 0.0f));
+    bench("Cube::intersect", [&](int i) {
+        Ray ray = rays[i];
+        Intersection intersection;
+        doNotOptimize(cube.intersect(ray, intersection));
+    });
+
+    /// a tree refined a few times from random training data, about as deep as one after a few EARS iterations
+    EARS::Octtree octtree;
+    std::vector<Vec3f> positions(INPUT_COUNT);
+    std::vector<Vec2f> directions(INPUT_COUNT);
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        positions[i] = randomVec3(random, 0, 1);
+        directions[i] = random.next2D();
+    }
+    for (int refinement = 0; refinement < 4; refinement++) {
+        for (int s = 0; s < 200000; s++) {
+            const EARS::Octtree::SamplingNode* sampling;
+            EARS::Octtree::TrainingNode* training;
+            Vec3f p = randomVec3(random, 0, 1);
+            /// denser towards one corner so the tree is unbalanced
+            Vec2f d = random.next2D();
+            octtree.lookup(p * p, d * d, sampling, training);
+            /// brighter towards one corner of the direction domain so bins refine
+            training->splatLrEstimate(Vec3f(1 / (d.x() + 0.05f)), Vec3f(1.0f), 1000.0f, 1000.0f);
+        }
+        octtree.build(true);
+        printf("\n");
+    }
+    collectCounters();
+    bench("Octtree::lookup", [&](int i) {
+        const EARS::Octtree::SamplingNode* sampling;
+        EARS::Octtree::TrainingNode* training;
+        octtree.lookup(positions[i], directions[i], sampling, training);
+        doNotOptimize(sampling);
+        doNotOptimize(training);
+    });
+    collectCounters();
+
+    /// heavy tailed, as pixel second moments are, so the outlier history keeps being reordered
+    std::vector<EARS::OutlierRejectedAverage::Sample> samples(INPUT_COUNT);
+    for (auto& sample : samples) {
+        float tail = 1.0f / std::max(random.next1D(), 1e-4f);
+        sample = EARS::OutlierRejectedAverage::Sample(Vec3f(tail * tail), tail);
+    }
+    EARS::OutlierRejectedAverage average;
+    average.resize(10);
+    bench("OutlierRejectedAverage::+=", [&](int i) {
+        if (i == 0)
+            average.reset();
+        average += samples[i];
+    });
+
+    UniformSampler sampler(0xBA5EBA11);
+    bench("UniformSampler::nextI", [&](int) {
+        doNotOptimize(sampler.nextI());
+    });
+
+    Lambertian lambertian(Vec3f(0.8f));
+    UniformPathSampler pathSampler(0xBA5EBA11);
+    std::vector<Vec3f> incoming(INPUT_COUNT);
+    for (Vec3f& wi : incoming) {
+        wi = randomVec3(random, -1, 1);
+        wi.z() = std::abs(wi.z()) + 1e-3f;
+        wi.normalize();
+    }
+    bench("Lambertian::sample", [&](int i) {
+        SurfaceScatterEvent event;
+        event.sampler = &pathSampler;
+        event.wi = incoming[i];
+        doNotOptimize(lambertian.sample(event));
+        doNotOptimize(event);
+    });
+
+    std::vector<Mat4f> matrices(INPUT_COUNT);
+    std::vector<Vec3f> vectors(INPUT_COUNT);
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        Vec3f t = randomVec3(random, -1, 1);
+        Vec3f s = randomVec3(random, 0.5f, 2);
+        Mat4f translateScale(
+            s.x(), 0.0f, 0.0f, t.x(),
+            0.0f, s.y(), 0.0f, t.y(),
+            0.0f, 0.0f, s.z(), t.z(),
+            0.0f, 0.0f, 0.0f, 1.0f
+        );
+        matrices[i] = translateScale * Mat4f::rotYXZ(randomVec3(random, -180, 180));
+        vectors[i] = randomVec3(random, -1, 1);
+    }
+    bench("Mat4f * Mat4f", [&](int i) {
+        doNotOptimize(matrices[i] * matrices[(i + 1) & (INPUT_COUNT - 1)]);
+    });
+    bench("Mat4f * Vec3f", [&](int i) {
+        doNotOptimize(matrices[i] * vectors[i]);
+    });
+    bench("Mat4f::transformVector", [&](int i) {
+        doNotOptimize(matrices[i].transformVector(vectors[i]));
+    });
+    bench("Mat4f::invert", [&](int i) {
+        doNotOptimize(matrices[i].invert());
+    });
+    bench("Vec3f::dot", [&](int i) {
+        doNotOptimize(vectors[i].dot(vectors[(i + 1) & (INPUT_COUNT - 1)]));
+    });
+    bench("Vec3f::cross", [&](int i) {
+        doNotOptimize(vectors[i].cross(vectors[(i + 1) & (INPUT_COUNT - 1)]));
+    });
+    bench("Vec3f::normalized", [&](int i) {
+        doNotOptimize(vectors[i].normalized());
+    });
+
+    if (options.output.empty())
+        return 0;
+    json kernels = json::array();
+    for (const KernelResult& result : results) {
+        kernels.push_back({
+            { "name", result.name },
+            { "nsPerOp", result.nsPerOp },
+            { "minNsPerOp", result.minNsPerOp },
+            { "maxNsPerOp", result.maxNsPerOp },
+            { "opsPerSecond", 1e9 / result.nsPerOp },
+            { "opsPerRepetition", result.ops }
+        });
+    }
+    json out = {
+        { "label", options.label },
+        { "time", long(std::time(nullptr)) },
+        { "repetitions", options.repetitions },
+        { "kernels", kernels }
+    };
+    std::ofstream file(options.output);
+    file << out.dump(2) << std::endl;
+    if (!file) {
+        printf("Error: could not write %s\n", options.output.c_str());
+        return 1;
+    }
+    printf("Results written to %s\n", options.output.c_str());
+    return 0;
+}
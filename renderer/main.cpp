@@ -1,13 +1,17 @@
 ﻿#include <iostream>
 
 #include "src/renderer.h"
+#include "src/renderserver.h"
+#include "src/timeline.h"
 
 #include <filesystem>
+#include <thread>
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 #include <stdio.h>
+#include <string.h>
 #define GL_SILENCE_DEPRECATION
 #include <GLFW/glfw3.h>
 
@@ -20,20 +24,41 @@ static void glfw_key_callback(GLFWwindow* window, int key, int scancode, int act
         glfwSetWindowShouldClose(window, GLFW_TRUE);
 }
 
-int main(int argc, char *argv[]) {
-    Renderer renderer;
-    renderer.loadTungstenJSON(argv[1]);
-    renderer.render();
-    return 0;
-
-    GLFWwindow* window;
-    GLuint vertex_buffer, vertex_shader, fragment_shader, program;
-    GLint mvp_location, vpos_location, vcol_location;
+static void usage(const char* program) {
+    printf("Usage: %s [options] scene.json\n"
+           "       %s --serve <port> [--cache-size <n>]\n"
+           "  --output <path>          final image, a .exr (default render.exr) or .pfm next to a tonemapped .png,\n"
+           "                           or a .png alone. Animations write frame_0000 etc. next to it\n"
+           "  --tiled-exr <path>       with --integrator scene, the path tracer also writes each 32x32 block to a tiled\n"
+           "                           EXR as soon as it is rendered\n"
+           "  --no-debug-images        don't write per-iteration debug images\n"
+           "  --preview <path>         write progressive snapshots to a .png, or as PPM frames to any other path\n"
+           "  --preview-interval <s>   seconds between snapshots (default 1)\n"
+           "  --viewer                 show progress in a window while rendering\n"
+           "  --checkpoint <path>      save progress to path and resume from it if it exists\n"
+           "  --checkpoint-interval <n> iterations between checkpoints (default 1)\n"
+           "  --stats <path>           write ray, bounce and split counters per iteration as JSON\n"
+           "  --rrs <technique>        EARS Russian roulette and splitting: none, classic, gwtw, adrrs (default), ears, mixed\n"
+           "  --guiding                EARS also samples directions from its cache's incident radiance\n"
+           "  --async-cache            build the EARS cache in the background, each iteration samples from the one before\n"
+           "  --integrator <name>      ears (default), or scene for the path_tracer or oidn integrator the scene file\n"
+           "                           configures, with adaptive sampling if its renderer settings enable it\n"
+           "  --timeline <path>        write a Chrome trace of the render phases, for chrome://tracing or Perfetto\n"
+           "  --workers <n>            trace on n worker processes, started on this machine unless --listen is given\n"
+           "  --listen <[addr:]port>   wait for the workers to connect on port instead, on the loopback address\n"
+           "                           unless another is given, e.g. 0.0.0.0:port for a trusted network\n"
+           "  --worker <host:port>     serve tiles to a coordinator listening on host:port\n"
+           "  --serve <port>           keep running and take render jobs from local clients on port\n"
+           "  --cache-size <n>         scenes the server keeps loaded and trained (default 4)\n", program, program);
+}
 
+/* Runs the preview window until it is closed or the render finishes and the window is closed.
+ * Returns false if no display is available. */
+static bool runViewer(PreviewStream& preview, const Tonemapper& tonemapper, const char* title) {
     glfwSetErrorCallback(glfw_error_callback);
 
     if (!glfwInit())
-        exit(EXIT_FAILURE);
+        return false;
 
 #if defined(__APPLE__)
     // GL 3.2 + GLSL 150
@@ -51,10 +76,10 @@ int main(int argc, char *argv[]) {
     //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);            // 3.0+ only
 #endif
 
-    window = glfwCreateWindow(1600, 900, "", NULL, NULL);
+    GLFWwindow* window = glfwCreateWindow(1600, 900, "", NULL, NULL);
     if (!window) {
         glfwTerminate();
-        exit(EXIT_FAILURE);
+        return false;
     }
 
     glfwSetKeyCallback(window, glfw_key_callback);
@@ -71,58 +96,54 @@ int main(int argc, char *argv[]) {
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init(glsl_version);
 
-    bool show_render_result = true;
-
-    int tx_tab = 1;
-    int gl_tx_resx = renderer.frame.resx;
-    int gl_tx_resy = renderer.frame.resy;
-    GLuint gl_tx_oidn, gl_tx_color;
-
-    auto color_buf = renderer.frame.tonemap(FrameBuffer::COLOR);
-    glGenTextures(1, &gl_tx_color);
-    glBindTexture(GL_TEXTURE_2D, gl_tx_color);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, gl_tx_resx, gl_tx_resy, 0, GL_RGB, GL_UNSIGNED_BYTE, color_buf.data());
-
-    if (renderer.frame.useOidn) {
-        auto oidn_buf = renderer.frame.tonemap(FrameBuffer::OIDN);
-        glGenTextures(1, &gl_tx_oidn);
-        glBindTexture(GL_TEXTURE_2D, gl_tx_oidn);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, gl_tx_resx, gl_tx_resy, 0, GL_RGB, GL_UNSIGNED_BYTE, oidn_buf.data());
-    }
+    int gl_tx_resx = 0;
+    int gl_tx_resy = 0;
+    GLuint gl_tx_color = 0;
+    std::vector<Vec3c> color_buf;
+    char status[128] = "Waiting for the first snapshot";
 
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
+
+        // upload the newest snapshot, if the renderer published one since the last frame
+        if (const PreviewFrame* snapshot = preview.acquire()) {
+            tonemapper.apply(snapshot->hdr, color_buf);
+            if (!gl_tx_color) {
+                glGenTextures(1, &gl_tx_color);
+                glBindTexture(GL_TEXTURE_2D, gl_tx_color);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            }
+            glBindTexture(GL_TEXTURE_2D, gl_tx_color);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            if (snapshot->resx != gl_tx_resx || snapshot->resy != gl_tx_resy) {
+                gl_tx_resx = snapshot->resx;
+                gl_tx_resy = snapshot->resy;
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, gl_tx_resx, gl_tx_resy, 0, GL_RGB, GL_UNSIGNED_BYTE, color_buf.data());
+            } else {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gl_tx_resx, gl_tx_resy, GL_RGB, GL_UNSIGNED_BYTE, color_buf.data());
+            }
+            if (snapshot->iteration < 0)
+                snprintf(status, sizeof(status), "Frame %d done, %d spp", snapshot->frame, snapshot->spp);
+            else
+                snprintf(status, sizeof(status), "Frame %d, iteration %d, %d spp, %.1fs",
+                         snapshot->frame, snapshot->iteration, snapshot->spp, snapshot->elapsed);
+        }
+
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
-        if (show_render_result) {
-            ImGui::Begin(argv[1]);
+
+        ImGui::Begin(title);
+        ImGui::TextUnformatted(status);
+        if (!preview.finished()) {
             ImGui::SameLine();
-            if (ImGui::Button("color", ImVec2(150, 25)))
-            {
-                tx_tab = 1;
-            }
-            if (renderer.frame.useOidn) {
-                ImGui::SameLine();
-                if (ImGui::Button("oidn", ImVec2(150, 25)))
-                {
-                    tx_tab = 2;
-                }
-            }
-            switch (tx_tab) {
-            case 1:
-                ImGui::Image((void*)(intptr_t)gl_tx_color, ImVec2(800, 800));
-                break;
-            case 2:
-                ImGui::Image((void*)(intptr_t)gl_tx_oidn, ImVec2(800, 800));
-                break;
-            }
-            ImGui::End();
+            if (ImGui::Button(preview.stopRequested() ? "stopping..." : "stop", ImVec2(150, 25)))
+                preview.requestStop();
         }
+        if (gl_tx_color)
+            ImGui::Image((void*)(intptr_t)gl_tx_color, ImVec2(800, 800));
+        ImGui::End();
 
         ImGui::Render();
         int display_w, display_h;
@@ -134,6 +155,9 @@ int main(int argc, char *argv[]) {
         glfwSwapBuffers(window);
     }
 
+    if (gl_tx_color)
+        glDeleteTextures(1, &gl_tx_color);
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -141,5 +165,150 @@ int main(int argc, char *argv[]) {
     glfwDestroyWindow(window);
     glfwTerminate();
 
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    Renderer renderer;
+    const char* sceneFile = nullptr;
+    const char* previewTarget = nullptr;
+    float previewInterval = 1.0f;
+    bool viewer = false;
+    int workers = 0;
+    int listenPort = 0;
+    std::string listenAddress = "127.0.0.1";
+    const char* workerEndpoint = nullptr;
+    int servePort = 0;
+    int cacheSize = 4;
+    const char* timelinePath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-debug-images") == 0)
+            renderer.debugImages = false;
+        else if (strcmp(argv[i], "--tiled-exr") == 0 && i + 1 < argc)
+            renderer.tiledOutputPath = argv[++i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            renderer.outputPath = argv[++i];
+            const std::string extension = std::filesystem::path(renderer.outputPath).extension().string();
+            if (extension != ".png" && extension != ".exr" && extension != ".pfm") {
+                printf("Error: unsupported output format %s, use .png, .exr or .pfm\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--preview") == 0 && i + 1 < argc)
+            previewTarget = argv[++i];
+        else if (strcmp(argv[i], "--preview-interval") == 0 && i + 1 < argc)
+            previewInterval = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--viewer") == 0)
+            viewer = true;
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+            renderer.checkpointPath = argv[++i];
+        else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc)
+            renderer.checkpointInterval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+            renderer.statsPath = argv[++i];
+        else if (strcmp(argv[i], "--guiding") == 0)
+            renderer.guiding = true;
+        else if (strcmp(argv[i], "--async-cache") == 0)
+            renderer.asyncCacheBuild = true;
+        else if (strcmp(argv[i], "--integrator") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (strcmp(name, "ears") != 0 && strcmp(name, "scene") != 0) {
+                printf("Error: unknown integrator %s\n", name);
+                return 1;
+            }
+            renderer.sceneIntegrator = strcmp(name, "scene") == 0;
+        }
+        else if (strcmp(argv[i], "--rrs") == 0 && i + 1 < argc) {
+            if (!EARS::RRSMethod::fromName(argv[++i], renderer.rrs)) {
+                printf("Error: unknown RR/splitting technique %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc)
+            timelinePath = argv[++i];
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            const std::string endpoint = argv[++i];
+            const size_t colon = endpoint.rfind(':');
+            if (colon != std::string::npos)
+                listenAddress = endpoint.substr(0, colon);
+            listenPort = atoi(endpoint.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+        }
+        else if (strcmp(argv[i], "--worker") == 0 && i + 1 < argc)
+            workerEndpoint = argv[++i];
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            servePort = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc)
+            cacheSize = atoi(argv[++i]);
+        else
+            sceneFile = argv[i];
+    }
+    if (servePort > 0) {
+        RenderServer server(size_t(std::max(cacheSize, 1)));
+        return server.serve(servePort) ? 0 : 1;
+    }
+    if (!sceneFile) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (timelinePath) {
+        Timeline::instance().start(timelinePath);
+        Timeline::instance().nameThread("Main");
+    }
+    renderer.loadTungstenJSON(sceneFile);
+
+    if (workerEndpoint) {
+        bool served = TileWorker::serve(workerEndpoint, renderer.scene);
+        Timeline::instance().stop();
+        return served ? 0 : 1;
+    }
+
+    TileCluster cluster;
+    if (workers > 0) {
+        const Vec2i resolution = renderer.scene.camera.resolution();
+        /// workers are started from the same binary, which /proc/self/exe names reliably where it exists
+        const std::string executable = std::filesystem::exists("/proc/self/exe") ? "/proc/self/exe" : argv[0];
+        bool started = listenPort > 0 ? cluster.listen(listenAddress, listenPort, workers, resolution)
+                                      : cluster.spawn(executable, sceneFile, workers, resolution);
+        if (started)
+            renderer.cluster = &cluster;
+        else
+            printf("Error: no workers available, rendering locally\n");
+    }
+
+    PreviewStream preview(previewInterval);
+    if (previewTarget || viewer)
+        renderer.preview = &preview;
+
+    auto render = [&renderer]() {
+        if (renderer.scene.animation.isAnimated())
+            renderer.renderSequence();
+        else
+            renderer.render();
+    };
+
+    unique_ptr<HeadlessPreview> headless;
+    if (previewTarget && !viewer)
+        headless = make_unique<HeadlessPreview>(preview, previewTarget, renderer.frame.tonemapper);
+
+    if (!viewer) {
+        render();
+        Timeline::instance().stop();
+        return 0;
+    }
+
+    // the window owns the main thread, rendering happens next to it
+    std::thread renderThread(render);
+    if (!runViewer(preview, renderer.frame.tonemapper, sceneFile)) {
+        printf("No display available, rendering without the viewer\n");
+        if (previewTarget)
+            headless = make_unique<HeadlessPreview>(preview, previewTarget, renderer.frame.tonemapper);
+    } else {
+        // closing the window ends the render after its current iteration
+        preview.requestStop();
+    }
+    renderThread.join();
+    Timeline::instance().stop();
     return 0;
 }
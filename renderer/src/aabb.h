@@ -10,15 +10,60 @@ public:
         max(std::numeric_limits<Vec3f>::max())
     {};
 
+    AABB(const Vec3f& min, const Vec3f& max) :
+        min(min),
+        max(max)
+    {};
+
+    static AABB empty() {
+        return { Vec3f(F_INFTY), Vec3f(-F_INFTY) };
+    }
+
     void grow(const Vec3f& v) {
         min = v3fmin(min, v);
         max = v3fmax(max, v);
     }
 
+    void grow(const AABB& b) {
+        min = v3fmin(min, b.min);
+        max = v3fmax(max, b.max);
+    }
+
     Vec3f getExtents() const {
         return max - min;
     }
 
+    Vec3f centroid() const {
+        return (min + max) * 0.5f;
+    }
+
+    bool isEmpty() const {
+        return min.x() > max.x() || min.y() > max.y() || min.z() > max.z();
+    }
+
+    float surfaceArea() const {
+        if (isEmpty())
+            return 0.0f;
+        Vec3f e = getExtents();
+        return 2.0f * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+    }
+
+    /* Slab test against [tmin, tmax]; returns the entry distance in tEntry. */
+    bool intersect(const Vec3f& o, const Vec3f& invD, float tmin, float tmax, float& tEntry) const {
+        for (int i = 0; i < 3; i++) {
+            float t0 = (min[i] - o[i]) * invD[i];
+            float t1 = (max[i] - o[i]) * invD[i];
+            if (invD[i] < 0.0f)
+                std::swap(t0, t1);
+            tmin = t0 > tmin ? t0 : tmin;
+            tmax = t1 < tmax ? t1 : tmax;
+            if (tmax < tmin)
+                return false;
+        }
+        tEntry = tmin;
+        return true;
+    }
+
     Vec3f min;
     Vec3f max;
 };
@@ -0,0 +1,120 @@
+#ifndef ADAPTIVESAMPLER_H
+#define ADAPTIVESAMPLER_H
+
+#include "usings.h"
+
+#include <iostream>
+
+/* Distributes a fixed sample budget over the image, taking more samples where the per-pixel error is high.
+ * Every pixel first takes minSpp samples, after which pixels whose relative standard error has fallen below
+ * errorThreshold stop sampling and the remaining budget goes to the noisy ones in passes of sppStep samples. */
+class AdaptiveSampler {
+public:
+    struct Configuration {
+        bool enabled = false;
+        int spp = 16;                 /// average samples per pixel over the whole image
+        int minSpp = 4;               /// samples every pixel takes before its error estimate is trusted
+        int maxSpp = 256;
+        int sppStep = 2;              /// samples added to each unconverged pixel per pass
+        float errorThreshold = 0.02f; /// relative standard error below which a pixel counts as converged
+    };
+
+    /* Running mean of a pixel's radiance, plus the variance of its luminance (Welford). */
+    struct Pixel {
+        int count{0};
+        Vec3f mean{0.0f};
+        float lumMean{0.0f};
+        float lumM2{0.0f};
+
+        void add(const Vec3f &v) {
+            count++;
+            mean += (v - mean) / float(count);
+            float lum = v.luminance();
+            float delta = lum - lumMean;
+            lumMean += delta / float(count);
+            lumM2 += delta * (lum - lumMean);
+        }
+
+        float relativeError() const {
+            if (count < 2)
+                return F_INFTY;
+            float varianceOfMean = lumM2 / float(count - 1) / float(count);
+            return std::sqrt(varianceOfMean / (lumMean * lumMean + 1e-4f));
+        }
+    };
+
+    AdaptiveSampler(int resx, int resy, const Configuration &configuration) :
+        resx(resx),
+        resy(resy),
+        configuration(configuration),
+        pixels(resx * resy)
+    {};
+
+    /**
+     * Samples the image until the budget is spent or every pixel has converged.
+     * sample(px) traces one path through px and returns its radiance.
+     */
+    template<typename SampleFn>
+    void render(SampleFn &&sample) {
+        const long budget = long(configuration.spp) * resx * resy;
+        long spent = 0;
+
+        for (int i = 0; i < resx * resy; i++) {
+            Vec2i px(i % resx, i / resx);
+            for (int s = 0; s < configuration.minSpp; s++)
+                pixels[i].add(sample(px));
+        }
+        spent += long(configuration.minSpp) * resx * resy;
+
+        int pass = 0;
+        std::vector<int> active;
+        while (spent < budget) {
+            active.clear();
+            for (int i = 0; i < resx * resy; i++) {
+                if (pixels[i].count < configuration.maxSpp && pixels[i].relativeError() > configuration.errorThreshold)
+                    active.push_back(i);
+            }
+            if (active.empty())
+                break;
+
+            /// noisiest pixels first, so a partially spent last pass still goes where it helps most
+            std::sort(active.begin(), active.end(), [this](int a, int b) {
+                return pixels[a].relativeError() > pixels[b].relativeError();
+            });
+
+            for (int i : active) {
+                Vec2i px(i % resx, i / resx);
+                for (int s = 0; s < configuration.sppStep && spent < budget && pixels[i].count < configuration.maxSpp; s++) {
+                    pixels[i].add(sample(px));
+                    spent++;
+                }
+                if (spent >= budget)
+                    break;
+            }
+            pass++;
+            std::cout << "Adaptive pass " << pass << ": " << active.size() << " active pixels\r";
+        }
+
+        int converged = 0;
+        for (const Pixel &p : pixels) {
+            if (p.relativeError() <= configuration.errorThreshold)
+                converged++;
+        }
+        printf("\nAdaptive sampling: %d passes, %.2f avg spp, %.1f%% of pixels converged\n",
+               pass, float(spent) / float(resx * resy), 100.0f * float(converged) / float(resx * resy));
+    }
+
+    int count(int px) const {
+        return pixels[px].count;
+    }
+
+    Vec3f mean(int px) const {
+        return pixels[px].mean;
+    }
+
+    int resx, resy;
+    Configuration configuration;
+    std::vector<Pixel> pixels;
+};
+
+#endif
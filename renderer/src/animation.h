@@ -0,0 +1,69 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "usings.h"
+
+struct TransformKey {
+    float frame{0.0f};
+    Vec3f pos{0.0f};
+    Vec3f scale{1.0f};
+    Vec3f rot{0.0f};
+
+    static TransformKey lerp(const TransformKey &a, const TransformKey &b, float t) {
+        return {
+            a.frame + (b.frame - a.frame) * t,
+            a.pos + (b.pos - a.pos) * t,
+            a.scale + (b.scale - a.scale) * t,
+            a.rot + (b.rot - a.rot) * t
+        };
+    }
+};
+
+struct CameraKey {
+    float frame{0.0f};
+    Vec3f eye{0.0f};
+    Vec3f center{0.0f, 0.0f, -1.0f};
+    Vec3f up{0.0f, 1.0f, 0.0f};
+
+    static CameraKey lerp(const CameraKey &a, const CameraKey &b, float t) {
+        return {
+            a.frame + (b.frame - a.frame) * t,
+            a.eye + (b.eye - a.eye) * t,
+            a.center + (b.center - a.center) * t,
+            a.up + (b.up - a.up) * t
+        };
+    }
+};
+
+/* Piecewise linear keyframe track, clamped outside of its first and last key. */
+template<typename Key>
+class Track {
+public:
+    void add(const Key &key) {
+        auto it = std::upper_bound(keys.begin(), keys.end(), key.frame,
+                                   [](float frame, const Key &k) { return frame < k.frame; });
+        keys.insert(it, key);
+    }
+
+    bool empty() const {
+        return keys.empty();
+    }
+
+    Key evaluate(float frame) const {
+        if (frame <= keys.front().frame)
+            return keys.front();
+        if (frame >= keys.back().frame)
+            return keys.back();
+
+        size_t i = 1;
+        while (keys[i].frame < frame)
+            i++;
+        const Key &a = keys[i - 1];
+        const Key &b = keys[i];
+        return Key::lerp(a, b, (frame - a.frame) / (b.frame - a.frame));
+    }
+
+    std::vector<Key> keys;
+};
+
+#endif
@@ -0,0 +1,365 @@
+#include "bvh.h"
+
+#include <atomic>
+#include <chrono>
+
+#include "parallel.h"
+
+namespace {
+
+constexpr int SAH_BIN_COUNT = 16;
+constexpr uint32 PARALLEL_SUBTREE_SIZE = 4096;
+constexpr uint32 MORTON_LEAF_SIZE = 4;
+
+struct BuildContext {
+    const std::vector<AABB> &bounds;
+    const std::vector<Vec3f> &centroids;
+    std::vector<BVH::Node> &nodes;
+    std::vector<uint32> &indices;
+    std::atomic<uint32> nodeCount;
+    TaskGroup tasks;
+
+    BuildContext(const std::vector<AABB> &bounds, const std::vector<Vec3f> &centroids,
+                 std::vector<BVH::Node> &nodes, std::vector<uint32> &indices) :
+        bounds(bounds), centroids(centroids), nodes(nodes), indices(indices), nodeCount(1) {}
+
+    uint32 allocatePair() {
+        return nodeCount.fetch_add(2);
+    }
+};
+
+void makeLeaf(BuildContext &ctx, BVH::Node &node, uint32 begin, uint32 end) {
+    node.start = begin;
+    node.count = end - begin;
+    node.bounds = AABB::empty();
+    for (uint32 i = begin; i < end; i++)
+        node.bounds.grow(ctx.bounds[ctx.indices[i]]);
+}
+
+uint32 medianSplit(BuildContext &ctx, uint32 begin, uint32 end, int axis) {
+    uint32 mid = begin + (end - begin) / 2;
+    std::nth_element(ctx.indices.begin() + begin, ctx.indices.begin() + mid, ctx.indices.begin() + end,
+                     [&](uint32 a, uint32 b) { return ctx.centroids[a][axis] < ctx.centroids[b][axis]; });
+    return mid;
+}
+
+void buildSAH(BuildContext &ctx, uint32 nodeIndex, uint32 begin, uint32 end, int depth) {
+    BVH::Node &node = ctx.nodes[nodeIndex];
+    const uint32 count = end - begin;
+
+    AABB nodeBounds = AABB::empty();
+    AABB centroidBounds = AABB::empty();
+    for (uint32 i = begin; i < end; i++) {
+        nodeBounds.grow(ctx.bounds[ctx.indices[i]]);
+        centroidBounds.grow(ctx.centroids[ctx.indices[i]]);
+    }
+
+    if (count <= 1 || depth >= BVH::MAX_DEPTH - 1) {
+        makeLeaf(ctx, node, begin, end);
+        return;
+    }
+
+    const int axis = int(centroidBounds.getExtents().maxDim());
+    const float axisMin = centroidBounds.min[axis];
+    const float axisExtent = centroidBounds.getExtents()[axis];
+    const float nodeArea = nodeBounds.surfaceArea();
+
+    uint32 mid;
+    if (axisExtent <= 0.0f || nodeArea <= 0.0f) {
+        if (count <= uint32(BVH::MAX_LEAF_SIZE)) {
+            makeLeaf(ctx, node, begin, end);
+            return;
+        }
+        mid = medianSplit(ctx, begin, end, axis);
+    } else {
+        struct Bin {
+            AABB bounds{AABB::empty()};
+            uint32 count{0};
+        } bins[SAH_BIN_COUNT];
+
+        const float scale = SAH_BIN_COUNT / axisExtent;
+        auto binOf = [&](uint32 prim) {
+            int b = int((ctx.centroids[prim][axis] - axisMin) * scale);
+            return std::min(std::max(b, 0), SAH_BIN_COUNT - 1);
+        };
+        for (uint32 i = begin; i < end; i++) {
+            Bin &bin = bins[binOf(ctx.indices[i])];
+            bin.count++;
+            bin.bounds.grow(ctx.bounds[ctx.indices[i]]);
+        }
+
+        /// sweep from the right to get the cost of every split plane in linear time
+        float rightArea[SAH_BIN_COUNT];
+        uint32 rightCount[SAH_BIN_COUNT];
+        AABB accum = AABB::empty();
+        uint32 accumCount = 0;
+        for (int b = SAH_BIN_COUNT - 1; b > 0; b--) {
+            accum.grow(bins[b].bounds);
+            accumCount += bins[b].count;
+            rightArea[b] = accum.surfaceArea();
+            rightCount[b] = accumCount;
+        }
+
+        int bestSplit = -1;
+        float bestCost = F_INFTY;
+        accum = AABB::empty();
+        accumCount = 0;
+        for (int b = 0; b < SAH_BIN_COUNT - 1; b++) {
+            accum.grow(bins[b].bounds);
+            accumCount += bins[b].count;
+            if (accumCount == 0 || rightCount[b + 1] == 0)
+                continue;
+            float cost = BVH::COST_TRAVERSAL + BVH::COST_INTERSECT *
+                (accum.surfaceArea() * accumCount + rightArea[b + 1] * rightCount[b + 1]) / nodeArea;
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = b;
+            }
+        }
+
+        const float leafCost = BVH::COST_INTERSECT * count;
+        if (count <= uint32(BVH::MAX_LEAF_SIZE) && (bestSplit < 0 || bestCost >= leafCost)) {
+            makeLeaf(ctx, node, begin, end);
+            return;
+        }
+
+        if (bestSplit < 0) {
+            mid = medianSplit(ctx, begin, end, axis);
+        } else {
+            auto split = std::partition(ctx.indices.begin() + begin, ctx.indices.begin() + end,
+                                        [&](uint32 prim) { return binOf(prim) <= bestSplit; });
+            mid = uint32(split - ctx.indices.begin());
+            if (mid == begin || mid == end)
+                mid = medianSplit(ctx, begin, end, axis);
+        }
+    }
+
+    node.bounds = nodeBounds;
+    node.count = 0;
+    const uint32 children = ctx.allocatePair();
+    node.left = children;
+    node.right = children + 1;
+
+    if (count > PARALLEL_SUBTREE_SIZE) {
+        ctx.tasks.run([&ctx, children, begin, mid, depth]() {
+            buildSAH(ctx, children, begin, mid, depth + 1);
+        });
+    } else {
+        buildSAH(ctx, children, begin, mid, depth + 1);
+    }
+    buildSAH(ctx, children + 1, mid, end, depth + 1);
+}
+
+uint32 expandBits(uint32 v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+uint32 morton3D(const Vec3f &unit) {
+    uint32 x = uint32(std::min(std::max(unit.x() * 1024.0f, 0.0f), 1023.0f));
+    uint32 y = uint32(std::min(std::max(unit.y() * 1024.0f, 0.0f), 1023.0f));
+    uint32 z = uint32(std::min(std::max(unit.z() * 1024.0f, 0.0f), 1023.0f));
+    return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+}
+
+int highestBit(uint32 v) {
+    int bit = -1;
+    while (v) {
+        v >>= 1;
+        bit++;
+    }
+    return bit;
+}
+
+void buildMortonRange(BuildContext &ctx, const std::vector<uint32> &codes, uint32 nodeIndex,
+                      uint32 begin, uint32 end, int depth) {
+    BVH::Node &node = ctx.nodes[nodeIndex];
+    const uint32 count = end - begin;
+
+    if (count <= MORTON_LEAF_SIZE || depth >= BVH::MAX_DEPTH - 1) {
+        makeLeaf(ctx, node, begin, end);
+        return;
+    }
+
+    uint32 mid;
+    const uint32 first = codes[begin];
+    const uint32 last = codes[end - 1];
+    if (first == last) {
+        mid = begin + count / 2;
+    } else {
+        /// split where the highest differing bit of the (sorted) range flips
+        const uint32 bit = 1u << highestBit(first ^ last);
+        mid = uint32(std::partition_point(codes.begin() + begin, codes.begin() + end,
+                                          [bit](uint32 code) { return (code & bit) == 0; }) - codes.begin());
+    }
+
+    node.count = 0;
+    const uint32 children = ctx.allocatePair();
+    node.left = children;
+    node.right = children + 1;
+
+    if (count > PARALLEL_SUBTREE_SIZE) {
+        ctx.tasks.run([&ctx, &codes, children, begin, mid, depth]() {
+            buildMortonRange(ctx, codes, children, begin, mid, depth + 1);
+        });
+    } else {
+        buildMortonRange(ctx, codes, children, begin, mid, depth + 1);
+    }
+    buildMortonRange(ctx, codes, children + 1, mid, end, depth + 1);
+}
+
+AABB fitInteriorBounds(std::vector<BVH::Node> &nodes, uint32 index) {
+    BVH::Node &node = nodes[index];
+    if (!node.isLeaf()) {
+        node.bounds = fitInteriorBounds(nodes, node.left);
+        node.bounds.grow(fitInteriorBounds(nodes, node.right));
+    }
+    return node.bounds;
+}
+
+}
+
+void BVH::build(const std::vector<AABB> &primitiveBounds, Builder builder) {
+    auto start = std::chrono::steady_clock::now();
+
+    const uint32 count = uint32(primitiveBounds.size());
+    nodes.clear();
+    indices.resize(count);
+    for (uint32 i = 0; i < count; i++)
+        indices[i] = i;
+
+    m_stats = Stats();
+    m_stats.builder = builder;
+    m_stats.primitiveCount = count;
+
+    if (count > 0) {
+        std::vector<Vec3f> centroids(count);
+        const int blocks = int(std::min<uint32>(threadCount() * 4, count / 16384 + 1));
+        parallelFor(blocks, [&](int b) {
+            uint32 begin = uint32(uint64(count) * b / blocks);
+            uint32 end = uint32(uint64(count) * (b + 1) / blocks);
+            for (uint32 i = begin; i < end; i++)
+                centroids[i] = primitiveBounds[i].centroid();
+        });
+
+        if (builder == Builder::Morton)
+            buildMorton(primitiveBounds, centroids);
+        else
+            buildBinnedSAH(primitiveBounds, centroids);
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    m_stats.buildMs = std::chrono::duration<float, std::milli>(elapsed).count();
+    computeStats();
+    m_stats.builtSahCost = m_stats.sahCost;
+}
+
+void BVH::refit(const std::vector<AABB> &primitiveBounds) {
+    /// children are always allocated after their parent, so a reverse sweep visits them first
+    for (size_t n = nodes.size(); n-- > 0;) {
+        Node &node = nodes[n];
+        node.bounds = AABB::empty();
+        if (node.isLeaf()) {
+            for (uint32 i = node.start; i < node.start + node.count; i++)
+                node.bounds.grow(primitiveBounds[indices[i]]);
+        } else {
+            node.bounds.grow(nodes[node.left].bounds);
+            node.bounds.grow(nodes[node.right].bounds);
+        }
+    }
+    m_stats.refitCount++;
+    m_stats.leafCount = 0;
+    m_stats.maxDepth = 0;
+    computeStats();
+}
+
+void BVH::buildBinnedSAH(const std::vector<AABB> &bounds, const std::vector<Vec3f> &centroids) {
+    nodes.resize(2 * bounds.size() - 1);
+    BuildContext ctx(bounds, centroids, nodes, indices);
+    buildSAH(ctx, 0, 0, uint32(bounds.size()), 0);
+    ctx.tasks.wait();
+    nodes.resize(ctx.nodeCount.load());
+}
+
+void BVH::buildMorton(const std::vector<AABB> &bounds, const std::vector<Vec3f> &centroids) {
+    const uint32 count = uint32(bounds.size());
+
+    AABB centroidBounds = AABB::empty();
+    for (const auto &c : centroids)
+        centroidBounds.grow(c);
+    Vec3f extent = centroidBounds.getExtents();
+    for (int i = 0; i < 3; i++)
+        extent[i] = extent[i] > 0.0f ? extent[i] : 1.0f;
+
+    std::vector<uint32> mortonCodes(count);
+    const int blocks = int(std::min<uint32>(threadCount() * 4, count / 16384 + 1));
+    parallelFor(blocks, [&](int b) {
+        uint32 begin = uint32(uint64(count) * b / blocks);
+        uint32 end = uint32(uint64(count) * (b + 1) / blocks);
+        for (uint32 i = begin; i < end; i++)
+            mortonCodes[i] = morton3D((centroids[i] - centroidBounds.min) / extent);
+    });
+
+    std::sort(indices.begin(), indices.end(), [&](uint32 a, uint32 b) {
+        return mortonCodes[a] < mortonCodes[b];
+    });
+    std::vector<uint32> sortedCodes(count);
+    for (uint32 i = 0; i < count; i++)
+        sortedCodes[i] = mortonCodes[indices[i]];
+
+    nodes.resize(2 * count - 1);
+    BuildContext ctx(bounds, centroids, nodes, indices);
+    buildMortonRange(ctx, sortedCodes, 0, 0, count, 0);
+    ctx.tasks.wait();
+    nodes.resize(ctx.nodeCount.load());
+    fitInteriorBounds(nodes, 0);
+}
+
+void BVH::computeStats() {
+    m_stats.nodeCount = uint32(nodes.size());
+    if (nodes.empty())
+        return;
+
+    const float rootArea = nodes[0].bounds.surfaceArea();
+    const float invRootArea = rootArea > 0.0f ? 1.0f / rootArea : 0.0f;
+
+    struct Entry {
+        uint32 index;
+        uint32 depth;
+    };
+    std::vector<Entry> stack{{0, 1}};
+    float cost = 0.0f;
+    while (!stack.empty()) {
+        Entry e = stack.back();
+        stack.pop_back();
+        const Node &node = nodes[e.index];
+        const float relativeArea = rootArea > 0.0f ? node.bounds.surfaceArea() * invRootArea : 1.0f;
+        m_stats.maxDepth = std::max(m_stats.maxDepth, e.depth);
+        if (node.isLeaf()) {
+            m_stats.leafCount++;
+            cost += relativeArea * COST_INTERSECT * node.count;
+        } else {
+            cost += relativeArea * COST_TRAVERSAL;
+            stack.push_back({node.left, e.depth + 1});
+            stack.push_back({node.right, e.depth + 1});
+        }
+    }
+    m_stats.sahCost = cost;
+}
+
+void BVH::printStats() const {
+    printf("BVH built [%s, %u primitives, %u nodes, %u leaves, depth %u, SAH cost %.2f, %.2f ms]\n",
+           builderName(m_stats.builder),
+           m_stats.primitiveCount,
+           m_stats.nodeCount,
+           m_stats.leafCount,
+           m_stats.maxDepth,
+           m_stats.sahCost,
+           m_stats.buildMs
+    );
+    if (m_stats.refitCount > 0)
+        printf("  refitted %u times, SAH cost %.2f at build\n", m_stats.refitCount, m_stats.builtSahCost);
+}
@@ -0,0 +1,135 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "usings.h"
+
+#include "aabb.h"
+#include "ray.h"
+
+/* Bounding volume hierarchy over an indexed set of primitive bounds.
+ * The hierarchy only stores primitive indices; callers supply the actual intersection test. */
+class BVH {
+public:
+    enum class Builder {
+        BinnedSAH, /// high quality, parallel over subtrees
+        Morton     /// linear BVH from sorted morton codes, fast to build for previews
+    };
+
+    struct Node {
+        AABB bounds{AABB::empty()};
+        uint32 left{0};
+        uint32 right{0};
+        uint32 start{0};
+        uint32 count{0};
+
+        bool isLeaf() const { return count > 0; }
+    };
+
+    struct Stats {
+        Builder builder{Builder::BinnedSAH};
+        float buildMs{0.0f};
+        float sahCost{0.0f};
+        float builtSahCost{0.0f}; /// cost right after the last full build, for judging refits
+        uint32 refitCount{0};
+        uint32 primitiveCount{0};
+        uint32 nodeCount{0};
+        uint32 leafCount{0};
+        uint32 maxDepth{0};
+    };
+
+    static constexpr float COST_TRAVERSAL = 1.0f;
+    static constexpr float COST_INTERSECT = 1.0f;
+    static constexpr int MAX_LEAF_SIZE = 8;
+    static constexpr int MAX_DEPTH = 128;
+
+    static Builder builderFromString(const std::string &name) {
+        return name == "morton" || name == "lbvh" ? Builder::Morton : Builder::BinnedSAH;
+    }
+
+    static const char *builderName(Builder builder) {
+        return builder == Builder::Morton ? "morton" : "sah";
+    }
+
+    void build(const std::vector<AABB> &primitiveBounds, Builder builder = Builder::BinnedSAH);
+
+    /**
+     * Updates node bounds for moved primitives while keeping the topology. Much cheaper than a build,
+     * but tree quality degrades as primitives drift away from where they were when the tree was built.
+     */
+    void refit(const std::vector<AABB> &primitiveBounds);
+
+    /**
+     * Whether the refitted tree has become more than \c threshold times as expensive as when it was built.
+     */
+    bool needsRebuild(float threshold) const {
+        return m_stats.builtSahCost > 0.0f && m_stats.sahCost > threshold * m_stats.builtSahCost;
+    }
+
+    /**
+     * Visits the primitives whose bounds the ray overlaps, nearest node first.
+     * intersectPrimitive(index, ray) must shrink ray.tfar() on a hit.
+     */
+    template<typename IntersectFn>
+    bool intersect(Ray &ray, IntersectFn &&intersectPrimitive) const {
+        if (nodes.empty())
+            return false;
+
+        const Vec3f o = ray.p();
+        const Vec3f invD = 1.0f / ray.d();
+
+        uint32 stack[MAX_DEPTH];
+        int stackSize = 0;
+        uint32 current = 0;
+        bool hit = false;
+
+        float tEntry;
+        if (!nodes[0].bounds.intersect(o, invD, ray.tnear(), ray.tfar(), tEntry))
+            return false;
+
+        while (true) {
+            const Node &node = nodes[current];
+            if (node.isLeaf()) {
+                for (uint32 i = node.start; i < node.start + node.count; i++)
+                    hit |= intersectPrimitive(indices[i], ray);
+            } else {
+                float tLeft, tRight;
+                bool hitLeft = nodes[node.left].bounds.intersect(o, invD, ray.tnear(), ray.tfar(), tLeft);
+                bool hitRight = nodes[node.right].bounds.intersect(o, invD, ray.tnear(), ray.tfar(), tRight);
+                if (hitLeft && hitRight) {
+                    uint32 nearChild = tLeft <= tRight ? node.left : node.right;
+                    uint32 farChild = tLeft <= tRight ? node.right : node.left;
+                    if (stackSize < MAX_DEPTH)
+                        stack[stackSize++] = farChild;
+                    current = nearChild;
+                    continue;
+                } else if (hitLeft) {
+                    current = node.left;
+                    continue;
+                } else if (hitRight) {
+                    current = node.right;
+                    continue;
+                }
+            }
+            if (stackSize == 0)
+                break;
+            current = stack[--stackSize];
+        }
+        return hit;
+    }
+
+    const Stats &stats() const { return m_stats; }
+
+    void printStats() const;
+
+    std::vector<Node> nodes;
+    std::vector<uint32> indices;
+
+private:
+    void buildBinnedSAH(const std::vector<AABB> &bounds, const std::vector<Vec3f> &centroids);
+    void buildMorton(const std::vector<AABB> &bounds, const std::vector<Vec3f> &centroids);
+    void computeStats();
+
+    Stats m_stats;
+};
+
+#endif
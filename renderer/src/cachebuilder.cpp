@@ -0,0 +1,97 @@
+#include "cachebuilder.h"
+
+#include "timeline.h"
+
+namespace EARS {
+
+AsyncCacheBuilder::AsyncCacheBuilder() {
+    m_worker = std::thread([this]() { run(); });
+}
+
+AsyncCacheBuilder::~AsyncCacheBuilder() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    m_worker.join();
+}
+
+void AsyncCacheBuilder::waitIdle(std::unique_lock<std::mutex> &lock) {
+    m_wakeup.wait(lock, [this]() { return !m_pending; });
+}
+
+void AsyncCacheBuilder::start(Octtree &cache) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    waitIdle(lock);
+    m_tree = cache;
+    cache.clearTraining();
+    m_active = true;
+}
+
+void AsyncCacheBuilder::resume(Octtree built) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    waitIdle(lock);
+    m_tree = std::move(built);
+    m_active = true;
+    m_built = false;
+}
+
+void AsyncCacheBuilder::submit(Octtree &cache, bool needsSplitting) {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        waitIdle(lock);
+        reportBuild();
+        m_tree.mergeTrainingFrom(cache);
+        cache.syncFrom(m_tree);
+        m_needsSplitting = needsSplitting;
+        m_pending = true;
+    }
+    m_wakeup.notify_all();
+}
+
+void AsyncCacheBuilder::finish(Octtree &cache) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    waitIdle(lock);
+    reportBuild();
+    m_tree.mergeTrainingFrom(cache);
+    cache = std::move(m_tree);
+    m_active = false;
+}
+
+void AsyncCacheBuilder::reportBuild() {
+    /// printed from here rather than the builder thread so it doesn't end up in the middle of the progress output
+    if (m_built)
+        m_tree.printBuildSummary();
+    m_built = false;
+}
+
+const Octtree &AsyncCacheBuilder::tree() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    waitIdle(lock);
+    return m_tree;
+}
+
+void AsyncCacheBuilder::run() {
+    Timeline::instance().nameThread("Cache builder");
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this]() { return m_stop || m_pending; });
+            if (m_stop)
+                return;
+        }
+
+        /// m_tree is only touched by submit() and finish() while no build is pending
+        m_tree.build(m_needsSplitting, false);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending = false;
+            m_built = true;
+        }
+        m_wakeup.notify_all();
+    }
+}
+
+};
@@ -0,0 +1,72 @@
+#ifndef CACHEBUILDER_H
+#define CACHEBUILDER_H
+
+#include "usings.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "octtree.h"
+
+namespace EARS {
+
+/* Builds the EARS cache on its own thread while the next iteration renders.
+ * The tracer samples from and splats into its own copy of the tree, which stays untouched while it renders. At every
+ * iteration boundary the copy's training data is merged into the builder's tree, the copy takes over what the build
+ * in flight learned and the next build starts. The copy therefore samples from the build before the last one, the
+ * same lag the denoised estimates have. Merging and handing over only visit the regions that changed. */
+class AsyncCacheBuilder {
+public:
+    AsyncCacheBuilder();
+    ~AsyncCacheBuilder();
+
+    AsyncCacheBuilder(const AsyncCacheBuilder &) = delete;
+    AsyncCacheBuilder &operator=(const AsyncCacheBuilder &) = delete;
+
+    /* Takes over cache's training data, cache keeps what it has learned and is rendered with from now on. */
+    void start(Octtree &cache);
+
+    /* Like start(), but the builder's tree is built, a build that had not been handed over when it was checkpointed. */
+    void resume(Octtree built);
+
+    /**
+     * Merges the training data splatted into cache since the last call into the builder's tree, waiting for the
+     * build in flight first, and updates cache with that build. Then builds the tree again in the background.
+     */
+    void submit(Octtree &cache, bool needsSplitting);
+
+    /**
+     * Waits for the build in flight and hands the whole tree back to cache, training data and all, along with any
+     * training data splatted into cache since the last submit(). The builder is idle afterwards.
+     */
+    void finish(Octtree &cache);
+
+    /* Waits for the build in flight, e.g. to checkpoint the tree. */
+    const Octtree &tree();
+
+    /* Whether a tree has been taken over and not yet handed back. */
+    bool isActive() const {
+        return m_active;
+    }
+
+private:
+    void run();
+    void waitIdle(std::unique_lock<std::mutex> &lock);
+    void reportBuild();
+
+    Octtree m_tree;       /// only touched by the builder thread while a build is pending
+    bool m_active{false};
+    bool m_needsSplitting{false};
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::thread m_worker;
+    bool m_pending{false}; /// a build has been started but not finished
+    bool m_built{false};   /// a build has finished whose summary has not been printed
+    bool m_stop{false};
+};
+
+};
+
+#endif
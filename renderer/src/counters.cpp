@@ -0,0 +1,56 @@
+#include "counters.h"
+
+#include <cstdio>
+#include <mutex>
+
+static std::mutex registryMutex;
+static std::vector<ThreadCounters *> registry;
+static RenderCounters retired; /// counts of threads that have exited since the last collect
+
+ThreadCounters::ThreadCounters() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry.push_back(this);
+}
+
+ThreadCounters::~ThreadCounters() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    retired += counts;
+    registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+}
+
+RenderCounters collectCounters() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    RenderCounters total = retired;
+    retired = RenderCounters();
+    for (ThreadCounters *counters : registry) {
+        total += counters->counts;
+        counters->counts = RenderCounters();
+    }
+    return total;
+}
+
+void RenderCounters::print(float seconds) const {
+    auto rate = [seconds](uint64 count) {
+        return seconds > 0 ? double(count) / seconds * 1e-6 : 0.0;
+    };
+    printf("Counters:\n"
+           "  Camera rays       = %llu\n"
+           "  Shadow rays       = %llu\n"
+           "  BSDF rays         = %llu\n"
+           "  Rays              = %llu (%.2f Mrays/s)\n"
+           "  Intersect tests   = %llu (%.1f per ray)\n"
+           "  Octree lookups    = %llu\n"
+           "  RR kills          = %llu\n"
+           "  Splits            = %llu\n"
+           "  Paths             = %llu (%.3f vertices on average)\n",
+        (unsigned long long)cameraRays,
+        (unsigned long long)shadowRays,
+        (unsigned long long)bsdfRays,
+        (unsigned long long)rays(), rate(rays()),
+        (unsigned long long)intersectionTests, rays() > 0 ? double(intersectionTests) / double(rays()) : 0.0,
+        (unsigned long long)octreeLookups,
+        (unsigned long long)rrKills,
+        (unsigned long long)splits,
+        (unsigned long long)paths, averagePathLength()
+    );
+}
@@ -0,0 +1,69 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include "usings.h"
+
+/* Event counts of the tracing kernels. Plain integers bumped by the thread doing the work. */
+struct RenderCounters {
+    uint64 cameraRays{0};
+    uint64 shadowRays{0};
+    uint64 bsdfRays{0};
+    uint64 intersectionTests{0}; /// primitives tested by the BVH traversal
+    uint64 octreeLookups{0};
+    uint64 rrKills{0};           /// vertices where russian roulette ended the path
+    uint64 splits{0};            /// samples taken beyond the first at a splitting vertex
+    uint64 paths{0};             /// path ends, one per camera ray unless paths were split
+    uint64 pathVertices{0};      /// sum of the depths the paths ended at
+
+    RenderCounters &operator+=(const RenderCounters &other) {
+        cameraRays += other.cameraRays;
+        shadowRays += other.shadowRays;
+        bsdfRays += other.bsdfRays;
+        intersectionTests += other.intersectionTests;
+        octreeLookups += other.octreeLookups;
+        rrKills += other.rrKills;
+        splits += other.splits;
+        paths += other.paths;
+        pathVertices += other.pathVertices;
+        return *this;
+    }
+
+    uint64 rays() const {
+        return cameraRays + shadowRays + bsdfRays;
+    }
+
+    float averagePathLength() const {
+        return paths > 0 ? float(pathVertices) / float(paths) : 0.0f;
+    }
+
+    /* Prints the counts, with rates over seconds if they are known. */
+    void print(float seconds = 0.0f) const;
+};
+
+/* Registers a thread's counters for collectCounters(), and keeps their counts once the thread exits. */
+struct ThreadCounters {
+    ThreadCounters();
+    ~ThreadCounters();
+
+    ThreadCounters(const ThreadCounters &) = delete;
+    ThreadCounters &operator=(const ThreadCounters &) = delete;
+
+    RenderCounters counts;
+};
+
+/**
+ * Counters of the calling thread. Every thread gets its own, so counting is a plain increment with no
+ * sharing between threads; collectCounters() adds them up.
+ */
+inline RenderCounters &threadCounters() {
+    thread_local ThreadCounters counters;
+    return counters.counts;
+}
+
+/**
+ * Sums the counters of all threads, including those that have exited, and resets them.
+ * Only exact while no thread is tracing, e.g. between the passes of an integrator.
+ */
+RenderCounters collectCounters();
+
+#endif
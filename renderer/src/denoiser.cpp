@@ -0,0 +1,109 @@
+#include "denoiser.h"
+
+#include "timeline.h"
+
+AsyncDenoiser::AsyncDenoiser(int resx, int resy) :
+    resx(resx),
+    resy(resy),
+    m_color(resx, resy),
+    m_albedo(resx, resy),
+    m_normal(resx, resy),
+    m_output(resx, resy),
+    m_result(resx, resy)
+{
+    m_device = oidnNewDevice(OIDN_DEVICE_TYPE_DEFAULT);
+    oidnCommitDevice(m_device);
+
+    m_filter = oidnNewFilter(m_device, "RT");
+    oidnSetSharedFilterImage(m_filter, "color", m_color.data(), OIDN_FORMAT_FLOAT3, resx, resy, 0, 0, 0);
+    oidnSetSharedFilterImage(m_filter, "albedo", m_albedo.data(), OIDN_FORMAT_FLOAT3, resx, resy, 0, 0, 0);
+    oidnSetSharedFilterImage(m_filter, "normal", m_normal.data(), OIDN_FORMAT_FLOAT3, resx, resy, 0, 0, 0);
+    oidnSetSharedFilterImage(m_filter, "output", m_output.data(), OIDN_FORMAT_FLOAT3, resx, resy, 0, 0, 0);
+    oidnSetFilter1b(m_filter, "hdr", true);
+    oidnCommitFilter(m_filter);
+
+    m_worker = std::thread([this]() { run(); });
+}
+
+AsyncDenoiser::~AsyncDenoiser() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    m_worker.join();
+
+    oidnReleaseFilter(m_filter);
+    oidnReleaseDevice(m_device);
+}
+
+void AsyncDenoiser::waitIdle(std::unique_lock<std::mutex> &lock) {
+    m_wakeup.wait(lock, [this]() { return !m_pending; });
+}
+
+void AsyncDenoiser::setAuxiliaries(const Film &albedo, const Film &normal) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    waitIdle(lock);
+    /// copy element-wise, the filter is bound to these buffers' storage
+    std::copy(albedo.buffer.begin(), albedo.buffer.end(), m_albedo.buffer.begin());
+    std::copy(normal.buffer.begin(), normal.buffer.end(), m_normal.buffer.begin());
+}
+
+int AsyncDenoiser::takeResult(Film &output) {
+    if (!m_hasResult)
+        return -1;
+    std::copy(m_result.buffer.begin(), m_result.buffer.end(), output.buffer.begin());
+    m_hasResult = false;
+    return m_resultTag;
+}
+
+int AsyncDenoiser::submit(const Film &color, int tag, Film &previous) {
+    int previousTag;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        waitIdle(lock);
+        previousTag = takeResult(previous);
+        std::copy(color.buffer.begin(), color.buffer.end(), m_color.buffer.begin());
+        m_jobTag = tag;
+        m_pending = true;
+    }
+    m_wakeup.notify_all();
+    return previousTag;
+}
+
+int AsyncDenoiser::finish(Film &output) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    waitIdle(lock);
+    return takeResult(output);
+}
+
+void AsyncDenoiser::run() {
+    Timeline::instance().nameThread("Denoiser");
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this]() { return m_stop || m_pending; });
+            if (m_stop)
+                return;
+        }
+
+        /// m_color, m_albedo and m_normal are only written while no job is pending
+        {
+            TimelineScope scope("OIDN", "tag", m_jobTag);
+            oidnExecuteFilter(m_filter);
+        }
+
+        const char* errorMessage;
+        if (oidnGetDeviceError(m_device, &errorMessage) != OIDN_ERROR_NONE)
+            printf("Error: %s\n", errorMessage);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::copy(m_output.buffer.begin(), m_output.buffer.end(), m_result.buffer.begin());
+            m_resultTag = m_jobTag;
+            m_hasResult = true;
+            m_pending = false;
+        }
+        m_wakeup.notify_all();
+    }
+}
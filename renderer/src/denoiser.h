@@ -0,0 +1,71 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "usings.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <OpenImageDenoise/oidn.h>
+
+#include "framebuffer.h"
+
+/* OIDN "RT" filter running on its own thread.
+ * The device and filter are created once and bound to buffers owned by the denoiser, so each job only copies
+ * its input into a snapshot and executes the already committed filter. At most one job is in flight. */
+class AsyncDenoiser {
+public:
+    AsyncDenoiser(int resx, int resy);
+    ~AsyncDenoiser();
+
+    AsyncDenoiser(const AsyncDenoiser &) = delete;
+    AsyncDenoiser &operator=(const AsyncDenoiser &) = delete;
+
+    /**
+     * Replaces the albedo and normal auxiliaries used by the following jobs.
+     * Waits for a running job first, its result is kept for the next fetch().
+     */
+    void setAuxiliaries(const Film &albedo, const Film &normal);
+
+    /**
+     * Starts denoising a copy of color in the background. If the previous job is still running this waits for
+     * it first. The previous job's result is copied into previous and its tag returned, -1 if there was none.
+     * Handing results over here rather than whenever they happen to be ready keeps renders reproducible.
+     */
+    int submit(const Film &color, int tag, Film &previous);
+
+    /* Waits for the job in flight and copies its result into output. Returns its tag, -1 if there was none. */
+    int finish(Film &output);
+
+    Vec2i size() const {
+        return { resx, resy };
+    }
+
+private:
+    void run();
+    void waitIdle(std::unique_lock<std::mutex> &lock);
+    int takeResult(Film &output);
+
+    int resx, resy;
+
+    OIDNDevice m_device;
+    OIDNFilter m_filter;
+
+    Film m_color;
+    Film m_albedo;
+    Film m_normal;
+    Film m_output;
+    Film m_result; /// last finished output, so a new job can start before it is taken
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::thread m_worker;
+    bool m_pending{false};  /// a job has been submitted but not finished
+    bool m_hasResult{false};
+    bool m_stop{false};
+    int m_jobTag{-1};
+    int m_resultTag{-1};
+};
+
+#endif
@@ -0,0 +1,618 @@
+#include "distributed.h"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "streamio.h"
+#include "timeline.h"
+
+/// tiles queued per worker, so it has the next one at hand while its last result is on the way
+static constexpr size_t TILES_IN_FLIGHT = 2;
+static constexpr int TILE_SIZE = 32;
+/// larger than any cache a render can hold, a bigger size means the peer is not one of ours
+static constexpr uint64 MAX_PAYLOAD_BYTES = uint64(1) << 30;
+
+/* uint32 type, then uint64 payload size, packed so no padding goes over the wire. */
+static constexpr size_t HEADER_BYTES = sizeof(uint32) + sizeof(uint64);
+
+#ifndef _WIN32
+
+static bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::send(fd, data, size, 0);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        size -= size_t(written);
+    }
+    return true;
+}
+
+static bool readAll(int fd, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t received = ::recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        data += received;
+        size -= size_t(received);
+    }
+    return true;
+}
+
+static void closeDescriptor(int fd) {
+    ::close(fd);
+}
+
+/* Tile requests are tiny and answered right away, don't let them sit in Nagle's buffer. */
+static void disableNagle(int fd) {
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+}
+
+#else
+
+static bool writeAll(int, const char *, size_t) { return false; }
+static bool readAll(int, char *, size_t) { return false; }
+static void closeDescriptor(int) {}
+
+#endif
+
+TileChannel::~TileChannel() {
+    close();
+}
+
+TileChannel::TileChannel(TileChannel &&other) noexcept : m_fd(other.m_fd) {
+    other.m_fd = -1;
+}
+
+TileChannel &TileChannel::operator=(TileChannel &&other) noexcept {
+    if (this != &other) {
+        close();
+        m_fd = other.m_fd;
+        other.m_fd = -1;
+    }
+    return *this;
+}
+
+bool TileChannel::send(Message type, const std::string &payload) {
+    if (m_fd < 0)
+        return false;
+    const uint32 typeValue = uint32(type);
+    const uint64 size = payload.size();
+    char header[HEADER_BYTES];
+    std::memcpy(header, &typeValue, sizeof(typeValue));
+    std::memcpy(header + sizeof(typeValue), &size, sizeof(size));
+    return writeAll(m_fd, header, sizeof(header)) && writeAll(m_fd, payload.data(), payload.size());
+}
+
+bool TileChannel::receive(Message &type, std::string &payload) {
+    if (m_fd < 0)
+        return false;
+    char header[HEADER_BYTES];
+    if (!readAll(m_fd, header, sizeof(header)))
+        return false;
+    uint32 typeValue;
+    uint64 size;
+    std::memcpy(&typeValue, header, sizeof(typeValue));
+    std::memcpy(&size, header + sizeof(typeValue), sizeof(size));
+    if (typeValue > uint32(Message::Shutdown) || size > MAX_PAYLOAD_BYTES) {
+        printf("Error: received a malformed message (type %u, %llu bytes), closing the connection\n",
+               typeValue, (unsigned long long)size);
+        close();
+        return false;
+    }
+    type = Message(typeValue);
+    payload.resize(size);
+    return readAll(m_fd, payload.data(), payload.size());
+}
+
+void TileChannel::close() {
+    if (m_fd >= 0)
+        closeDescriptor(m_fd);
+    m_fd = -1;
+}
+
+void TileResult::saveState(std::ostream &out) const {
+    streamWrite(out, request);
+    streamWrite(out, radiance);
+    statistics.saveState(out);
+    streamWrite(out, depthAcc);
+    streamWrite(out, depthWeight);
+    streamWrite(out, primarySplit);
+    streamWrite(out, samplesTaken);
+    streamWrite(out, counters);
+}
+
+void TileResult::loadState(std::istream &in) {
+    streamRead(in, request);
+    streamRead(in, radiance);
+    statistics.loadState(in);
+    streamRead(in, depthAcc);
+    streamRead(in, depthWeight);
+    streamRead(in, primarySplit);
+    streamRead(in, samplesTaken);
+    streamRead(in, counters);
+}
+
+void renderTile(EARSTracer &tracer, const TileRequest &request, TileResult &result) {
+    TimelineScope scope("Tile", "index", request.index);
+    result.request = request;
+    result.radiance.assign(size_t(request.width) * request.height, Vec3f(0.0f));
+
+    EARS::OutlierRejectedAverage blockStatistics;
+    blockStatistics.resize(10);
+    if (request.hasOutlierBound)
+        blockStatistics.setRemoteOutlierLowerBound(request.outlierBound);
+    tracer.blockStatistics = blockStatistics;
+    tracer.resetBlockAccumulators();
+
+    UniformPathSampler sampler(request.seed);
+    for (int y = 0; y < request.height; y++) {
+        for (int x = 0; x < request.width; x++) {
+            Vec2i px(request.blockX + x, request.blockY + y);
+            sampler.startPath(px.x() + px.y(), 0xFFFF);
+            result.radiance[y * request.width + x] = tracer.trace(px, sampler);
+        }
+    }
+
+    result.statistics = tracer.blockStatistics;
+    result.depthAcc = tracer.depthAcc;
+    result.depthWeight = tracer.depthWeight;
+    result.primarySplit = tracer.primarySplit;
+    result.samplesTaken = tracer.samplesTaken;
+}
+
+/* Seeds a tile's sampler from where it is in the render, independent of which worker traces it. */
+static uint32 tileSeed(int frame, int iteration, int pass, int tile) {
+    uint64 h = 0xBA5EBA11;
+    for (uint64 v : { uint64(frame), uint64(iteration), uint64(pass), uint64(tile) }) {
+        h ^= v + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+    }
+    return uint32(h);
+}
+
+TileCluster::~TileCluster() {
+    for (auto &worker : m_workers) {
+        if (worker.alive)
+            worker.channel.send(TileChannel::Message::Shutdown, {});
+        worker.channel.close();
+#ifndef _WIN32
+        if (worker.pid > 0) {
+            if (!worker.alive)
+                kill(worker.pid, SIGTERM);
+            waitpid(worker.pid, nullptr, 0);
+        }
+#endif
+    }
+}
+
+bool TileCluster::addWorker(TileChannel channel, int pid, Vec2i resolution) {
+    TileChannel::Message type;
+    std::string payload;
+    Vec2i workerResolution;
+    bool ok = channel.receive(type, payload) && type == TileChannel::Message::Hello;
+    if (ok) {
+        std::istringstream in(payload);
+        streamRead(in, workerResolution);
+        ok = bool(in) && workerResolution == resolution;
+    }
+
+    Worker worker;
+    worker.channel = std::move(channel);
+    worker.pid = pid;
+    worker.alive = ok;
+    if (!ok)
+        printf("Error: worker %d did not start or renders a different scene, leaving it out\n", int(m_workers.size()));
+    m_workers.push_back(std::move(worker));
+    return ok;
+}
+
+void TileCluster::dropWorker(Worker &worker, std::deque<TileRequest> &pending) {
+    printf("Error: lost worker %d, its tiles go to the others\n", int(&worker - m_workers.data()));
+    worker.alive = false;
+    worker.channel.close();
+    /// in front, those tiles have been waiting longest
+    pending.insert(pending.begin(), worker.inFlight.begin(), worker.inFlight.end());
+    worker.inFlight.clear();
+}
+
+bool TileCluster::spawn(const std::string &executable, const std::string &sceneFile, int count, Vec2i resolution) {
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < count; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            printf("Error: could not create a socket for worker %d: %s\n", i, strerror(errno));
+            break;
+        }
+        /// keep our end out of the workers started after this one
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+        /// prepared up front, the child may only make async-signal-safe calls before exec
+        std::string endpoint = "fd:" + std::to_string(fds[1]);
+        pid_t pid = fork();
+        if (pid == 0) {
+            fcntl(fds[1], F_SETFD, 0);
+            execl(executable.c_str(), executable.c_str(), "--worker", endpoint.c_str(), sceneFile.c_str(), nullptr);
+            _exit(127);
+        }
+        closeDescriptor(fds[1]);
+        if (pid < 0) {
+            printf("Error: could not start worker %d: %s\n", i, strerror(errno));
+            closeDescriptor(fds[0]);
+            break;
+        }
+        addWorker(TileChannel(fds[0]), pid, resolution);
+    }
+    printf("Started %d of %d workers\n", size(), count);
+    return size() > 0;
+#else
+    printf("Error: distributed rendering is not supported on this platform\n");
+    return false;
+#endif
+}
+
+bool TileCluster::listen(const std::string &address, int port, int count, Vec2i resolution) {
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *addresses = nullptr;
+    int resolved = getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &addresses);
+    if (resolved != 0) {
+        printf("Error: could not resolve %s: %s\n", address.c_str(), gai_strerror(resolved));
+        return false;
+    }
+
+    int server = -1;
+    int error = 0;
+    for (addrinfo *a = addresses; a && server < 0; a = a->ai_next) {
+        server = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (server < 0) {
+            error = errno;
+            continue;
+        }
+        int reuse = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(server, a->ai_addr, a->ai_addrlen) != 0 || ::listen(server, count) != 0) {
+            error = errno;
+            closeDescriptor(server);
+            server = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (server < 0) {
+        printf("Error: could not listen on %s:%d: %s\n", address.c_str(), port, strerror(error));
+        return false;
+    }
+
+    printf("Waiting for %d workers on %s:%d\n", count, address.c_str(), port);
+    for (int i = 0; i < count; i++) {
+        int fd = accept(server, nullptr, nullptr);
+        if (fd < 0) {
+            printf("Error: accepting worker %d failed: %s\n", i, strerror(errno));
+            break;
+        }
+        disableNagle(fd);
+        addWorker(TileChannel(fd), -1, resolution);
+    }
+    closeDescriptor(server);
+    printf("%d of %d workers connected\n", size(), count);
+    return size() > 0;
+#else
+    printf("Error: distributed rendering is not supported on this platform\n");
+    return false;
+#endif
+}
+
+int TileCluster::size() const {
+    int alive = 0;
+    for (const auto &worker : m_workers)
+        alive += worker.alive;
+    return alive;
+}
+
+void TileCluster::beginIteration(const EARSTracer &tracer, int iteration) {
+    m_frame = tracer.scene->currentFrame;
+    m_iteration = iteration;
+
+    std::ostringstream out;
+    streamWrite(out, m_frame);
+    tracer.cache.saveState(out);
+    streamWrite(out, tracer.imageEstimate.buffer);
+    streamWrite(out, tracer.imageEarsFactor);
+    streamWrite(out, tracer.rrs);
+    streamWrite(out, tracer.guiding);
+    streamWrite(out, tracer.guidingBsdfFraction);
+    const std::string payload = out.str();
+
+    std::deque<TileRequest> none;
+    for (auto &worker : m_workers) {
+        if (worker.alive && !worker.channel.send(TileChannel::Message::Iteration, payload))
+            dropWorker(worker, none);
+    }
+}
+
+void TileCluster::renderPass(EARSTracer &tracer, int pass, int spp, Film &estimate, Film &rawEstimate) {
+    const int resx = tracer.imageEstimate.resx;
+    const int resy = tracer.imageEstimate.resy;
+
+    std::deque<TileRequest> pending;
+    for (int blockY = 0; blockY < resy; blockY += TILE_SIZE) {
+        for (int blockX = 0; blockX < resx; blockX += TILE_SIZE) {
+            TileRequest request;
+            request.index = int(pending.size());
+            request.blockX = blockX;
+            request.blockY = blockY;
+            request.width = std::min(TILE_SIZE, resx - blockX);
+            request.height = std::min(TILE_SIZE, resy - blockY);
+            request.seed = tileSeed(m_frame, m_iteration, pass, request.index);
+            pending.push_back(request);
+        }
+    }
+
+    /// statistics are only merged once the pass is done, so every tile gets the same bound whenever it is sent
+    auto withOutlierBound = [&tracer](TileRequest request) {
+        request.hasOutlierBound = tracer.imageStatistics.hasOutlierLowerBound();
+        if (request.hasOutlierBound)
+            request.outlierBound = tracer.imageStatistics.outlierLowerBound();
+        return request;
+    };
+
+    std::vector<TileResult> results(pending.size());
+    size_t remaining = pending.size();
+
+    while (remaining > 0) {
+        for (auto &worker : m_workers) {
+            while (worker.alive && worker.inFlight.size() < TILES_IN_FLIGHT && !pending.empty()) {
+                TileRequest request = withOutlierBound(pending.front());
+                pending.pop_front();
+                worker.inFlight.push_back(request);
+
+                std::ostringstream out;
+                streamWrite(out, request);
+                if (!worker.channel.send(TileChannel::Message::Tile, out.str()))
+                    dropWorker(worker, pending);
+            }
+        }
+
+        std::vector<Worker *> busy;
+        for (auto &worker : m_workers) {
+            if (worker.alive && !worker.inFlight.empty())
+                busy.push_back(&worker);
+        }
+
+        if (busy.empty()) {
+            printf("Error: no workers left, tracing the remaining %d tiles locally\n", int(pending.size()));
+            while (!pending.empty()) {
+                TileRequest request = withOutlierBound(pending.front());
+                pending.pop_front();
+                renderTile(tracer, request, results[request.index]);
+                remaining--;
+            }
+            break;
+        }
+
+#ifndef _WIN32
+        std::vector<pollfd> fds;
+        for (Worker *worker : busy)
+            fds.push_back({ worker->channel.fd(), POLLIN, 0 });
+        if (poll(fds.data(), nfds_t(fds.size()), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("Error: waiting for workers failed: %s\n", strerror(errno));
+            for (Worker *worker : busy)
+                dropWorker(*worker, pending);
+            continue;
+        }
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            Worker &worker = *busy[i];
+
+            TileChannel::Message type;
+            std::string payload;
+            TileResult result;
+            bool ok = worker.channel.receive(type, payload) && type == TileChannel::Message::TileResult;
+            if (ok) {
+                std::istringstream in(payload);
+                result.loadState(in);
+                ok = bool(in) && !worker.inFlight.empty() && worker.inFlight.front().index == result.request.index &&
+                     result.radiance.size() == size_t(result.request.width) * result.request.height;
+            }
+            if (!ok) {
+                dropWorker(worker, pending);
+                continue;
+            }
+
+            /// workers answer in the order the tiles were sent
+            worker.inFlight.pop_front();
+            results[result.request.index] = std::move(result);
+            remaining--;
+        }
+#endif
+    }
+
+    for (const TileResult &result : results) {
+        const TileRequest &request = result.request;
+        for (int y = 0; y < request.height; y++) {
+            for (int x = 0; x < request.width; x++) {
+                Vec2i px(request.blockX + x, request.blockY + y);
+                Vec3f li = result.radiance[y * request.width + x];
+                estimate.add(px, li / spp);
+                rawEstimate.add(px, li / spp);
+            }
+        }
+        tracer.imageStatistics += result.statistics;
+        tracer.imageStatistics.splatDepthAcc(result.depthAcc, result.depthWeight, result.primarySplit, result.samplesTaken);
+        threadCounters() += result.counters;
+    }
+}
+
+void TileCluster::endIteration(EARSTracer &tracer) {
+    TimelineScope scope("Merge training");
+    std::deque<TileRequest> none;
+    for (auto &worker : m_workers) {
+        if (worker.alive && !worker.channel.send(TileChannel::Message::Training, {}))
+            dropWorker(worker, none);
+    }
+
+    /// merged in worker order, the sums only differ in rounding from any other order
+    for (auto &worker : m_workers) {
+        if (!worker.alive)
+            continue;
+        TileChannel::Message type;
+        std::string payload;
+        if (!worker.channel.receive(type, payload) || type != TileChannel::Message::Training) {
+            dropWorker(worker, none);
+            continue;
+        }
+        std::istringstream in(payload);
+        if (!tracer.cache.mergeTraining(in))
+            printf("Error: training data of worker %d doesn't fit the cache, leaving it out\n",
+                   int(&worker - m_workers.data()));
+    }
+}
+
+TileWorker::TileWorker(Scene &scene, TileChannel channel) :
+    m_scene(scene),
+    m_channel(std::move(channel)),
+    m_tracer(scene)
+{};
+
+bool TileWorker::serve(const std::string &endpoint, Scene &scene) {
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+    int fd = -1;
+    if (endpoint.rfind("fd:", 0) == 0) {
+        fd = atoi(endpoint.c_str() + 3);
+    } else {
+        size_t colon = endpoint.rfind(':');
+        std::string host = colon == std::string::npos ? "localhost" : endpoint.substr(0, colon);
+        std::string port = colon == std::string::npos ? endpoint : endpoint.substr(colon + 1);
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        /// the coordinator may still be loading its scene, keep trying for a while
+        for (int attempt = 0; attempt < 100 && fd < 0; attempt++) {
+            addrinfo *addresses = nullptr;
+            if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) == 0) {
+                for (addrinfo *a = addresses; a && fd < 0; a = a->ai_next) {
+                    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                        closeDescriptor(fd);
+                        fd = -1;
+                    }
+                }
+                freeaddrinfo(addresses);
+            }
+            if (fd < 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    if (fd < 0) {
+        printf("Error: could not connect to coordinator %s\n", endpoint.c_str());
+        return false;
+    }
+    if (endpoint.rfind("fd:", 0) != 0)
+        disableNagle(fd);
+
+    TileWorker worker(scene, TileChannel(fd));
+    return worker.run();
+#else
+    printf("Error: distributed rendering is not supported on this platform\n");
+    return false;
+#endif
+}
+
+bool TileWorker::run() {
+    std::ostringstream hello;
+    streamWrite(hello, m_scene.camera.resolution());
+    if (!m_channel.send(TileChannel::Message::Hello, hello.str()))
+        return false;
+
+    while (true) {
+        TileChannel::Message type;
+        std::string payload;
+        if (!m_channel.receive(type, payload)) {
+            printf("Error: lost the connection to the coordinator\n");
+            return false;
+        }
+        std::istringstream in(payload);
+
+        switch (type) {
+        case TileChannel::Message::Iteration: {
+            int frame = 0;
+            streamRead(in, frame);
+            if (frame != m_scene.currentFrame)
+                m_scene.setFrame(frame);
+            m_tracer.cache.loadState(in);
+            /// only what this worker collects goes back to the coordinator
+            m_tracer.cache.clearTraining();
+            streamRead(in, m_tracer.imageEstimate.buffer);
+            streamRead(in, m_tracer.imageEarsFactor);
+            streamRead(in, m_tracer.rrs);
+            streamRead(in, m_tracer.guiding);
+            streamRead(in, m_tracer.guidingBsdfFraction);
+            if (!in) {
+                printf("Error: received a broken iteration state\n");
+                return false;
+            }
+            break;
+        }
+        case TileChannel::Message::Tile: {
+            TileRequest request;
+            streamRead(in, request);
+            if (!in)
+                return false;
+            TileResult result;
+            renderTile(m_tracer, request, result);
+            result.counters = collectCounters();
+            std::ostringstream out;
+            result.saveState(out);
+            if (!m_channel.send(TileChannel::Message::TileResult, out.str()))
+                return false;
+            break;
+        }
+        case TileChannel::Message::Training: {
+            std::ostringstream out;
+            m_tracer.cache.saveTraining(out);
+            m_tracer.cache.clearTraining();
+            if (!m_channel.send(TileChannel::Message::Training, out.str()))
+                return false;
+            break;
+        }
+        case TileChannel::Message::Shutdown:
+            return true;
+        default:
+            printf("Error: unexpected message %u from the coordinator\n", uint32(type));
+            return false;
+        }
+    }
+}
@@ -0,0 +1,156 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "usings.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "counters.h"
+#include "framebuffer.h"
+#include "outlierrejectedaverage.h"
+#include "scene.h"
+#include "tracer.h"
+
+/* Length prefixed messages over a connected socket. Owns and closes the descriptor. */
+class TileChannel {
+public:
+    enum class Message : uint32 {
+        Hello,      /// worker -> coordinator, carries the resolution of the worker's scene
+        Iteration,  /// coordinator -> worker, the cache and image state the following tiles are traced against
+        Tile,
+        TileResult,
+        Training,   /// coordinator asks for, and the worker replies with, the training data collected since Iteration
+        Shutdown
+    };
+
+    explicit TileChannel(int fd = -1) : m_fd(fd) {}
+    ~TileChannel();
+
+    TileChannel(const TileChannel &) = delete;
+    TileChannel &operator=(const TileChannel &) = delete;
+    TileChannel(TileChannel &&other) noexcept;
+    TileChannel &operator=(TileChannel &&other) noexcept;
+
+    bool send(Message type, const std::string &payload);
+    bool receive(Message &type, std::string &payload);
+    void close();
+
+    int fd() const {
+        return m_fd;
+    }
+
+private:
+    int m_fd;
+};
+
+/* One block of one EARS pass, traced by a worker with its own sampler stream. */
+struct TileRequest {
+    int index{0}; /// position in the pass, results are merged in this order
+    int blockX{0};
+    int blockY{0};
+    int width{0};
+    int height{0};
+    uint32 seed{0};
+    bool hasOutlierBound{false};
+    EARS::OutlierRejectedAverage::Sample outlierBound;
+};
+
+struct TileResult {
+    TileRequest request;
+    std::vector<Vec3f> radiance;
+    EARS::OutlierRejectedAverage statistics;
+    float depthAcc{0};
+    float depthWeight{0};
+    float primarySplit{0};
+    float samplesTaken{0};
+    RenderCounters counters; /// counted by the worker that traced the tile, tiles traced locally count in place
+
+    void saveState(std::ostream &out) const;
+    void loadState(std::istream &in);
+};
+
+/* Traces a tile the same way EARSIntegrator traces a block, collecting training data into tracer.cache. */
+void renderTile(EARSTracer &tracer, const TileRequest &request, TileResult &result);
+
+/**
+ * Coordinator side of distributed EARS rendering. Each pass of an iteration is split into tiles that are handed
+ * out to the workers as they become idle. Results are merged in tile order once the pass is complete, and the
+ * training data the workers collected is merged into the coordinator's cache before it is built. Tiles are seeded
+ * by their position, so apart from rounding in the merged training data the result doesn't depend on how many
+ * workers there are or which of them traced what.
+ */
+class TileCluster {
+public:
+    TileCluster() = default;
+    ~TileCluster();
+
+    TileCluster(const TileCluster &) = delete;
+    TileCluster &operator=(const TileCluster &) = delete;
+
+    /**
+     * Starts count worker processes on this machine by running executable with --worker on sceneFile.
+     * Returns false if none of them came up.
+     */
+    bool spawn(const std::string &executable, const std::string &sceneFile, int count, Vec2i resolution);
+
+    /**
+     * Waits for count workers started elsewhere with --worker host:port to connect to address:port.
+     * Anyone who can reach the address can connect, so bind to a public one on trusted networks only.
+     * Returns false if none of them connected.
+     */
+    bool listen(const std::string &address, int port, int count, Vec2i resolution);
+
+    int size() const;
+
+    /* Sends the state the tiles of the following passes are traced against. */
+    void beginIteration(const EARSTracer &tracer, int iteration);
+
+    /**
+     * Traces one sample per pixel and adds radiance / spp to estimate and rawEstimate. Block statistics are
+     * merged into tracer.imageStatistics. Tiles of workers that drop out are traced by the others, or locally
+     * once there are none left.
+     */
+    void renderPass(EARSTracer &tracer, int pass, int spp, Film &estimate, Film &rawEstimate);
+
+    /* Merges the workers' training data into tracer.cache, to be called before building it. */
+    void endIteration(EARSTracer &tracer);
+
+private:
+    struct Worker {
+        TileChannel channel;
+        int pid{-1}; /// -1 for workers that connected over the network
+        std::deque<TileRequest> inFlight;
+        bool alive{true};
+    };
+
+    bool addWorker(TileChannel channel, int pid, Vec2i resolution);
+    void dropWorker(Worker &worker, std::deque<TileRequest> &pending);
+
+    std::vector<Worker> m_workers;
+    int m_frame{0};
+    int m_iteration{0};
+};
+
+/* Worker side: traces the tiles a TileCluster hands out, against the state it broadcasts. */
+class TileWorker {
+public:
+    TileWorker(Scene &scene, TileChannel channel);
+
+    /**
+     * Connects to a coordinator, "fd:<n>" for a descriptor inherited from a local coordinator or
+     * "host:port" for one listening on the network, and serves it until it shuts down.
+     */
+    static bool serve(const std::string &endpoint, Scene &scene);
+
+    /* Returns false if the connection broke down rather than being shut down by the coordinator. */
+    bool run();
+
+private:
+    Scene &m_scene;
+    TileChannel m_channel;
+    EARSTracer m_tracer;
+};
+
+#endif
@@ -11,6 +11,46 @@ static float computeElapsedSeconds(std::chrono::steady_clock::time_point start)
     return (float)ms.count() / 1000;
 }
 
+bool EARSTracer::sampleGuided(SurfaceScatterEvent& event, const EARS::Octtree::SamplingNode* guiding) {
+    const Primitive& primitive = *event.data->primitive;
+    if (!guiding)
+        return primitive.sampleBsdf(event) && event.weight != 0.0f;
+
+    if (event.sampler->next1D(BsdfSample) < guidingBsdfFraction) {
+        if (!primitive.sampleBsdf(event))
+            return false;
+    } else {
+        /// pick a bin by its share of the incident radiance, then a direction uniformly within it
+        const int res = EARS::Octtree::HISTOGRAM_RESOLUTION;
+        float xi = event.sampler->next1D(BsdfSample);
+        int bin = 0;
+        while (bin < EARS::Octtree::BIN_COUNT - 1 && xi >= guiding[bin].guidingProbability()) {
+            xi -= guiding[bin].guidingProbability();
+            bin++;
+        }
+        Vec2f uv = event.sampler->next2D(BsdfSample);
+        Vec2f p((float(bin % res) + uv.x()) / res, (float(bin / res) + uv.y()) / res);
+        event.wo = event.frame.toLocal(canonicalToDir(p));
+    }
+
+    Vec3f f = primitive.evalBsdf(event);
+    if (f == 0.0f)
+        return false;
+    event.pdf = guidedPdf(event, guiding);
+    event.weight = f / event.pdf;
+    return true;
+}
+
+float EARSTracer::guidedPdf(const SurfaceScatterEvent& event, const EARS::Octtree::SamplingNode* guiding) {
+    const float bsdfPdf = event.data->primitive->bsdfPdf(event);
+    if (!guiding)
+        return bsdfPdf;
+    /// the bins cover equal solid angles
+    const int bin = mapOutgoingDirectionToHistogramBin(event.frame.toGlobal(event.wo));
+    const float guidePdf = guiding[bin].guidingProbability() * EARS::Octtree::BIN_COUNT / (4 * PI);
+    return guidingBsdfFraction * bsdfPdf + (1 - guidingBsdfFraction) * guidePdf;
+}
+
 EARSTracer::LiOutput EARSTracer::Li(EARSTracer::LiInput &input, PathSampleGenerator& sampler) {
     EARSTracer::LiOutput output;
 
@@ -43,17 +83,43 @@ EARSTracer::LiOutput EARSTracer::Li(EARSTracer::LiInput &input, PathSampleGenera
         return output;
     }
 
-    //const bool bsdfHasSmoothComponent = true;
-    Vec3f albedo = idata.primitive->material->albedo;
-    const int histogramBinIndex = mapOutgoingDirectionToHistogramBin(input.ray.d());
+    const Material &material = *idata.primitive->material;
+    Vec3f albedo = material.albedo;
+    const Vec2f canonicalDirection = dirToCanonical(input.ray.d());
     const EARS::Octtree::SamplingNode* samplingNode = nullptr;
     EARS::Octtree::TrainingNode* trainingNode = nullptr;
-    cache.lookup(mapPointToUnitCube(its.data->p), histogramBinIndex, samplingNode, trainingNode);
+    EARS::Octtree::TechniqueTraining* techniques = nullptr;
+    const EARS::Octtree::SamplingNode* guidingBins = nullptr;
+    EARS::Octtree::IncidentTraining* incidentTraining = nullptr;
+    if (guiding || rrs.technique == EARS::RRSMethod::EMixed) {
+        cache.lookup(mapPointToUnitCube(its.data->p), canonicalDirection, samplingNode, trainingNode,
+                     techniques, guidingBins, incidentTraining);
+        if (!guiding) {
+            /// distributions an earlier render learned while guiding
+            guidingBins = nullptr;
+            incidentTraining = nullptr;
+        }
+    }
+    else
+        cache.lookup(mapPointToUnitCube(its.data->p), canonicalDirection, samplingNode, trainingNode);
+
+    /// a mixed method hands the vertex to the technique that did best in this region, or to a random one to keep
+    /// measuring them all
+    int candidate = -1;
+    EARS::RRSMethod method = rrs;
+    if (rrs.technique == EARS::RRSMethod::EMixed) {
+        candidate = rrs.selectCandidate(samplingNode, sampler.next1D());
+        method = EARS::RRSMethod::candidate(candidate);
+    }
+    Vec3f throughput = input.weight;
+    if (method.useAbsoluteThroughput && !rrs.useAbsoluteThroughput)
+        throughput *= input.pixelNorm;
+    else if (!method.useAbsoluteThroughput && rrs.useAbsoluteThroughput)
+        throughput /= input.pixelNorm;
 
-//    const float splittingFactor = 1.0f;
-    const float splittingFactor = rrs.evaluate(
+    const float splittingFactor = method.evaluate(
         samplingNode, imageEarsFactor,
-        albedo, input.weight, 0.0f, true,
+        albedo, throughput, material.shininess(), material.hasSmoothComponent(),
         input.depth
     );
 
@@ -63,6 +129,10 @@ EARSTracer::LiOutput EARSTracer::Li(EARSTracer::LiInput &input, PathSampleGenera
 
     const int numSamples = int(splittingFactor + sampler.next1D());
     output.numSamples = numSamples;
+    if (numSamples == 0)
+        threadCounters().rrKills++;
+    else
+        threadCounters().splits += numSamples - 1;
     if (output.numSamples > 1)
         output.numSamples = numSamples;
     for (int sampleIndex = 0; sampleIndex < numSamples; sampleIndex++) {
@@ -77,28 +147,31 @@ EARSTracer::LiOutput EARSTracer::Li(EARSTracer::LiInput &input, PathSampleGenera
         LightSample lightsample;
         auto light = scene->primitives.at("Light");
 
-        /* Sample direct illumination */
-        Vec3f value(0.0f);
-        if (light->sampleLightDirect(its.data->p, *its.sampler, lightsample))
-            value = light->evalEmissionDirect(iinfo, idata);
-        its.wo = its.frame.toLocal(lightsample.d);
-
-        /* Test visibility */
-        Ray shadowRay = input.ray.scatter(its.data->p, lightsample.d, its.data->epsilon);
-        Intersection ishadow;
-        IntersectionData dshadow;
-        if (scene->intersect(shadowRay, ishadow, dshadow) && dshadow.primitive != light.get())
-            value *= 0.0f;
-
-        /* Attenuate direct illumination with bsdf */
-        Vec3f bsdfVal = its.data->primitive->evalBsdf(its);
-        if (bsdfVal != 0.0f && its.frame.normal.dot(lightsample.d) * its.wo.z() > 0) {
-            float bsdfPdf = its.data->primitive->bsdfPdf(its);
-            float misWeight = powerHeuristic(lightsample.pdf, bsdfPdf);
-            float absCosTheta = std::abs(its.wo.z());
-
-            LrEstimate += bsdfVal * value * misWeight / lightsample.pdf;
-            irradianceEstimate += absCosTheta * value * misWeight;
+        /* Sample direct illumination, the light can't be sampled from points behind it */
+        if (light->sampleLightDirect(its.data->p, *its.sampler, lightsample)) {
+            Vec3f value = light->evalEmissionDirect(iinfo, idata);
+            its.wo = its.frame.toLocal(lightsample.d);
+
+            /* Test visibility */
+            Ray shadowRay = input.ray.scatter(its.data->p, lightsample.d, its.data->epsilon);
+            Intersection ishadow;
+            IntersectionData dshadow;
+            threadCounters().shadowRays++;
+            /// a mesh light can also shadow its own sample point
+            if (scene->intersect(shadowRay, ishadow, dshadow) && (dshadow.primitive != light.get() ||
+                (dshadow.p - its.data->p).length() < lightsample.dist * 0.999f))
+                value *= 0.0f;
+
+            /* Attenuate direct illumination with bsdf */
+            Vec3f bsdfVal = its.data->primitive->evalBsdf(its);
+            if (bsdfVal != 0.0f && its.frame.normal.dot(lightsample.d) * its.wo.z() > 0) {
+                float bsdfPdf = guidedPdf(its, guidingBins);
+                float misWeight = powerHeuristic(lightsample.pdf, bsdfPdf);
+                float absCosTheta = std::abs(its.wo.z());
+
+                LrEstimate += bsdfVal * value * misWeight / lightsample.pdf;
+                irradianceEstimate += absCosTheta * value * misWeight;
+            }
         }
 
         /* ==================================================================== */
@@ -116,7 +189,7 @@ EARSTracer::LiOutput EARSTracer::Li(EARSTracer::LiInput &input, PathSampleGenera
             IntersectionData idataNested = idata;
             Ray& rayNested = inputNested.ray;
             SurfaceScatterEvent itsNested = makeLocalScatterEvent(iinfoNested, idataNested, rayNested, &sampler);
-            if (!itsNested.data->primitive->sampleBsdf(itsNested) || itsNested.weight == 0.0f)
+            if (!sampleGuided(itsNested, guidingBins))
                 break;
             bsdfWeight = itsNested.weight;
             bsdfPdf = itsNested.pdf;
@@ -128,9 +201,10 @@ EARSTracer::LiOutput EARSTracer::Li(EARSTracer::LiInput &input, PathSampleGenera
 
             rayNested = Ray(itsNested.data->p, wo);
             LrCost += COST_BSDF;
+            threadCounters().bsdfRays++;
             if (scene->intersect(rayNested, iinfoNested, idataNested)) {
                 itsNested = makeLocalScatterEvent(iinfoNested, idataNested, rayNested, &sampler);
-                if (idataNested.primitive->emissive() && !iinfoNested.backface || idataNested.backSide) {
+                if (idataNested.primitive->emissive() && !iinfoNested.backface) {
                     value = idataNested.primitive->evalEmissionDirect(iinfoNested, idataNested);
                     hitEmitter = true;
                 }
@@ -141,9 +215,11 @@ EARSTracer::LiOutput EARSTracer::Li(EARSTracer::LiInput &input, PathSampleGenera
 
             inputNested.weight *= bsdfWeight;
             if (hitEmitter) {
-                LightSample lightsampleNested;
-                itsNested.data->primitive->sampleLightDirect(itsNested.data->p, sampler, lightsampleNested);
-                float lumPdf = lightsampleNested.pdf;
+                /// pdf of having reached the emitter by light sampling from the previous vertex, only the light is
+                /// sampled directly, other emitters count in full here
+                float lumPdf = 0.0f;
+                if (idataNested.primitive == light.get() && light->shape->canSampleDirect())
+                    lumPdf = idataNested.primitive->shapePdf(iinfoNested, idataNested, its.data->p);
                 float misWeight = powerHeuristic(bsdfPdf, lumPdf);
                 LrEstimate += bsdfWeight * value * misWeight;
                 irradianceEstimate += absCosTheta * (value / bsdfPdf) * misWeight;
@@ -155,6 +231,12 @@ EARSTracer::LiOutput EARSTracer::Li(EARSTracer::LiInput &input, PathSampleGenera
             inputNested.depth++;
             EARSTracer::LiOutput outputNested = Li(inputNested, sampler);
             LrEstimate += bsdfWeight * outputNested.totalContribution();
+            if (incidentTraining) {
+                Vec3f incident = outputNested.totalContribution();
+                if (hitEmitter)
+                    incident += value;
+                incidentTraining->splat(mapOutgoingDirectionToHistogramBin(wo), incident.avg() / bsdfPdf);
+            }
             irradianceEstimate += absCosTheta * (outputNested.totalContribution() / bsdfPdf);
             LrCost += outputNested.cost;
             output.depthAcc += outputNested.depthAcc;
@@ -170,6 +252,11 @@ EARSTracer::LiOutput EARSTracer::Li(EARSTracer::LiInput &input, PathSampleGenera
         lrSumCosts += LrCost;
     }
 
+    if (candidate >= 0 && techniques) {
+        /// killed vertices count too, contributing nothing at no cost
+        techniques->splat(candidate, (input.weight * output.reflected).avg(), lrSumCosts);
+    }
+
     if (numSamples > 0) {
         trainingNode->splatLrEstimate(
             lrSum,
@@ -204,11 +291,12 @@ Vec3f EARSTracer::trace(const Vec2i& px, PathSampleGenerator& sampler) {
     sampler.advancePath();
 
     Ray ray(point.p, direction.d);
+    threadCounters().cameraRays++;
     Vec3f weight(1.0f);
     if (!rrs.useAbsoluteThroughput)
         weight /= (pixelEstimate + Vec3f(1e-2));
     int bounce = 0;
-    EARSTracer::LiInput input{weight, ray, bounce, true};
+    EARSTracer::LiInput input{weight, ray, bounce, true, pixelEstimate + Vec3f(1e-2)};
     EARSTracer::LiOutput output = Li(input, sampler);
 
     const Vec3f pixelContribution = (Vec3f(1.0f) / metricNorm) * output.totalContribution();
@@ -242,14 +330,14 @@ Vec3f EARSTracer::LrEstimate(const Vec2i& px, PathSampleGenerator& sampler) {
     IntersectionData idata;
     scene->intersect(ray, iinfo, idata);
 
-    const int histogramBinIndex = mapOutgoingDirectionToHistogramBin(ray.d());
+    const Vec2f canonicalDirection = dirToCanonical(ray.d());
     const EARS::Octtree::SamplingNode* samplingNode = nullptr;
     EARS::Octtree::TrainingNode* trainingNode = nullptr;
-    cache.lookup(mapPointToUnitCube(idata.p), histogramBinIndex, samplingNode, trainingNode);
+    cache.lookup(mapPointToUnitCube(idata.p), canonicalDirection, samplingNode, trainingNode);
     if (samplingNode == nullptr) {
         return {};
     }
     else {
-        return samplingNode->lrEstimate;
+        return samplingNode->lrEstimate();
     }
 }
@@ -0,0 +1,138 @@
+#ifndef FLOATPARSER_H
+#define FLOATPARSER_H
+
+#include <cmath>
+#include <cstdint>
+
+/* Hand-written number parsing for scene and mesh text formats.
+ * All functions advance `p` past the parsed token and never read past `end`. */
+
+inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == ',';
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline void skipBlanks(const char *&p, const char *end) {
+    while (p < end && isBlank(*p))
+        p++;
+}
+
+inline void skipToken(const char *&p, const char *end) {
+    while (p < end && !isBlank(*p) && *p != '\n')
+        p++;
+}
+
+inline void skipLine(const char *&p, const char *end) {
+    while (p < end && *p != '\n')
+        p++;
+    if (p < end)
+        p++;
+}
+
+inline double pow10i(int e) {
+    static const double exact[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    if (e >= 0 && e <= 22)
+        return exact[e];
+    if (e < 0 && e >= -22)
+        return 1.0 / exact[-e];
+    return std::pow(10.0, e);
+}
+
+inline bool parseFloat(const char *&p, const char *end, float &out) {
+    skipBlanks(p, end);
+    const char *start = p;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool sawDigit = false;
+
+    while (p < end && isDigit(*p)) {
+        sawDigit = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && isDigit(*p)) {
+            sawDigit = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+            p++;
+        }
+    }
+    if (!sawDigit) {
+        p = start;
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *expStart = p++;
+        bool negativeExp = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negativeExp = *p == '-';
+            p++;
+        }
+        if (p < end && isDigit(*p)) {
+            int e = 0;
+            while (p < end && isDigit(*p)) {
+                if (e < 10000)
+                    e = e * 10 + (*p - '0');
+                p++;
+            }
+            exponent += negativeExp ? -e : e;
+        } else {
+            p = expStart;
+        }
+    }
+
+    double value = double(mantissa) * pow10i(exponent);
+    out = float(negative ? -value : value);
+    return true;
+}
+
+inline bool parseInt(const char *&p, const char *end, int64_t &out) {
+    skipBlanks(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p >= end || !isDigit(*p))
+        return false;
+    int64_t value = 0;
+    while (p < end && isDigit(*p)) {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    out = negative ? -value : value;
+    return true;
+}
+
+inline int parseFloats(const char *p, const char *end, float *out, int count) {
+    int parsed = 0;
+    while (parsed < count && parseFloat(p, end, out[parsed]))
+        parsed++;
+    return parsed;
+}
+
+#endif
@@ -3,14 +3,11 @@
 
 #include "usings.h"
 
-inline std::vector<Vec3c> tonemap(std::vector<Vec3f> hdr) {
+#include "tonemapper.h"
+
+inline std::vector<Vec3c> tonemap(const std::vector<Vec3f>& hdr) {
     std::vector<Vec3c> ldr(hdr.size());
-    for (int i = 0; i < ldr.size(); i++) {
-        Vec3f a = v3fmax(hdr[i], Vec3f(0.0f));
-        Vec3f x = v3fmax(a - 0.004f, Vec3f(0.0f));
-        Vec3f tonemap = (x * (6.2f * x + 0.5f)) / (x * (6.2f * x + 1.7f) + 0.06f);
-        ldr[i] = Vec3c(255.0f * clamp(tonemap.x()), 255.0f * clamp(tonemap.y()), 255.0f * clamp(tonemap.z()));
-    }
+    Tonemapper().apply(hdr, ldr);
     return ldr;
 }
 
@@ -153,7 +150,12 @@ public:
 
     void normalize(buffer b = COLOR);
 
-    std::vector<Vec3c> tonemap(std::vector<Vec3f> hdr);
+    std::vector<Vec3c> tonemap(const std::vector<Vec3f>& hdr);
+
+    /* Tonemaps buffer b into ldr, reusing its storage when the size matches. */
+    void tonemap(buffer b, std::vector<Vec3c>& ldr) const {
+        tonemapper.apply(data(b), ldr);
+    }
 
     std::vector<Vec3c> tonemap(buffer b) {
         switch (b) {
@@ -170,6 +172,24 @@ public:
 
     void toPng(const char *filename, buffer b=COLOR);
 
+    /* Linear float output, written directly from the buffer. */
+    void toPfm(const char *filename, buffer b=COLOR);
+    void toExr(const char *filename, buffer b=COLOR);
+
+    const std::vector<Vec3f>& data(buffer b=COLOR) const {
+        switch (b) {
+        case ALBEDO:
+            return albedo;
+        case NORMAL:
+            return normal;
+        case OIDN:
+            return oidn;
+        default:
+            return color;
+        }
+    }
+
+    Tonemapper tonemapper;
     bool useOidn;
     int resx{};
     int resy{};
@@ -0,0 +1,327 @@
+#include "imageio.h"
+
+#include <cstring>
+
+static_assert(sizeof(Vec3f) == 3 * sizeof(float), "Vec3f must be tightly packed to be written in place");
+
+namespace ImageIO {
+
+bool writePfm(const char *filename, const Vec3f *pixels, int resx, int resy) {
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        printf("Error: could not open %s for writing\n", filename);
+        return false;
+    }
+
+    /// negative scale marks little endian data, rows are stored bottom to top
+    fprintf(file, "PF\n%d %d\n-1.0\n", resx, resy);
+    bool ok = true;
+    for (int y = resy - 1; y >= 0 && ok; y--)
+        ok = fwrite(pixels + long(y) * resx, sizeof(Vec3f), resx, file) == size_t(resx);
+
+    ok &= fclose(file) == 0;
+    if (!ok)
+        printf("Error: failed writing %s\n", filename);
+    return ok;
+}
+
+bool readPfm(const char *filename, std::vector<Vec3f> &pixels, int &resx, int &resy) {
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+        return false;
+
+    char magic[3] = {};
+    float scale = 0;
+    bool ok = fscanf(file, "%2s %d %d %f", magic, &resx, &resy, &scale) == 4 && strcmp(magic, "PF") == 0 &&
+              resx > 0 && resy > 0 && scale < 0 && fgetc(file) != EOF;
+    if (ok) {
+        pixels.resize(size_t(resx) * resy);
+        for (int y = resy - 1; y >= 0 && ok; y--)
+            ok = fread(pixels.data() + long(y) * resx, sizeof(Vec3f), resx, file) == size_t(resx);
+    }
+    fclose(file);
+    if (!ok)
+        printf("Error: %s is not a little endian RGB float map\n", filename);
+    return ok;
+}
+
+namespace {
+
+/* OpenEXR header fields; all values are little endian. */
+struct ExrHeader {
+    std::vector<char> bytes;
+
+    void put(const void *data, size_t size) {
+        const char *p = static_cast<const char *>(data);
+        bytes.insert(bytes.end(), p, p + size);
+    }
+
+    void putInt(int32_t v) { put(&v, 4); }
+    void putFloat(float v) { put(&v, 4); }
+    void putString(const char *s) { put(s, strlen(s) + 1); }
+
+    void attribute(const char *name, const char *type, int32_t size) {
+        putString(name);
+        putString(type);
+        putInt(size);
+    }
+
+    void begin(bool tiled) {
+        putInt(20000630);
+        putInt(tiled ? 2 | 0x200 : 2);
+    }
+
+    void commonAttributes(int resx, int resy, bool randomOrder) {
+        /// channels must be listed in alphabetical order, which is also the order of each line's planes
+        const char *channels[] = { "B", "G", "R" };
+        attribute("channels", "chlist", 3 * (2 + 16) + 1);
+        for (const char *c : channels) {
+            putString(c);
+            putInt(2);               /// FLOAT
+            putInt(0);               /// pLinear and reserved bytes
+            putInt(1);               /// xSampling
+            putInt(1);               /// ySampling
+        }
+        bytes.push_back(0);
+
+        attribute("compression", "compression", 1);
+        bytes.push_back(0);          /// NO_COMPRESSION
+
+        int32_t window[4] = { 0, 0, resx - 1, resy - 1 };
+        attribute("dataWindow", "box2i", 16);
+        put(window, 16);
+        attribute("displayWindow", "box2i", 16);
+        put(window, 16);
+
+        attribute("lineOrder", "lineOrder", 1);
+        bytes.push_back(randomOrder ? 2 : 0);
+
+        attribute("pixelAspectRatio", "float", 4);
+        putFloat(1.0f);
+        attribute("screenWindowCenter", "v2f", 8);
+        putFloat(0.0f);
+        putFloat(0.0f);
+        attribute("screenWindowWidth", "float", 4);
+        putFloat(1.0f);
+    }
+
+    void end() {
+        bytes.push_back(0);
+    }
+};
+
+/* Splits width RGB pixels into the B, G and R planes of an EXR line. */
+void planarLine(const Vec3f *pixels, int width, float *out) {
+    for (int x = 0; x < width; x++) {
+        out[x] = pixels[x].z();
+        out[width + x] = pixels[x].y();
+        out[2 * width + x] = pixels[x].x();
+    }
+}
+
+}
+
+bool writeExr(const char *filename, const Vec3f *pixels, int resx, int resy) {
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        printf("Error: could not open %s for writing\n", filename);
+        return false;
+    }
+
+    ExrHeader header;
+    header.begin(false);
+    header.commonAttributes(resx, resy, false);
+    header.end();
+    bool ok = fwrite(header.bytes.data(), 1, header.bytes.size(), file) == header.bytes.size();
+
+    /// one scanline per chunk: int32 y, int32 size, then the line's planes
+    const uint64 lineBytes = uint64(resx) * 3 * sizeof(float);
+    const uint64 chunkBytes = 8 + lineBytes;
+    const uint64 firstChunk = header.bytes.size() + uint64(resy) * sizeof(uint64);
+    std::vector<uint64> offsets(resy);
+    for (int y = 0; y < resy; y++)
+        offsets[y] = firstChunk + y * chunkBytes;
+    ok = ok && fwrite(offsets.data(), sizeof(uint64), resy, file) == size_t(resy);
+
+    std::vector<float> line(resx * 3);
+    for (int y = 0; y < resy && ok; y++) {
+        int32_t chunk[2] = { y, int32_t(lineBytes) };
+        planarLine(pixels + long(y) * resx, resx, line.data());
+        ok = fwrite(chunk, sizeof(chunk), 1, file) == 1 &&
+             fwrite(line.data(), sizeof(float), line.size(), file) == line.size();
+    }
+
+    ok &= fclose(file) == 0;
+    if (!ok)
+        printf("Error: failed writing %s\n", filename);
+    return ok;
+}
+
+bool readExr(const char *filename, std::vector<Vec3f> &pixels, int &resx, int &resy) {
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+        return false;
+
+    auto readString = [file](std::string &s) {
+        s.clear();
+        for (int c = fgetc(file); c > 0; c = fgetc(file))
+            s.push_back(char(c));
+        return !ferror(file) && !feof(file);
+    };
+
+    int32_t magic[2] = {};
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1 && magic[0] == 20000630 && (magic[1] & ~0x200) == 2;
+    const bool tiled = (magic[1] & 0x200) != 0;
+
+    /// the attributes that matter for the files written above, everything else is skipped
+    int32_t window[4] = { 0, 0, -1, -1 };
+    int32_t tileSize[2] = { 0, 0 };
+    std::string channels;
+    int compression = -1;
+    std::string name, type;
+    while (ok && readString(name) && !name.empty()) {
+        int32_t size = 0;
+        ok = readString(type) && fread(&size, 4, 1, file) == 1 && size >= 0;
+        std::vector<char> value(size);
+        ok = ok && fread(value.data(), 1, size, file) == size_t(size);
+        if (!ok)
+            break;
+        if (name == "dataWindow" && size == 16)
+            std::memcpy(window, value.data(), 16);
+        else if (name == "tiles" && size == 9)
+            std::memcpy(tileSize, value.data(), 8);
+        else if (name == "compression" && size == 1)
+            compression = value[0];
+        else if (name == "channels")
+            channels.assign(value.begin(), value.end());
+    }
+
+    /// B, G and R, each a FLOAT sampled at every pixel
+    std::string expected;
+    for (const char *c : { "B", "G", "R" }) {
+        const int32_t fields[4] = { 2, 0, 1, 1 };
+        expected.append(c, 2);
+        expected.append(reinterpret_cast<const char *>(fields), sizeof(fields));
+    }
+    expected.push_back(0);
+
+    resx = window[2] - window[0] + 1;
+    resy = window[3] - window[1] + 1;
+    ok = ok && compression == 0 && channels == expected && resx > 0 && resy > 0 &&
+         (!tiled || (tileSize[0] > 0 && tileSize[1] > 0));
+
+    const int tilesX = tiled ? (resx + tileSize[0] - 1) / tileSize[0] : 1;
+    const int tilesY = tiled ? (resy + tileSize[1] - 1) / tileSize[1] : resy;
+    std::vector<uint64> offsets(ok ? size_t(tilesX) * tilesY : 0);
+    ok = ok && fread(offsets.data(), sizeof(uint64), offsets.size(), file) == offsets.size();
+    if (ok)
+        pixels.assign(size_t(resx) * resy, Vec3f(0.0f));
+
+    std::vector<float> planes;
+    for (size_t chunk = 0; chunk < offsets.size() && ok; chunk++) {
+        int32_t coordinates[4] = {};
+        int32_t bytes = 0;
+        ok = fseek(file, long(offsets[chunk]), SEEK_SET) == 0 &&
+             fread(coordinates, 4, tiled ? 4 : 1, file) == (tiled ? 4u : 1u) && fread(&bytes, 4, 1, file) == 1;
+        if (!ok)
+            break;
+
+        const int x0 = tiled ? coordinates[0] * tileSize[0] : 0;
+        const int y0 = tiled ? coordinates[1] * tileSize[1] : coordinates[0] - window[1];
+        const int width = tiled ? std::min(tileSize[0], resx - x0) : resx;
+        const int height = tiled ? std::min(tileSize[1], resy - y0) : 1;
+        ok = x0 >= 0 && y0 >= 0 && width > 0 && height > 0 && y0 + height <= resy && (!tiled || coordinates[2] == 0) &&
+             bytes == int32_t(size_t(width) * height * 3 * sizeof(float));
+        planes.resize(size_t(width) * height * 3);
+        ok = ok && fread(planes.data(), sizeof(float), planes.size(), file) == planes.size();
+        for (int y = 0; y < height && ok; y++) {
+            const float *line = planes.data() + size_t(y) * width * 3;
+            Vec3f *out = pixels.data() + long(y0 + y) * resx + x0;
+            for (int x = 0; x < width; x++)
+                out[x] = Vec3f(line[2 * width + x], line[width + x], line[x]);
+        }
+    }
+
+    fclose(file);
+    if (!ok)
+        printf("Error: %s is not an uncompressed float RGB EXR\n", filename);
+    return ok;
+}
+
+TiledExrWriter::~TiledExrWriter() {
+    if (m_file)
+        close();
+}
+
+bool TiledExrWriter::open(const char *filename, int resx, int resy, int tileSize) {
+    m_file = fopen(filename, "wb");
+    if (!m_file) {
+        printf("Error: could not open %s for writing\n", filename);
+        return false;
+    }
+    m_resx = resx;
+    m_resy = resy;
+    m_tileSize = tileSize;
+
+    ExrHeader header;
+    header.begin(true);
+    header.commonAttributes(resx, resy, true);
+    header.attribute("tiles", "tiledesc", 9);
+    header.putInt(tileSize);
+    header.putInt(tileSize);
+    header.bytes.push_back(0);       /// ONE_LEVEL, ROUND_DOWN
+    header.end();
+
+    m_tableOffset = long(header.bytes.size());
+    m_offsets.assign(size_t(tilesX()) * tilesY(), 0);
+    bool ok = fwrite(header.bytes.data(), 1, header.bytes.size(), m_file) == header.bytes.size() &&
+              fwrite(m_offsets.data(), sizeof(uint64), m_offsets.size(), m_file) == m_offsets.size();
+    if (!ok)
+        printf("Error: failed writing %s\n", filename);
+    return ok;
+}
+
+bool TiledExrWriter::writeTile(int tx, int ty, const Vec3f *pixels, int stride) {
+    const int x0 = tx * m_tileSize;
+    const int y0 = ty * m_tileSize;
+    const int width = std::min(m_tileSize, m_resx - x0);
+    const int height = std::min(m_tileSize, m_resy - y0);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file || tx < 0 || ty < 0 || tx >= tilesX() || ty >= tilesY())
+        return false;
+
+    m_scratch.resize(size_t(width) * height * 3);
+    for (int y = 0; y < height; y++)
+        planarLine(pixels + long(y) * stride, width, m_scratch.data() + size_t(y) * width * 3);
+
+    /// tiles go wherever the file currently ends, the offset table records where
+    fseek(m_file, 0, SEEK_END);
+    m_offsets[size_t(ty) * tilesX() + tx] = uint64(ftell(m_file));
+
+    int32_t chunk[5] = { tx, ty, 0, 0, int32_t(m_scratch.size() * sizeof(float)) };
+    return fwrite(chunk, sizeof(chunk), 1, m_file) == 1 &&
+           fwrite(m_scratch.data(), sizeof(float), m_scratch.size(), m_file) == m_scratch.size();
+}
+
+bool TiledExrWriter::close() {
+    if (!m_file)
+        return false;
+
+    std::vector<Vec3f> black(size_t(m_tileSize) * m_tileSize, Vec3f(0.0f));
+    for (int ty = 0; ty < tilesY(); ty++) {
+        for (int tx = 0; tx < tilesX(); tx++) {
+            if (m_offsets[size_t(ty) * tilesX() + tx] == 0)
+                writeTile(tx, ty, black.data(), m_tileSize);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    fseek(m_file, m_tableOffset, SEEK_SET);
+    bool ok = fwrite(m_offsets.data(), sizeof(uint64), m_offsets.size(), m_file) == m_offsets.size();
+    ok &= fclose(m_file) == 0;
+    m_file = nullptr;
+    return ok;
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef IMAGEIO_H
+#define IMAGEIO_H
+
+#include "usings.h"
+
+#include <cstdio>
+#include <mutex>
+
+/* Linear float image output. Pixels are written straight from the caller's Vec3f buffer, row-major,
+ * top row first, as used by Film and FrameBuffer. */
+namespace ImageIO {
+
+/* Portable float map, RGB, little endian. Rows are streamed directly from pixels. */
+bool writePfm(const char *filename, const Vec3f *pixels, int resx, int resy);
+
+/* Reads an RGB, little endian portable float map as written by writePfm(). Returns false for anything else. */
+bool readPfm(const char *filename, std::vector<Vec3f> &pixels, int &resx, int &resy);
+
+/* Uncompressed scanline OpenEXR with 32-bit float R, G and B channels. */
+bool writeExr(const char *filename, const Vec3f *pixels, int resx, int resy);
+
+/**
+ * Reads an uncompressed OpenEXR with float B, G and R channels only, scanline or single level tiled, as written by
+ * writeExr() and TiledExrWriter. Returns false for anything else.
+ */
+bool readExr(const char *filename, std::vector<Vec3f> &pixels, int &resx, int &resy);
+
+/**
+ * Uncompressed, single level tiled OpenEXR written tile by tile in any order.
+ * The file is laid out with a placeholder offset table that close() fills in, so tiles can be written
+ * as soon as a render block finishes while the rest of the image is still being rendered.
+ * writeTile() may be called from several threads.
+ */
+class TiledExrWriter {
+public:
+    TiledExrWriter() = default;
+    ~TiledExrWriter();
+
+    TiledExrWriter(const TiledExrWriter &) = delete;
+    TiledExrWriter &operator=(const TiledExrWriter &) = delete;
+
+    bool open(const char *filename, int resx, int resy, int tileSize = 32);
+
+    /**
+     * Writes tile (tx, ty). pixels points at the tile's top left pixel in an image that is
+     * stride pixels wide, e.g. &film.buffer[0] with stride film.resx for a full resolution film.
+     */
+    bool writeTile(int tx, int ty, const Vec3f *pixels, int stride);
+
+    /* Fills in tiles that were never written with black, writes the offset table and closes the file. */
+    bool close();
+
+    bool isOpen() const { return m_file != nullptr; }
+
+    int tilesX() const { return (m_resx + m_tileSize - 1) / m_tileSize; }
+    int tilesY() const { return (m_resy + m_tileSize - 1) / m_tileSize; }
+
+private:
+    FILE *m_file{nullptr};
+    int m_resx{0};
+    int m_resy{0};
+    int m_tileSize{32};
+    long m_tableOffset{0};
+    std::vector<uint64> m_offsets;
+    std::vector<float> m_scratch;
+    std::mutex m_mutex;
+};
+
+}
+
+#endif
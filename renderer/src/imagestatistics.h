@@ -6,6 +6,7 @@
 
 #include "usings.h"
 
+#include "counters.h"
 #include "outlierrejectedaverage.h"
 
 namespace EARS {
@@ -31,15 +32,20 @@ struct ImageStatistics {
         return m_lastStats.squareError;
     }
 
+    /* Scale of the EARS splitting factors, 0 while there is no error or cost to derive it from. */
     float earsFactor() const {
-        return std::sqrt( cost() / squareError().avg() );
+        float error = squareError().avg();
+        if (!(error > 0) || !(cost() > 0))
+            return 0;
+        float factor = std::sqrt( cost() / error );
+        return std::isfinite(factor) ? factor : 0;
     }
 
     float efficiency() const {
         return 1 / (cost() * squareError().avg());
     }
 
-    void reset(float actualTotalCost) {
+    void reset(float actualTotalCost, const RenderCounters &counters) {
         auto weight = m_average.weight();
         auto avgNoReject = m_average.averageWithoutRejection();
         auto avg = m_average.average();
@@ -71,6 +77,7 @@ struct ImageStatistics {
             1 / (actualTotalCost / weight * squareError().avg()), 1 / (actualTotalCost / weight * avgNoReject.secondMoment.avg()),
             earsFactor(), earsFactorNoReject
         );
+        counters.print(actualTotalCost);
 
         m_depthAcc = 0;
         m_depthWeight = 0;
@@ -97,9 +104,31 @@ struct ImageStatistics {
         return m_average.outlierLowerBound();
     }
 
+    void saveState(std::ostream &out) const {
+        streamWrite(out, m_iterSpp);
+        streamWrite(out, m_totalSpp);
+        m_average.saveState(out);
+        streamWrite(out, m_depthAcc);
+        streamWrite(out, m_depthWeight);
+        streamWrite(out, m_primarySplit);
+        streamWrite(out, m_primarySamples);
+        streamWrite(out, m_lastStats);
+    }
+
+    void loadState(std::istream &in) {
+        streamRead(in, m_iterSpp);
+        streamRead(in, m_totalSpp);
+        m_average.loadState(in);
+        streamRead(in, m_depthAcc);
+        streamRead(in, m_depthWeight);
+        streamRead(in, m_primarySplit);
+        streamRead(in, m_primarySamples);
+        streamRead(in, m_lastStats);
+    }
+
 public:
-    int m_iterSpp;
-    int m_totalSpp;
+    int m_iterSpp{0};
+    int m_totalSpp{0};
 
 private:
     OutlierRejectedAverage m_average;
@@ -0,0 +1,72 @@
+#include "imagewriter.h"
+
+#include "framebuffer.h"
+#include "timeline.h"
+
+#include "stb_image_write.h"
+
+ImageWriter::ImageWriter(size_t maxPendingBytes) :
+    m_maxPendingBytes(maxPendingBytes)
+{
+    m_worker = std::thread([this]() { run(); });
+}
+
+ImageWriter::~ImageWriter() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    m_worker.join();
+}
+
+void ImageWriter::enqueue(std::string filename, int resx, int resy, std::vector<Vec3f> hdr) {
+    Job job{ std::move(filename), resx, resy, std::move(hdr) };
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        /// an image larger than the whole budget is still let through once the queue has drained
+        m_wakeup.wait(lock, [&]() {
+            return m_jobs.empty() || m_pendingBytes + job.bytes() <= m_maxPendingBytes;
+        });
+        m_pendingBytes += job.bytes();
+        m_jobs.push_back(std::move(job));
+    }
+    m_wakeup.notify_all();
+}
+
+void ImageWriter::flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_wakeup.wait(lock, [this]() { return m_jobs.empty() && !m_writing; });
+}
+
+void ImageWriter::run() {
+    Timeline::instance().nameThread("Image writer");
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+            /// drain what is queued before stopping
+            if (m_jobs.empty())
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_writing = true;
+        }
+
+        const size_t bytes = job.bytes();
+        {
+            TimelineScope scope("PNG write");
+            tonemapper.apply(job.hdr, m_ldr);
+            if (!stbi_write_png(job.filename.c_str(), job.resx, job.resy, 3, m_ldr.data(), job.resx * 3))
+                printf("Error: could not write %s\n", job.filename.c_str());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pendingBytes -= bytes;
+            m_writing = false;
+        }
+        m_wakeup.notify_all();
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include "usings.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "tonemapper.h"
+
+/* Writes images from a background thread so tonemapping, encoding and disk I/O stay off the render loop.
+ * Queued images are held as HDR copies; enqueue() blocks while more than maxPendingBytes are waiting. */
+class ImageWriter {
+public:
+    explicit ImageWriter(size_t maxPendingBytes = size_t(64) * 1024 * 1024);
+    ~ImageWriter();
+
+    ImageWriter(const ImageWriter &) = delete;
+    ImageWriter &operator=(const ImageWriter &) = delete;
+
+    /* Queues hdr (resx * resy pixels) to be tonemapped and written as a PNG. */
+    void enqueue(std::string filename, int resx, int resy, std::vector<Vec3f> hdr);
+
+    /* Blocks until every queued image has been written. */
+    void flush();
+
+    Tonemapper tonemapper; /// set before enqueueing, read by the writer thread
+
+private:
+    struct Job {
+        std::string filename;
+        int resx, resy;
+        std::vector<Vec3f> hdr;
+
+        size_t bytes() const { return hdr.size() * sizeof(Vec3f); }
+    };
+
+    void run();
+
+    size_t m_maxPendingBytes;
+    size_t m_pendingBytes{0};
+    bool m_writing{false};
+    bool m_stop{false};
+    std::vector<Vec3c> m_ldr; /// writer thread only
+    std::deque<Job> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::thread m_worker;
+};
+
+#endif
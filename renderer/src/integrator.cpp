@@ -2,16 +2,66 @@
 
 #include <iostream>
 #include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 
+#include "adaptivesampler.h"
+#include "imageio.h"
+#include "timeline.h"
 #include "weightedbitmapaccumulator.h"
 
 #include <OpenImageDenoise/oidn.h>
+#include <nlohmann/json.hpp>
+
+static float computeElapsedSeconds(std::chrono::steady_clock::time_point start) {
+    auto current = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(current - start);
+    return (float)ms.count() / 1000;
+}
+
+static nlohmann::json countersToJson(const RenderCounters& counters) {
+    return {
+        { "cameraRays", counters.cameraRays },
+        { "shadowRays", counters.shadowRays },
+        { "bsdfRays", counters.bsdfRays },
+        { "intersectionTests", counters.intersectionTests },
+        { "octreeLookups", counters.octreeLookups },
+        { "rrKills", counters.rrKills },
+        { "splits", counters.splits },
+        { "paths", counters.paths },
+        { "pathVertices", counters.pathVertices },
+        { "averagePathLength", counters.averagePathLength() }
+    };
+}
+
+static void writeCounterReport(const std::string& path, const nlohmann::json& report) {
+    std::ofstream out(path);
+    out << report.dump(2) << std::endl;
+    if (!out)
+        printf("Error: could not write the counter report to %s\n", path.c_str());
+}
+
+/* Prints the counters of a whole render, for the integrators that don't work in iterations, and reports them. */
+static void reportRenderCounters(Integrator& integrator, const char* name, float seconds) {
+    integrator.counters = collectCounters();
+    integrator.counters.print(seconds);
+    if (integrator.statsPath.empty())
+        return;
+    nlohmann::json report;
+    report["integrator"] = name;
+    report["seconds"] = seconds;
+    report["counters"] = countersToJson(integrator.counters);
+    writeCounterReport(integrator.statsPath, report);
+}
 
 void RayCastIntegrator::render(const Scene &scene, FrameBuffer &frame) {
     Camera cam = scene.camera;
     int resx = cam.resx;
     int resy = cam.resy;
     tracer = make_unique<IntersectionDebugTracer>(scene);
+    auto startTime = std::chrono::steady_clock::now();
+    collectCounters();
     for (int j = 0; j < resy; j++) {
         for (int i = 0; i < resx; i++) {
             Vec2i px(i, j);
@@ -19,6 +69,7 @@ void RayCastIntegrator::render(const Scene &scene, FrameBuffer &frame) {
             frame.set(px, tracer->trace(px, *sampler));
         }
     }
+    reportRenderCounters(*this, "raycast", computeElapsedSeconds(startTime));
 }
 
 void PathTraceIntegrator::render(const Scene &scene, FrameBuffer &frame) {
@@ -26,14 +77,49 @@ void PathTraceIntegrator::render(const Scene &scene, FrameBuffer &frame) {
     int resx = cam.resx;
     int resy = cam.resy;
     tracer = make_unique<PathTracer>(scene);
-    for (int j = 0; j < resy; j++) {
-        for (int i = 0; i < resx; i++) {
-            Vec2i px(i, j);
-            sampler->startPath(i + j, 0xFFFF);
-            frame.set(px, tracer->trace(px, *sampler));
+    auto startTime = std::chrono::steady_clock::now();
+    collectCounters();
+
+    ImageIO::TiledExrWriter tiles;
+    if (!tiledOutputPath.empty())
+        tiles.open(tiledOutputPath.c_str(), resx, resy, BLOCK_SIZE); /// a failure is reported and leaves it closed
+
+    if (adaptive.enabled) {
+        AdaptiveSampler adaptiveSampler(resx, resy, adaptive);
+        adaptiveSampler.render([&](const Vec2i& px) {
+            sampler->startPath(px.x() + px.y(), 0xFFFF);
+            return tracer->trace(px, *sampler);
+        });
+        for (int i = 0; i < resx * resy; i++)
+            frame.set(i, adaptiveSampler.mean(i));
+        /// no block is final before the budget is spent
+        for (int ty = 0; ty < tiles.tilesY() && tiles.isOpen(); ty++)
+            for (int tx = 0; tx < tiles.tilesX(); tx++)
+                tiles.writeTile(tx, ty, &frame.color[(ty * resx + tx) * BLOCK_SIZE], resx);
+        if (tiles.isOpen())
+            tiles.close();
+        reportRenderCounters(*this, "path", computeElapsedSeconds(startTime));
+        return;
+    }
+
+    /// blocks are done one after the other, each goes out to the tiled EXR as soon as it is finished
+    for (int blockY = 0; blockY < resy; blockY += BLOCK_SIZE) {
+        for (int blockX = 0; blockX < resx; blockX += BLOCK_SIZE) {
+            for (int j = blockY; j < std::min(blockY + BLOCK_SIZE, resy); j++) {
+                for (int i = blockX; i < std::min(blockX + BLOCK_SIZE, resx); i++) {
+                    Vec2i px(i, j);
+                    sampler->startPath(i + j, 0xFFFF);
+                    frame.set(px, tracer->trace(px, *sampler));
+                }
+            }
+            if (tiles.isOpen())
+                tiles.writeTile(blockX / BLOCK_SIZE, blockY / BLOCK_SIZE, &frame.color[blockY * resx + blockX], resx);
         }
-        std::cout << "Completed row " << j << "\r";
+        std::cout << "Completed row " << std::min(blockY + BLOCK_SIZE, resy) - 1 << "\r";
     }
+    if (tiles.isOpen())
+        tiles.close();
+    reportRenderCounters(*this, "path", computeElapsedSeconds(startTime));
 }
 
 void OIDNIntegrator::render(const Scene& scene, FrameBuffer& frame) {
@@ -44,26 +130,49 @@ void OIDNIntegrator::render(const Scene& scene, FrameBuffer& frame) {
     auto albedoTracer = make_unique<AlbedoTracer>(scene);
     auto normalTracer = make_unique<NormalTracer>(scene);
     frame.enableOidn();
-
-    for (int j = 0; j < resy; j++) {
-        for (int i = 0; i < resx; i++) {
-            Vec2i px(i, j);
-            sampler->startPath(i + j, 0xFFFF);
-            for (int i = 0; i < frame.spp; i++) {
-                frame.add(px, albedoTracer->trace(px, *sampler), FrameBuffer::ALBEDO);
-                frame.add(px, normalTracer->trace(px, *sampler), FrameBuffer::NORMAL);
-                frame.add(px, tracer->trace(px, *sampler), FrameBuffer::COLOR);
+    auto startTime = std::chrono::steady_clock::now();
+    collectCounters();
+
+    if (adaptive.enabled) {
+        AdaptiveSampler adaptiveSampler(resx, resy, adaptive);
+        adaptiveSampler.render([&](const Vec2i& px) {
+            sampler->startPath(px.x() + px.y(), 0xFFFF);
+            frame.add(px, albedoTracer->trace(px, *sampler), FrameBuffer::ALBEDO);
+            frame.add(px, normalTracer->trace(px, *sampler), FrameBuffer::NORMAL);
+            return tracer->trace(px, *sampler);
+        });
+        /// auxiliaries were summed over a different number of samples per pixel
+        for (int i = 0; i < resx * resy; i++) {
+            float n = (float)adaptiveSampler.count(i);
+            frame.set(i, frame.get(i, FrameBuffer::ALBEDO) / n, FrameBuffer::ALBEDO);
+            frame.set(i, frame.get(i, FrameBuffer::NORMAL) / n, FrameBuffer::NORMAL);
+            frame.set(i, adaptiveSampler.mean(i), FrameBuffer::COLOR);
+        }
+    } else {
+        for (int j = 0; j < resy; j++) {
+            for (int i = 0; i < resx; i++) {
+                Vec2i px(i, j);
+                sampler->startPath(i + j, 0xFFFF);
+                for (int i = 0; i < frame.spp; i++) {
+                    frame.add(px, albedoTracer->trace(px, *sampler), FrameBuffer::ALBEDO);
+                    frame.add(px, normalTracer->trace(px, *sampler), FrameBuffer::NORMAL);
+                    frame.add(px, tracer->trace(px, *sampler), FrameBuffer::COLOR);
+                }
             }
+            std::cout << "Completed row " << j << "\r";
         }
-        std::cout << "Completed row " << j << "\r";
-    }
 
-    frame.normalize(FrameBuffer::ALBEDO);
-    frame.normalize(FrameBuffer::NORMAL);
-    frame.normalize(FrameBuffer::COLOR);
+        frame.normalize(FrameBuffer::ALBEDO);
+        frame.normalize(FrameBuffer::NORMAL);
+        frame.normalize(FrameBuffer::COLOR);
+    }
+    /// the auxiliaries are traced along with the image and counted with it
+    reportRenderCounters(*this, "oidn", computeElapsedSeconds(startTime));
 
-    frame.toPng("albedo_img.png", FrameBuffer::ALBEDO);
-    frame.toPng("normal_img.png", FrameBuffer::NORMAL);
+    if (debugImages) {
+        frame.toPng("albedo_img.png", FrameBuffer::ALBEDO);
+        frame.toPng("normal_img.png", FrameBuffer::NORMAL);
+    }
 
     OIDNDevice device = oidnNewDevice(OIDN_DEVICE_TYPE_DEFAULT);
     oidnCommitDevice(device);
@@ -74,7 +183,10 @@ void OIDNIntegrator::render(const Scene& scene, FrameBuffer& frame) {
     oidnSetSharedFilterImage(filter, "output", frame.oidn.data(), OIDN_FORMAT_FLOAT3, resx, resy, 0, 0, 0);
     oidnSetFilter1b(filter, "hdr", true);
     oidnCommitFilter(filter);
-    oidnExecuteFilter(filter);
+    {
+        TimelineScope scope("OIDN");
+        oidnExecuteFilter(filter);
+    }
 
     const char* errorMessage;
     if (oidnGetDeviceError(device, &errorMessage) != OIDN_ERROR_NONE)
@@ -84,41 +196,52 @@ void OIDNIntegrator::render(const Scene& scene, FrameBuffer& frame) {
     oidnReleaseFilter(filter);
     oidnReleaseDevice(device);
 
-    frame.toPng("oidn_img.png", FrameBuffer::OIDN);
-}
-
-static float computeElapsedSeconds(std::chrono::steady_clock::time_point start) {
-    auto current = std::chrono::steady_clock::now();
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(current - start);
-    return (float)ms.count() / 1000;
+    if (debugImages)
+        frame.toPng("oidn_img.png", FrameBuffer::OIDN);
 }
 
 void EARSIntegrator::render(const Scene& scene, FrameBuffer& frame) {
+    TimelineScope frameScope("EARS frame", "frame", frameIndex);
+    const auto frameStartTime = std::chrono::steady_clock::now();
+    counters = RenderCounters();
     Camera cam = scene.camera;
     int resx = cam.resx;
     int resy = cam.resy;
 
     // EARS configuration
-    EARSTracer etracer(scene);
+    const bool freshTracer = !earsTracer || earsTracer->scene != &scene ||
+                             earsTracer->imageEstimate.size() != cam.resolution();
+    if (freshTracer)
+        resetTracer(scene);
+
+    if (configuration.asyncCacheBuild && !cacheBuilder)
+        cacheBuilder = make_unique<EARS::AsyncCacheBuilder>();
 
     // oidn setup
-    OIDNDevice device = oidnNewDevice(OIDN_DEVICE_TYPE_DEFAULT);
-    oidnCommitDevice(device);
+    if (!denoiser || denoiser->size() != cam.resolution()) {
+        denoiser = make_unique<AsyncDenoiser>(resx, resy);
+    }
     auto albedoTracer = make_unique<AlbedoTracer>(scene);
     auto normalTracer = make_unique<NormalTracer>(scene);
     Film albedo(resx, resy);
     Film normal(resx, resy);
 
     std::cout << "Rendering denoising auxillaries" << std::endl;
-    // render denoising auxillaries 
-    for (int j = 0; j < resy; j++) {
-        for (int i = 0; i < resx; i++) {
-            Vec2i px(i, j);
-            sampler->startPath(i + j, 0xFFFF);
-            albedo.add(px, albedoTracer->trace(px, *sampler));
-            normal.add(px, normalTracer->trace(px, *sampler));
+    // render denoising auxillaries, from a sampler of their own so that a checkpoint taken between frames
+    // leaves the next frame's paths the same random numbers whether it is resumed from or not
+    {
+        TimelineScope scope("Auxiliaries");
+        UniformPathSampler auxSampler(0xBA5EBA11);
+        for (int j = 0; j < resy; j++) {
+            for (int i = 0; i < resx; i++) {
+                Vec2i px(i, j);
+                auxSampler.startPath(i + j, 0xFFFF);
+                albedo.add(px, albedoTracer->trace(px, auxSampler));
+                normal.add(px, normalTracer->trace(px, auxSampler));
+            }
         }
     }
+    denoiser->setAuxiliaries(albedo, normal);
 
     Film rawEstimate(resx, resy);
     Film estimate(resx, resy);
@@ -127,36 +250,107 @@ void EARSIntegrator::render(const Scene& scene, FrameBuffer& frame) {
     Film lrEstImg(resx, resy);
     EARS::WeightedBitmapAccumulator finalImage{};
     finalImage.clear();
-    etracer.imageStatistics.setOutlierRejectionCount(10);
 
-    int spp = 4;
+    // resume an interrupted render. Later frames of a run already hold the state the last checkpoint was saved from
+    int firstIteration = 0;
+    if (freshTracer && configuration.resumeCheckpoint && !configuration.checkpointPath.empty() &&
+        loadCheckpoint(configuration.checkpointPath, finalImage, lrEstImg, firstIteration))
+        std::cout << "Resuming frame " << frameIndex << " at iteration " << firstIteration << std::endl;
+    EARSTracer& etracer = *earsTracer;
+
+    const bool isFirstFrame = frameIndex == 0;
+    const int iterations = isFirstFrame ? configuration.iterations : configuration.sequenceIterations;
+    const int pretrainIterations = isFirstFrame ? configuration.pretrainIterations : 0;
+
+    if (!isFirstFrame && firstIteration == 0) {
+        /// fade out what was learned on the previous frame rather than discarding it
+        etracer.cache.configuration.leafDecay = configuration.sequenceLeafDecay;
+        etracer.cache.build(false);
+        etracer.cache.configuration.leafDecay = 1;
+        std::cout << std::endl;
+    }
+
+    // the builder takes over the cache, unless it already resumed the build a checkpoint was written during
+    if (!cacheBuilder || !cacheBuilder->isActive()) {
+        /// only a mixed method learns from technique statistics and only guiding from incident radiance, the memory
+        /// bound leaves their room to nodes otherwise
+        etracer.cache.collectTechniques(configuration.rrs.technique == EARS::RRSMethod::EMixed);
+        etracer.cache.collectIncident(configuration.guiding);
+        if (configuration.asyncCacheBuild)
+            cacheBuilder->start(etracer.cache);
+    }
+
+    // restart the denoise job that was in flight when the checkpoint was written
+    if (firstIteration > 0 && finalImage.hasData()) {
+        finalImage.develop(&finalImg);
+        denoiser->submit(finalImg, firstIteration - 1, etracer.imageEstimate);
+    }
+
+    int spp = configuration.spp;
     int iteration;
 
-    etracer.cache.configuration.leafDecay = 1;
-    etracer.cache.setMaximumMemory(long(24) * 1024 * 1024);
+    // debug images use the frame's tonemapping, the writer only picks it up while idle
+    imageWriter.flush();
+    imageWriter.tonemapper = frame.tonemapper;
+    auto writeDebugImage = [this](const Film& film, const char* name, int iteration) {
+        if (!configuration.debugImages)
+            return;
+        char fname[32];
+        snprintf(fname, sizeof(fname), "iteration_%d_%s.png", iteration, name);
+        imageWriter.enqueue(fname, film.resx, film.resy, film.buffer);
+    };
 
     std::chrono::steady_clock::time_point renderStartTime = std::chrono::steady_clock::now();
+    float lastIterationSeconds = 0.0f;
 
-    for (iteration = 0; iteration <= 16; iteration++) {
+    for (iteration = firstIteration; iteration < iterations; iteration++) {
+        TimelineScope iterationScope("EARS iteration", "iteration", iteration);
         const float timeBeforeIter = computeElapsedSeconds(renderStartTime);
 
+        // an early stop keeps everything merged so far, at least one iteration always runs
+        if (iteration > 0 && preview && preview->stopRequested()) {
+            std::cout << "Stopped early after " << iteration << " iterations" << std::endl;
+            break;
+        }
+        if (configuration.timeBudget > 0 && iteration > firstIteration &&
+            computeElapsedSeconds(frameStartTime) + lastIterationSeconds > configuration.timeBudget) {
+            std::cout << "Stopped after " << iteration << " iterations, another would exceed the time budget" << std::endl;
+            break;
+        }
+
         estimate.clear();
         rawEstimate.clear();
+        /// only the passes count towards an iteration, not the auxiliaries or the lr image
+        collectCounters();
 
-        bool isPretraining = iteration < 3;
+        bool isPretraining = iteration < pretrainIterations;
 
         // don't use learning based methods unless caches have begun to converge
-        if (isPretraining) {
+        if (isPretraining && configuration.rrs.needsTrainingPhase()) {
             etracer.rrs = EARS::RRSMethod::Classic();
         }
         else {
-            etracer.rrs = EARS::RRSMethod::ADRRS();
+            etracer.rrs = configuration.rrs;
         }
+        etracer.guiding = configuration.guiding;
+        etracer.guidingBsdfFraction = std::clamp(configuration.guidingBsdfFraction, 0.0f, 1.0f);
+
+        if (cluster)
+            cluster->beginIteration(etracer, iteration);
 
         for (int pass = 1; pass <= spp; pass++) {
+            TimelineScope passScope("Pass", "pass", pass);
+            if (cluster) {
+                std::cout << (isPretraining ? "(Pretraining)" : "(Rendering)") <<
+                    " on " << cluster->size() << " workers with " << pass << "/" << spp << "spp\r";
+                cluster->renderPass(etracer, pass, spp, estimate, rawEstimate);
+                continue;
+            }
+
             // block rendering
             for (int blockY = 0; blockY < resy; blockY += 32) {
                 for (int blockX = 0; blockX < resx; blockX += 32) {
+                    TimelineScope blockScope("Block");
                     EARS::OutlierRejectedAverage blockStatistics;
                     blockStatistics.resize(10);
                     if (etracer.imageStatistics.hasOutlierLowerBound()) {
@@ -167,8 +361,8 @@ void EARSIntegrator::render(const Scene& scene, FrameBuffer& frame) {
                     std::cout << (isPretraining ? "(Pretraining)" : "(Rendering)") <<
                         " blockX : " << blockX << " blockY : " << blockY <<
                         " with " << pass <<"/" << spp << "spp\r";
-                    for (int y = blockY; y < blockY + 32; y++) {
-                        for (int x = blockX; x < blockX + 32; x++) {
+                    for (int y = blockY; y < std::min(blockY + 32, resy); y++) {
+                        for (int x = blockX; x < std::min(blockX + 32, resx); x++) {
                             Vec2i px(x, y);
                             sampler->startPath(x + y, 0xFFFF);
                             Vec3f li = etracer.trace(px, *sampler);
@@ -182,14 +376,23 @@ void EARSIntegrator::render(const Scene& scene, FrameBuffer& frame) {
             }
         }
         std::cout << std::endl;
+        RenderCounters iterationCounters = collectCounters();
+        counters += iterationCounters;
+
+        // training data of the workers has to be in the cache before it is built
+        if (cluster)
+            cluster->endIteration(etracer);
 
         // draw lr cache
-        for (int y = 0; y < resy; y++) {
-            for (int x = 0; x < resy; x++) {
-                Vec2i px(x, y);
-                sampler->startPath(x + y, 0xFFFF);
-                Vec3f lr = etracer.LrEstimate(px, *sampler);
-                lrEstImg.add(px, lr);
+        {
+            TimelineScope scope("LR cache");
+            for (int y = 0; y < resy; y++) {
+                for (int x = 0; x < resx; x++) {
+                    Vec2i px(x, y);
+                    sampler->startPath(x + y, 0xFFFF);
+                    Vec3f lr = etracer.LrEstimate(px, *sampler);
+                    lrEstImg.add(px, lr);
+                }
             }
         }
 
@@ -199,60 +402,220 @@ void EARSIntegrator::render(const Scene& scene, FrameBuffer& frame) {
         // reject outliers
         etracer.imageStatistics.applyOutlierRejection();
         // update caches
-        etracer.cache.build(true);
+        if (configuration.asyncCacheBuild)
+            cacheBuilder->submit(etracer.cache, true);
+        else
+            etracer.cache.build(true);
         // update image statistics
-        etracer.updateImageStatistics((computeElapsedSeconds(renderStartTime) - timeBeforeIter));
+        const float iterationSeconds = computeElapsedSeconds(renderStartTime) - timeBeforeIter;
+        etracer.updateImageStatistics(iterationSeconds, iterationCounters);
+        if (!statsPath.empty())
+            counterReport.push_back({ frameIndex, iteration, spp, isPretraining, iterationSeconds, iterationCounters });
 
         // finalImage.add(rawEstimate, spp);
         finalImage.add(
             rawEstimate, spp,
             etracer.rrs.performsInvVarWeighting() ?
-            (iteration > 0 ? etracer.imageStatistics.squareError().avg() : 0) :
+            (iteration > 0 || !isFirstFrame ? etracer.imageStatistics.squareError().avg() : 0) :
             1
         );
 
-        if (finalImage.hasData())
-            finalImage.develop(&etracer.imageEstimate);
-
-        // denoise estimate
-        OIDNFilter filter = oidnNewFilter(device, "RT");
-        oidnSetSharedFilterImage(filter, "color", etracer.imageEstimate.data(), OIDN_FORMAT_FLOAT3, resx, resy, 0, 0, 0);
-        oidnSetSharedFilterImage(filter, "albedo", albedo.data(), OIDN_FORMAT_FLOAT3, resx, resy, 0, 0, 0);
-        oidnSetSharedFilterImage(filter, "normal", normal.data(), OIDN_FORMAT_FLOAT3, resx, resy, 0, 0, 0);
-        oidnSetSharedFilterImage(filter, "output", etracer.imageEstimate.data(), OIDN_FORMAT_FLOAT3, resx, resy, 0, 0, 0);
-        oidnSetFilter1b(filter, "hdr", true);
-        oidnCommitFilter(filter);
-        oidnExecuteFilter(filter);
-
-        const char* errorMessage;
-        if (oidnGetDeviceError(device, &errorMessage) != OIDN_ERROR_NONE)
-            printf("Error: %s\n", errorMessage);
+        // denoise estimate in the background while the next iteration renders,
+        // which then takes over the one denoised during this iteration
+        finalImage.develop(&finalImg);
+        if (finalImage.hasData()) {
+            int denoisedIteration = denoiser->submit(finalImg, iteration, etracer.imageEstimate);
+            if (denoisedIteration >= 0)
+                writeDebugImage(etracer.imageEstimate, "denoise", denoisedIteration);
+        }
 
         // debug images
-        char fname[32];
-        frame.color = etracer.imageEstimate.buffer;
-        snprintf(fname, sizeof(fname), "iteration_%d_denoise.png", iteration);
-        frame.toPng(fname);
+        writeDebugImage(estimate, "estimate", iteration);
+        writeDebugImage(finalImg, "merged", iteration);
+        writeDebugImage(lrEstImg, "lr", iteration);
 
-        frame.color = estimate.buffer;
-        snprintf(fname, sizeof(fname), "iteration_%d_estimate.png", iteration);
-        frame.toPng(fname);
+        if (!configuration.checkpointPath.empty() && (iteration + 1) % configuration.checkpointInterval == 0)
+            saveCheckpoint(configuration.checkpointPath, finalImage, lrEstImg, iteration + 1);
 
-        finalImage.develop(&finalImg);
-        frame.color = finalImg.buffer;
-        snprintf(fname, sizeof(fname), "iteration_%d_merged.png", iteration);
-        frame.toPng(fname);
+        if (preview && preview->due())
+            preview->publish(finalImg.buffer, resx, resy, frameIndex, iteration, (iteration + 1) * spp, computeElapsedSeconds(renderStartTime));
 
-        frame.color = lrEstImg.buffer;
-        snprintf(fname, sizeof(fname), "iteration_%d_lr.png", iteration);
-        frame.toPng(fname);
+        std::cout << "Frame : " << frameIndex << " Iteration : " << iteration << " Spp : " << spp << " Avg variance : " << etracer.imageStatistics.squareError().avg() << " Image EARS Factor : " << etracer.imageEarsFactor << " Elapsed : " << timeBeforeIter << std::endl;
+        lastIterationSeconds = computeElapsedSeconds(renderStartTime) - timeBeforeIter;
+    }
 
-        std::cout << "Iteration : " << iteration << " Spp : " << spp << " Avg variance : " << etracer.imageStatistics.squareError().avg() << " Image EARS Factor : " << etracer.imageEarsFactor << " Elapsed : " << timeBeforeIter << std::endl;
+    if (configuration.asyncCacheBuild) {
+        cacheBuilder->finish(etracer.cache);
+        std::cout << std::endl;
     }
 
-    oidnReleaseDevice(device);
+    int denoisedIteration = denoiser->finish(etracer.imageEstimate);
+    if (denoisedIteration >= 0)
+        writeDebugImage(etracer.imageEstimate, "denoise", denoisedIteration);
 
     frame.useOidn = true;
     frame.color = finalImg.buffer;
     frame.oidn = estimate.buffer;
+
+    if (!statsPath.empty()) {
+        nlohmann::json report;
+        RenderCounters total;
+        float seconds = 0;
+        report["integrator"] = "ears";
+        report["iterations"] = nlohmann::json::array();
+        for (const auto& entry : counterReport) {
+            report["iterations"].push_back({
+                { "frame", entry.frame },
+                { "iteration", entry.iteration },
+                { "spp", entry.spp },
+                { "pretraining", entry.pretraining },
+                { "seconds", entry.seconds },
+                { "counters", countersToJson(entry.counters) }
+            });
+            total += entry.counters;
+            seconds += entry.seconds;
+        }
+        report["seconds"] = seconds;
+        report["counters"] = countersToJson(total);
+        writeCounterReport(statsPath, report);
+    }
+    frameIndex++;
+
+    /// a finished frame leaves the state the next frame of a sequence starts from
+    if (!configuration.checkpointPath.empty())
+        saveCheckpoint(configuration.checkpointPath, EARS::WeightedBitmapAccumulator{}, Film(resx, resy), 0);
+}
+
+void EARSIntegrator::resetTracer(const Scene& scene) {
+    earsTracer = make_unique<EARSTracer>(scene);
+    earsTracer->imageStatistics.setOutlierRejectionCount(10);
+    earsTracer->cache.configuration.leafDecay = 1;
+    earsTracer->cache.setMaximumMemory(long(24) * 1024 * 1024);
+    frameIndex = 0;
+    counterReport.clear();
+}
+
+/// "RCKP", bumped with the version whenever the layout changes
+static constexpr uint32 CHECKPOINT_MAGIC = 0x504B4352;
+static constexpr uint32 CHECKPOINT_VERSION = 9;
+
+bool EARSIntegrator::saveCheckpoint(const std::string& path, const EARS::WeightedBitmapAccumulator& finalImage,
+                                    const Film& lrEstImg, int nextIteration) const {
+    TimelineScope scope("Checkpoint");
+    /// write next to the old checkpoint and swap, so preemption mid-write never leaves a broken file behind
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            printf("Error: could not write checkpoint %s\n", tmpPath.c_str());
+            return false;
+        }
+        streamWrite(out, CHECKPOINT_MAGIC);
+        streamWrite(out, CHECKPOINT_VERSION);
+        streamWrite(out, earsTracer->imageEstimate.size());
+        streamWrite(out, frameIndex);
+        streamWrite(out, nextIteration);
+
+        sampler->saveState(out);
+        /// while building, the builder's tree holds the training data and the tracer's copy what it samples from
+        bool building = cacheBuilder && cacheBuilder->isActive();
+        streamWrite(out, building);
+        if (building)
+            cacheBuilder->tree().saveState(out);
+        earsTracer->cache.saveState(out);
+        earsTracer->imageStatistics.saveState(out);
+        streamWrite(out, earsTracer->imageEarsFactor);
+        streamWrite(out, earsTracer->imageEstimate.buffer);
+        finalImage.saveState(out);
+        streamWrite(out, lrEstImg.buffer);
+
+        if (!out) {
+            printf("Error: failed writing checkpoint %s\n", tmpPath.c_str());
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    if (error) {
+        printf("Error: could not replace checkpoint %s: %s\n", path.c_str(), error.message().c_str());
+        return false;
+    }
+    return true;
+}
+
+bool EARSIntegrator::loadCheckpoint(const std::string& path, EARS::WeightedBitmapAccumulator& finalImage,
+                                    Film& lrEstImg, int& nextIteration) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+
+    uint32 magic = 0, version = 0;
+    Vec2i size;
+    int checkpointFrame = 0;
+    streamRead(in, magic);
+    streamRead(in, version);
+    streamRead(in, size);
+    if (!in || magic != CHECKPOINT_MAGIC || version != CHECKPOINT_VERSION) {
+        printf("Error: %s is not a compatible checkpoint, starting from scratch\n", path.c_str());
+        return false;
+    }
+    if (size != earsTracer->imageEstimate.size()) {
+        printf("Error: checkpoint %s was written at a different resolution, starting from scratch\n", path.c_str());
+        return false;
+    }
+    streamRead(in, checkpointFrame);
+    streamRead(in, nextIteration);
+
+    /// keep the stream the auxiliaries left behind in case the checkpoint turns out to be unusable
+    std::stringstream samplerState;
+    sampler->saveState(samplerState);
+    sampler->loadState(in);
+    bool building = false;
+    EARS::Octtree built;
+    streamRead(in, building);
+    if (building)
+        built.loadState(in);
+    earsTracer->cache.loadState(in);
+    earsTracer->imageStatistics.loadState(in);
+    streamRead(in, earsTracer->imageEarsFactor);
+    streamRead(in, earsTracer->imageEstimate.buffer);
+    finalImage.loadState(in);
+    streamRead(in, lrEstImg.buffer);
+
+    if (!in) {
+        /// the state is half overwritten by now, start over rather than render from a mix
+        printf("Error: checkpoint %s is truncated, starting from scratch\n", path.c_str());
+        const int frame = frameIndex;
+        resetTracer(*earsTracer->scene);
+        frameIndex = frame;
+        sampler->loadState(samplerState);
+        finalImage.clear();
+        lrEstImg.clear();
+        nextIteration = 0;
+        return false;
+    }
+
+    if (building && configuration.asyncCacheBuild)
+        cacheBuilder->resume(std::move(built));
+    else if (building)
+        /// rendering synchronously from here on, with the tree that was being built
+        earsTracer->cache = std::move(built);
+
+    frameIndex = checkpointFrame;
+    return true;
+}
+
+int EARSIntegrator::checkpointFrame(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    uint32 magic = 0, version = 0;
+    Vec2i size;
+    int frame = -1;
+    streamRead(in, magic);
+    streamRead(in, version);
+    streamRead(in, size);
+    streamRead(in, frame);
+    if (!in || magic != CHECKPOINT_MAGIC || version != CHECKPOINT_VERSION)
+        return -1;
+    return frame;
 }
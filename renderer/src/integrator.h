@@ -3,8 +3,16 @@
 
 #include "usings.h"
 
+#include "adaptivesampler.h"
+#include "cachebuilder.h"
+#include "counters.h"
+#include "denoiser.h"
+#include "distributed.h"
 #include "framebuffer.h"
+#include "imagewriter.h"
+#include "preview.h"
 #include "tracer.h"
+#include "weightedbitmapaccumulator.h"
 #include "sampler.h"
 #include "scene.h"
 
@@ -14,6 +22,9 @@ public:
     virtual void render(const Scene &scene, FrameBuffer &frame) = 0;
     unique_ptr<Tracer> tracer;
     unique_ptr<PathSampleGenerator> sampler;
+    PreviewStream *preview{nullptr}; /// progressive integrators publish snapshots here and honour stop requests
+    std::string statsPath; /// JSON report of the render counters, empty to disable
+    RenderCounters counters; /// counts of the last render, only those of the passes for EARS
 };
 
 class RayCastIntegrator : public Integrator {
@@ -26,10 +37,15 @@ public:
 
 class PathTraceIntegrator : public Integrator {
 public:
+    static constexpr int BLOCK_SIZE = 32;
+
     PathTraceIntegrator() {
         sampler = std::unique_ptr<PathSampleGenerator>(new UniformPathSampler(0xBA5EBA11));
     }
     void render(const Scene &scene, FrameBuffer &frame) override;
+
+    AdaptiveSampler::Configuration adaptive;
+    std::string tiledOutputPath; /// tiled EXR each block is written to as soon as it is rendered, empty to disable
 };
 
 class OIDNIntegrator : public Integrator {
@@ -38,16 +54,76 @@ public:
         sampler = std::unique_ptr<PathSampleGenerator>(new UniformPathSampler(0xBA5EBA11));
     }
     void render(const Scene& scene, FrameBuffer& frame) override;
+
+    AdaptiveSampler::Configuration adaptive;
+    bool debugImages{true}; /// albedo, normal and denoised PNGs in the working directory
 };
 
 /* Adapted From Rath et. al.'s EARS
  * https://github.com/irath96/ears */
 class EARSIntegrator : public Integrator {
 public:
+    struct Configuration {
+        int spp = 4;
+        int iterations = 17;
+        int pretrainIterations = 3;
+        int sequenceIterations = 8;     /// iterations for later frames of a sequence, which start from a trained cache
+        float sequenceLeafDecay = 0.5f; /// share of the previous frame's training data carried into the next frame
+        bool debugImages = true;        /// per-iteration denoise/estimate/merged/lr PNGs
+        std::string checkpointPath;     /// resume from and periodically save to this file, empty to disable
+        int checkpointInterval = 1;     /// iterations between checkpoints
+        bool resumeCheckpoint = true;   /// load checkpointPath first, only done while the tracer holds no state yet
+        EARS::RRSMethod rrs = EARS::RRSMethod::ADRRS(); /// used once pretraining is done, throughout if it needs no training
+        bool guiding = false;            /// guide BSDF sampling by the cache's incident radiance histograms
+        float guidingBsdfFraction = 0.5f; /// share of guided samples still drawn from the BSDF
+        bool asyncCacheBuild = false;     /// build the cache while the next iteration renders, which then samples from the build before
+        float timeBudget = 0.0f;          /// seconds from the start of render(), an iteration is only started if the
+                                          /// last one's duration still fits. 0 for no limit
+    };
+
     EARSIntegrator() {
         sampler = std::unique_ptr<PathSampleGenerator>(new UniformPathSampler(0xBA5EBA11));
     }
+
+    /**
+     * Renders one frame. Repeated calls with the same scene (e.g. the frames of an animation) keep the
+     * EARS cache and image statistics, so only the first frame pays for pretraining.
+     */
     void render(const Scene& scene, FrameBuffer& frame) override;
+
+    /* Frame a checkpoint file would resume at, -1 if there is no usable checkpoint. */
+    static int checkpointFrame(const std::string& path);
+
+    Configuration configuration;
+    TileCluster *cluster{nullptr}; /// traces the passes on worker processes when set
+    unique_ptr<EARSTracer> earsTracer;
+    unique_ptr<AsyncDenoiser> denoiser;
+    unique_ptr<EARS::AsyncCacheBuilder> cacheBuilder; /// created once asyncCacheBuild is used
+    ImageWriter imageWriter;
+
+private:
+    void resetTracer(const Scene& scene);
+
+    /**
+     * Checkpoints hold everything a render depends on between iterations: the sampler stream, the cache with its
+     * training data, image statistics and estimate, and the merged image. Resuming from one reproduces the
+     * uninterrupted render.
+     */
+    bool saveCheckpoint(const std::string& path, const EARS::WeightedBitmapAccumulator& finalImage,
+                        const Film& lrEstImg, int nextIteration) const;
+    bool loadCheckpoint(const std::string& path, EARS::WeightedBitmapAccumulator& finalImage,
+                        Film& lrEstImg, int& nextIteration);
+    int frameIndex{0};
+
+    struct IterationCounters {
+        int frame;
+        int iteration;
+        int spp;
+        bool pretraining;
+        float seconds;
+        RenderCounters counters;
+    };
+    std::vector<IterationCounters> counterReport; /// iterations since the tracer was reset, kept if statsPath is set
 };
 
 #endif
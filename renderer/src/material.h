@@ -15,6 +15,12 @@ public:
     virtual float pdf(const SurfaceScatterEvent& event) const = 0;
     virtual bool sample(SurfaceScatterEvent& event) const = 0;
 
+    /* Phong-equivalent exponent of the glossiest lobe, 0 for diffuse materials. */
+    virtual float shininess() const { return 0.0f; }
+
+    /* Whether any part of the BSDF is non-delta, i.e. can be evaluated and learned by the EARS cache. */
+    virtual bool hasSmoothComponent() const { return true; }
+
     Vec3f albedo{};
     Vec3f debug{randf(), randf(), randf()};
 };
@@ -44,6 +50,48 @@ public:
     }
 };
 
+/* Energy-normalised Phong lobe around the mirror direction. */
+class Phong : public Material {
+public:
+    Phong(const Vec3f &albedo, float exponent) : exponent(exponent) {
+        this->albedo = albedo;
+    };
+    Vec3f eval(const SurfaceScatterEvent& event) const override {
+        if (event.wi.z() <= 0.0f || event.wo.z() <= 0.0f)
+            return Vec3f(0.0f);
+        return albedo * ((exponent + 2.0f) * INV_TWO_PI) * lobe(event) * event.wo.z();
+    }
+    float pdf(const SurfaceScatterEvent& event) const override {
+        if (event.wi.z() <= 0.0f || event.wo.z() <= 0.0f)
+            return 0.0f;
+        return (exponent + 1.0f) * INV_TWO_PI * lobe(event);
+    }
+    bool sample(SurfaceScatterEvent& event) const override {
+        if (event.wi.z() <= 0.0f)
+            return false;
+        Vec2f xi = event.sampler->next2D(BsdfSample);
+        float phi = xi.x() * TWO_PI;
+        float cosAlpha = std::pow(xi.y(), 1.0f / (exponent + 1.0f));
+        float sinAlpha = std::sqrt(std::max(1.0f - cosAlpha * cosAlpha, 0.0f));
+        TangentFrame frame(Vec3f(-event.wi.x(), -event.wi.y(), event.wi.z()));
+        event.wo = frame.toGlobal(Vec3f(std::cos(phi) * sinAlpha, std::sin(phi) * sinAlpha, cosAlpha));
+        if (event.wo.z() <= 0.0f)
+            return false;
+        event.pdf = (exponent + 1.0f) * INV_TWO_PI * std::pow(cosAlpha, exponent);
+        event.weight = albedo * ((exponent + 2.0f) / (exponent + 1.0f) * event.wo.z());
+        return true;
+    }
+    float shininess() const override { return exponent; }
+
+    float exponent;
+
+private:
+    float lobe(const SurfaceScatterEvent& event) const {
+        float cosAlpha = Vec3f(-event.wi.x(), -event.wi.y(), event.wi.z()).dot(event.wo);
+        return cosAlpha > 0.0f ? std::pow(cosAlpha, exponent) : 0.0f;
+    }
+};
+
 class Emitter {
 public:
     explicit Emitter(const Vec3f &radiance) : radiance(radiance) {};
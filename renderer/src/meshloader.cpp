@@ -0,0 +1,681 @@
+#include "meshloader.h"
+
+#include <cctype>
+#include <cstring>
+
+#include "floatparser.h"
+#include "parallel.h"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const char *filename) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        return;
+    }
+    m_data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return;
+    }
+    m_size = size_t(size.QuadPart);
+    m_file = file;
+    m_mapping = mapping;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    void *data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return;
+    madvise(data, size_t(st.st_size), MADV_SEQUENTIAL);
+    m_data = static_cast<const char *>(data);
+    m_size = size_t(st.st_size);
+#endif
+}
+
+MappedFile::~MappedFile() {
+    if (!m_data)
+        return;
+#if defined(_WIN32)
+    UnmapViewOfFile(m_data);
+    CloseHandle(static_cast<HANDLE>(m_mapping));
+    CloseHandle(static_cast<HANDLE>(m_file));
+#else
+    munmap(const_cast<char *>(m_data), m_size);
+#endif
+}
+
+namespace {
+
+constexpr size_t MIN_CHUNK_BYTES = size_t(1) << 20;
+
+struct Chunk {
+    const char *begin;
+    const char *end;
+    size_t lineOffset{0};
+    size_t lineCount{0};
+    size_t vertexOffset{0};
+    size_t vertexCount{0};
+    size_t triangleOffset{0};
+    size_t triangleCount{0};
+};
+
+/* Splits [begin, end) into chunks that each start at the beginning of a line. */
+std::vector<Chunk> splitLines(const char *begin, const char *end) {
+    size_t size = end - begin;
+    size_t count = std::max<size_t>(1, std::min<size_t>(threadCount() * 4, size / MIN_CHUNK_BYTES));
+
+    std::vector<Chunk> chunks;
+    const char *chunkBegin = begin;
+    for (size_t i = 1; i <= count && chunkBegin < end; i++) {
+        const char *chunkEnd = i == count ? end : begin + size * i / count;
+        if (chunkEnd < chunkBegin)
+            chunkEnd = chunkBegin;
+        while (chunkEnd > begin && chunkEnd < end && chunkEnd[-1] != '\n')
+            chunkEnd++;
+        if (chunkEnd > chunkBegin)
+            chunks.push_back({chunkBegin, chunkEnd});
+        chunkBegin = chunkEnd;
+    }
+    return chunks;
+}
+
+/* Tokens up to the end of the line or a trailing # comment. */
+int countTokens(const char *p, const char *end) {
+    int tokens = 0;
+    while (true) {
+        skipBlanks(p, end);
+        if (p >= end || *p == '\n' || *p == '#')
+            return tokens;
+        skipToken(p, end);
+        tokens++;
+    }
+}
+
+bool isObjTag(const char *p, const char *end, char tag) {
+    return p + 1 < end && p[0] == tag && (p[1] == ' ' || p[1] == '\t');
+}
+
+uint32 resolveObjIndex(int64_t index, size_t verticesSoFar) {
+    if (index < 0)
+        return uint32(int64_t(verticesSoFar) + index);
+    return uint32(index - 1);
+}
+
+}
+
+bool MeshLoader::load(const char *filename, MeshData &mesh) {
+    std::string name(filename);
+    std::string ext = name.substr(name.find_last_of('.') + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    if (ext == "obj")
+        return loadObj(filename, mesh);
+    if (ext == "ply")
+        return loadPly(filename, mesh);
+
+    printf("Error: unsupported mesh format %s\n", filename);
+    return false;
+}
+
+bool MeshLoader::loadObj(const char *filename, MeshData &mesh) {
+    MappedFile file(filename);
+    if (!file.valid()) {
+        printf("Error: could not map %s\n", filename);
+        return false;
+    }
+
+    std::vector<Chunk> chunks = splitLines(file.begin(), file.end());
+
+    /// count vertices and (fan-triangulated) faces per chunk
+    parallelFor(int(chunks.size()), [&](int c) {
+        Chunk &chunk = chunks[c];
+        const char *p = chunk.begin;
+        while (p < chunk.end) {
+            skipBlanks(p, chunk.end);
+            if (isObjTag(p, chunk.end, 'v')) {
+                chunk.vertexCount++;
+            } else if (isObjTag(p, chunk.end, 'f')) {
+                int corners = countTokens(p + 1, chunk.end);
+                if (corners >= 3)
+                    chunk.triangleCount += corners - 2;
+            }
+            skipLine(p, chunk.end);
+        }
+    });
+
+    size_t vertexCount = 0;
+    size_t triangleCount = 0;
+    for (auto &chunk : chunks) {
+        chunk.vertexOffset = vertexCount;
+        chunk.triangleOffset = triangleCount;
+        vertexCount += chunk.vertexCount;
+        triangleCount += chunk.triangleCount;
+    }
+
+    mesh.vertices.resize(vertexCount);
+    mesh.triangles.resize(triangleCount);
+
+    /// parse every chunk directly into its slice of the output buffers
+    parallelFor(int(chunks.size()), [&](int c) {
+        const Chunk &chunk = chunks[c];
+        Vec3f *vertex = mesh.vertices.data() + chunk.vertexOffset;
+        Vec3u *triangle = mesh.triangles.data() + chunk.triangleOffset;
+        size_t verticesSoFar = chunk.vertexOffset;
+
+        const char *p = chunk.begin;
+        while (p < chunk.end) {
+            skipBlanks(p, chunk.end);
+            if (isObjTag(p, chunk.end, 'v')) {
+                p++;
+                float xyz[3] = {0.0f, 0.0f, 0.0f};
+                for (float &f : xyz)
+                    parseFloat(p, chunk.end, f);
+                *vertex++ = Vec3f(xyz);
+                verticesSoFar++;
+            } else if (isObjTag(p, chunk.end, 'f')) {
+                p++;
+                int corners = countTokens(p, chunk.end);
+                uint32 first = 0, previous = 0;
+                for (int i = 0; i < corners; i++) {
+                    int64_t index = 0;
+                    parseInt(p, chunk.end, index);
+                    skipToken(p, chunk.end);
+                    uint32 current = resolveObjIndex(index, verticesSoFar);
+                    if (i == 0)
+                        first = current;
+                    else if (i >= 2)
+                        *triangle++ = Vec3u(first, previous, current);
+                    previous = current;
+                }
+            }
+            skipLine(p, chunk.end);
+        }
+    });
+
+    for (const auto &tri : mesh.triangles) {
+        if (tri.x() >= vertexCount || tri.y() >= vertexCount || tri.z() >= vertexCount) {
+            printf("Error: %s references a vertex out of range\n", filename);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+namespace {
+
+enum class PlyFormat {
+    Ascii,
+    BinaryLittleEndian,
+    BinaryBigEndian
+};
+
+struct PlyProperty {
+    std::string name;
+    int size{0};
+    bool isFloat{false};
+    bool isSigned{false};
+    bool isList{false};
+    int countSize{0};
+    bool countIsSigned{false};
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count{0};
+    std::vector<PlyProperty> properties;
+
+    int stride() const {
+        int s = 0;
+        for (const auto &p : properties) {
+            if (p.isList)
+                return -1;
+            s += p.size;
+        }
+        return s;
+    }
+
+    int find(const char *property) const {
+        for (int i = 0; i < int(properties.size()); i++)
+            if (properties[i].name == property)
+                return i;
+        return -1;
+    }
+
+    /* The list holding a face's vertex indices, its other properties (colors, flags, ...) are skipped. */
+    int findFaceIndices() const {
+        int index = find("vertex_indices");
+        if (index < 0)
+            index = find("vertex_index");
+        return index >= 0 && properties[index].isList ? index : -1;
+    }
+};
+
+int plyTypeSize(const std::string &type, bool &isFloat, bool &isSigned) {
+    isFloat = type == "float" || type == "float32" || type == "double" || type == "float64";
+    isSigned = type == "char" || type == "int8" || type == "short" || type == "int16" || type == "int" || type == "int32";
+    if (type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+        return 1;
+    if (type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+        return 2;
+    if (type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32")
+        return 4;
+    if (type == "double" || type == "float64")
+        return 8;
+    return 0;
+}
+
+double readBinary(const char *p, int size, bool isFloat, bool isSigned) {
+    switch (size) {
+    case 1:
+        return isSigned ? double(int8(*p)) : double(uint8(*p));
+    case 2:
+        if (isSigned) {
+            int16 v;
+            std::memcpy(&v, p, 2);
+            return double(v);
+        } else {
+            uint16 v;
+            std::memcpy(&v, p, 2);
+            return double(v);
+        }
+    case 4:
+        if (isFloat) {
+            float v;
+            std::memcpy(&v, p, 4);
+            return double(v);
+        } else if (isSigned) {
+            int32 v;
+            std::memcpy(&v, p, 4);
+            return double(v);
+        } else {
+            uint32 v;
+            std::memcpy(&v, p, 4);
+            return double(v);
+        }
+    case 8: {
+        double v;
+        std::memcpy(&v, p, 8);
+        return v;
+    }
+    }
+    return 0.0;
+}
+
+/* Advances p past one record's value of property, false if it runs past end. */
+bool skipBinary(const char *&p, const char *end, const PlyProperty &property) {
+    size_t size = property.size;
+    if (property.isList) {
+        if (p + property.countSize > end)
+            return false;
+        double count = readBinary(p, property.countSize, false, property.countIsSigned);
+        if (count < 0.0)
+            return false;
+        p += property.countSize;
+        size *= size_t(count);
+    }
+    if (size_t(end - p) < size)
+        return false;
+    p += size;
+    return true;
+}
+
+void skipAscii(const char *&p, const char *end, const PlyProperty &property) {
+    int64_t count = 1;
+    if (property.isList && !parseInt(p, end, count))
+        return;
+    for (int64_t i = 0; i < count; i++) {
+        skipBlanks(p, end);
+        skipToken(p, end);
+    }
+}
+
+bool parsePlyHeader(const char *&p, const char *end, PlyFormat &format, std::vector<PlyElement> &elements) {
+    auto readLine = [&](std::string &line) {
+        const char *lineBegin = p;
+        skipLine(p, end);
+        line.assign(lineBegin, p);
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+    };
+
+    std::string line;
+    readLine(line);
+    if (line != "ply")
+        return false;
+
+    while (p < end) {
+        readLine(line);
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        if (keyword == "format") {
+            std::string type;
+            stream >> type;
+            if (type == "ascii")
+                format = PlyFormat::Ascii;
+            else if (type == "binary_little_endian")
+                format = PlyFormat::BinaryLittleEndian;
+            else
+                format = PlyFormat::BinaryBigEndian;
+        } else if (keyword == "element") {
+            PlyElement element;
+            stream >> element.name >> element.count;
+            elements.push_back(element);
+        } else if (keyword == "property" && !elements.empty()) {
+            PlyProperty property;
+            std::string type;
+            stream >> type;
+            if (type == "list") {
+                std::string countType, indexType;
+                stream >> countType >> indexType;
+                bool countIsFloat;
+                property.isList = true;
+                property.countSize = plyTypeSize(countType, countIsFloat, property.countIsSigned);
+                property.size = plyTypeSize(indexType, property.isFloat, property.isSigned);
+            } else {
+                property.size = plyTypeSize(type, property.isFloat, property.isSigned);
+            }
+            stream >> property.name;
+            elements.back().properties.push_back(property);
+        } else if (keyword == "end_header") {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool loadPlyBinary(const char *p, const char *end, const std::vector<PlyElement> &elements, MeshData &mesh) {
+    for (const auto &element : elements) {
+        if (element.name == "vertex") {
+            int stride = element.stride();
+            int ix = element.find("x"), iy = element.find("y"), iz = element.find("z");
+            if (stride < 0 || ix < 0 || iy < 0 || iz < 0 || p + stride * element.count > end)
+                return false;
+
+            int offsets[3] = {0, 0, 0};
+            const int axes[3] = {ix, iy, iz};
+            for (int a = 0; a < 3; a++)
+                for (int i = 0; i < axes[a]; i++)
+                    offsets[a] += element.properties[i].size;
+
+            mesh.vertices.resize(element.count);
+            const char *base = p;
+            int blocks = int(std::min<size_t>(threadCount() * 4, element.count / 4096 + 1));
+            parallelFor(blocks, [&](int b) {
+                size_t begin = element.count * b / blocks;
+                size_t stop = element.count * (b + 1) / blocks;
+                for (size_t v = begin; v < stop; v++) {
+                    const char *record = base + v * stride;
+                    for (int a = 0; a < 3; a++) {
+                        const PlyProperty &prop = element.properties[axes[a]];
+                        mesh.vertices[v][a] = float(readBinary(record + offsets[a], prop.size, prop.isFloat, prop.isSigned));
+                    }
+                }
+            });
+            p += stride * element.count;
+        } else if (element.name == "face") {
+            const int listIndex = element.findFaceIndices();
+            if (listIndex < 0)
+                return false;
+            const PlyProperty &list = element.properties[listIndex];
+
+            /// bytes of the scalar properties before and after the index list
+            size_t before = 0, after = 0;
+            bool scalarsOnly = true;
+            for (int i = 0; i < int(element.properties.size()); i++) {
+                if (i == listIndex)
+                    continue;
+                const PlyProperty &other = element.properties[i];
+                scalarsOnly = scalarsOnly && !other.isList;
+                (i < listIndex ? before : after) += other.size;
+            }
+
+            /// fast path: all faces are triangles and nothing else is a list, so every record has the same size
+            const size_t triStride = before + list.countSize + 3 * list.size + after;
+            bool allTriangles = scalarsOnly && p + triStride * element.count <= end;
+            if (allTriangles) {
+                int blocks = int(std::min<size_t>(threadCount() * 4, element.count / 4096 + 1));
+                std::vector<char> blockOk(blocks, 1);
+                parallelFor(blocks, [&](int b) {
+                    size_t begin = element.count * b / blocks;
+                    size_t stop = element.count * (b + 1) / blocks;
+                    for (size_t f = begin; f < stop; f++) {
+                        if (readBinary(p + f * triStride + before, list.countSize, false, list.countIsSigned) != 3.0) {
+                            blockOk[b] = 0;
+                            return;
+                        }
+                    }
+                });
+                for (char ok : blockOk)
+                    allTriangles = allTriangles && ok;
+            }
+
+            if (allTriangles) {
+                mesh.triangles.resize(element.count);
+                const char *base = p;
+                int blocks = int(std::min<size_t>(threadCount() * 4, element.count / 4096 + 1));
+                parallelFor(blocks, [&](int b) {
+                    size_t begin = element.count * b / blocks;
+                    size_t stop = element.count * (b + 1) / blocks;
+                    for (size_t f = begin; f < stop; f++) {
+                        const char *record = base + f * triStride + before + list.countSize;
+                        for (int k = 0; k < 3; k++)
+                            mesh.triangles[f][k] = uint32(int64(readBinary(record + k * list.size, list.size, false, list.isSigned)));
+                    }
+                });
+                p += triStride * element.count;
+            } else {
+                /// mixed polygons: a sequential scan is needed to find record boundaries
+                mesh.triangles.clear();
+                mesh.triangles.reserve(element.count * 2);
+                for (size_t f = 0; f < element.count; f++) {
+                    for (int i = 0; i < listIndex; i++)
+                        if (!skipBinary(p, end, element.properties[i]))
+                            return false;
+                    if (p + list.countSize > end)
+                        return false;
+                    int corners = int(readBinary(p, list.countSize, false, list.countIsSigned));
+                    p += list.countSize;
+                    if (corners < 0 || size_t(end - p) < size_t(corners) * list.size)
+                        return false;
+                    uint32 first = uint32(int64(readBinary(p, list.size, false, list.isSigned)));
+                    for (int k = 2; k < corners; k++) {
+                        mesh.triangles.emplace_back(
+                            first,
+                            uint32(int64(readBinary(p + (k - 1) * list.size, list.size, false, list.isSigned))),
+                            uint32(int64(readBinary(p + k * list.size, list.size, false, list.isSigned)))
+                        );
+                    }
+                    p += size_t(corners) * list.size;
+                    for (int i = listIndex + 1; i < int(element.properties.size()); i++)
+                        if (!skipBinary(p, end, element.properties[i]))
+                            return false;
+                }
+            }
+        } else {
+            int stride = element.stride();
+            if (stride >= 0) {
+                p += stride * element.count;
+                continue;
+            }
+            /// variable sized element that is neither vertex nor face, walk its records to find what follows
+            for (size_t r = 0; r < element.count; r++)
+                for (const auto &property : element.properties)
+                    if (!skipBinary(p, end, property))
+                        return false;
+        }
+    }
+    return true;
+}
+
+bool loadPlyAscii(const char *p, const char *end, const std::vector<PlyElement> &elements, MeshData &mesh) {
+    size_t vertexCount = 0, faceCount = 0, vertexLine = 0, faceLine = 0, line = 0;
+    int ix = -1, iy = -1, iz = -1;
+    const PlyElement *face = nullptr;
+    int listIndex = -1;
+    for (const auto &element : elements) {
+        if (element.name == "vertex") {
+            vertexCount = element.count;
+            vertexLine = line;
+            ix = element.find("x");
+            iy = element.find("y");
+            iz = element.find("z");
+        } else if (element.name == "face") {
+            faceCount = element.count;
+            faceLine = line;
+            face = &element;
+            listIndex = element.findFaceIndices();
+        }
+        line += element.count;
+    }
+    const int maxAxis = std::max(ix, std::max(iy, iz));
+    if (ix < 0 || iy < 0 || iz < 0 || maxAxis >= 32 || (face && listIndex < 0))
+        return false;
+
+    /// moves a face line's cursor to its vertex index list
+    auto seekFaceIndices = [&](const char *&q, const char *lineEnd) {
+        for (int i = 0; i < listIndex; i++)
+            skipAscii(q, lineEnd, face->properties[i]);
+    };
+
+    std::vector<Chunk> chunks = splitLines(p, end);
+
+    /// global line numbers of each chunk
+    parallelFor(int(chunks.size()), [&](int c) {
+        chunks[c].lineCount = std::count(chunks[c].begin, chunks[c].end, '\n');
+    });
+    size_t lines = 0;
+    for (auto &chunk : chunks) {
+        chunk.lineOffset = lines;
+        lines += chunk.lineCount;
+    }
+
+    /// triangles produced by face lines of each chunk
+    parallelFor(int(chunks.size()), [&](int c) {
+        Chunk &chunk = chunks[c];
+        const char *q = chunk.begin;
+        for (size_t l = chunk.lineOffset; q < chunk.end; l++) {
+            if (l >= faceLine && l < faceLine + faceCount) {
+                const char *r = q;
+                seekFaceIndices(r, chunk.end);
+                int64_t corners = 0;
+                if (parseInt(r, chunk.end, corners) && corners >= 3)
+                    chunk.triangleCount += corners - 2;
+            }
+            skipLine(q, chunk.end);
+        }
+    });
+    size_t triangles = 0;
+    for (auto &chunk : chunks) {
+        chunk.triangleOffset = triangles;
+        triangles += chunk.triangleCount;
+    }
+
+    mesh.vertices.resize(vertexCount);
+    mesh.triangles.resize(triangles);
+
+    parallelFor(int(chunks.size()), [&](int c) {
+        const Chunk &chunk = chunks[c];
+        Vec3u *triangle = mesh.triangles.data() + chunk.triangleOffset;
+        const char *q = chunk.begin;
+        for (size_t l = chunk.lineOffset; q < chunk.end; l++) {
+            if (l >= vertexLine && l < vertexLine + vertexCount) {
+                float values[32] = {};
+                parseFloats(q, chunk.end, values, maxAxis + 1);
+                mesh.vertices[l - vertexLine] = Vec3f(values[ix], values[iy], values[iz]);
+            } else if (l >= faceLine && l < faceLine + faceCount) {
+                const char *r = q;
+                seekFaceIndices(r, chunk.end);
+                int64_t corners = 0;
+                parseInt(r, chunk.end, corners);
+                int64_t first = 0, previous = 0, current = 0;
+                for (int64_t k = 0; k < corners; k++) {
+                    parseInt(r, chunk.end, current);
+                    if (k == 0)
+                        first = current;
+                    else if (k >= 2)
+                        *triangle++ = Vec3u(uint32(first), uint32(previous), uint32(current));
+                    previous = current;
+                }
+            }
+            skipLine(q, chunk.end);
+        }
+    });
+    return true;
+}
+
+}
+
+bool MeshLoader::loadPly(const char *filename, MeshData &mesh) {
+    MappedFile file(filename);
+    if (!file.valid()) {
+        printf("Error: could not map %s\n", filename);
+        return false;
+    }
+
+    const char *p = file.begin();
+    PlyFormat format = PlyFormat::Ascii;
+    std::vector<PlyElement> elements;
+    if (!parsePlyHeader(p, file.end(), format, elements)) {
+        printf("Error: %s has no valid PLY header\n", filename);
+        return false;
+    }
+
+    bool ok = false;
+    switch (format) {
+    case PlyFormat::Ascii:
+        ok = loadPlyAscii(p, file.end(), elements, mesh);
+        break;
+    case PlyFormat::BinaryLittleEndian:
+        ok = loadPlyBinary(p, file.end(), elements, mesh);
+        break;
+    case PlyFormat::BinaryBigEndian:
+        printf("Error: big endian PLY is not supported (%s)\n", filename);
+        return false;
+    }
+
+    if (!ok) {
+        printf("Error: could not parse %s\n", filename);
+        return false;
+    }
+
+    const size_t vertexCount = mesh.vertices.size();
+    for (const auto &tri : mesh.triangles) {
+        if (tri.x() >= vertexCount || tri.y() >= vertexCount || tri.z() >= vertexCount) {
+            printf("Error: %s references a vertex out of range\n", filename);
+            return false;
+        }
+    }
+    return true;
+}
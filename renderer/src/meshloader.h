@@ -0,0 +1,41 @@
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+
+#include "usings.h"
+
+struct MeshData {
+    std::vector<Vec3f> vertices;
+    std::vector<Vec3u> triangles;
+};
+
+/* Read-only memory mapping of a whole file. */
+class MappedFile {
+public:
+    explicit MappedFile(const char *filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool valid() const { return m_data != nullptr; }
+    const char *begin() const { return m_data; }
+    const char *end() const { return m_data + m_size; }
+    size_t size() const { return m_size; }
+
+private:
+    const char *m_data{nullptr};
+    size_t m_size{0};
+    void *m_file{nullptr};
+    void *m_mapping{nullptr};
+};
+
+/* Streaming OBJ/PLY ingestion. Files are memory-mapped and split into line-aligned chunks that are
+ * counted and then parsed in parallel straight into preallocated vertex and index buffers. */
+class MeshLoader {
+public:
+    static bool load(const char *filename, MeshData &mesh);
+    static bool loadObj(const char *filename, MeshData &mesh);
+    static bool loadPly(const char *filename, MeshData &mesh);
+};
+
+#endif
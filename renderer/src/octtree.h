@@ -6,7 +6,15 @@
 
 #include "usings.h"
 
+#include "counters.h"
+#include "streamio.h"
+#include "timeline.h"
+
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <vector>
 
 namespace EARS {
@@ -15,14 +23,129 @@ class Octtree {
 public:
     static constexpr int HISTOGRAM_RESOLUTION = 4;
     static constexpr int BIN_COUNT = HISTOGRAM_RESOLUTION * HISTOGRAM_RESOLUTION;
+    /// RR/splitting techniques a mixed RRSMethod measures and chooses between, see RRSMethod::candidate()
+    static constexpr int TECHNIQUE_COUNT = 4;
 
     struct Configuration {
         float minimumLeafWeightForSampling = 40000;
         float minimumLeafWeightForTraining = 20000;
         float leafDecay = 0; /// set to 0 for hard reset after an iteration, 1 for no reset at all
         float maxNodeCount = 0;
+        float minimumTechniqueWeight = 32; /// vertices a technique needs in a region before its efficiency counts
+        float minimumIncidentWeightForGuiding = 128; /// BSDF samples a region needs before it guides directions
+        float minimumBinWeightForDirectionalSplit = 10000; /// below the spatial split, so leaves refine directions first
+        float directionalSplitEnergyRatio = 2; /// a bin refines if its share of the region's Lr is this many times its share of the sphere
+        int maxDirectionalDepth = 3;           /// quadtree levels below the HISTOGRAM_RESOLUTION² bins
+        float maxDirectionNodeCount = 0;
+        float maximumMemory = 0; /// bytes setMaximumMemory() bounded the tree to, 0 for no bound
+    };
+
+    /**
+     * What one RR/splitting technique achieved at the vertices it was used at: the moments of each vertex's
+     * contribution to its pixel (relative to the pixel estimate) and the cost of computing it.
+     */
+    struct TechniqueStatistics {
+        float weight{0.f};
+        float sum{0.f};
+        float sumSquares{0.f};
+        float cost{0.f};
+
+        void decay(float decayFactor) {
+            weight *= decayFactor;
+            sum *= decayFactor;
+            sumSquares *= decayFactor;
+            cost *= decayFactor;
+        }
+
+        TechniqueStatistics &operator+=(const TechniqueStatistics &other) {
+            weight += other.weight;
+            sum += other.sum;
+            sumSquares += other.sumSquares;
+            cost += other.cost;
+            return *this;
+        }
+
+        /* Variance times cost per vertex, the inverse of the technique's efficiency. */
+        float inefficiency() const {
+            float mean = sum / weight;
+            float variance = std::max(sumSquares / weight - mean * mean, 0.f);
+            return variance * (cost / weight);
+        }
+    };
+
+    /* The technique statistics of a region, which a mixed RRSMethod splats its vertices into. */
+    struct TechniqueTraining {
+        std::array<TechniqueStatistics, TECHNIQUE_COUNT> techniques;
+
+        void decay(float decayFactor) {
+            for (auto &t : techniques)
+                t.decay(decayFactor);
+        }
+
+        TechniqueTraining &operator+=(const TechniqueTraining &other) {
+            for (int t = 0; t < TECHNIQUE_COUNT; ++t)
+                techniques[t] += other.techniques[t];
+            return *this;
+        }
+
+        void splat(int technique, float contribution, float cost) {
+            auto &t = techniques[technique];
+            t.weight += 1;
+            t.sum += contribution;
+            t.sumSquares += contribution * contribution;
+            t.cost += cost;
+        }
+    };
+
+    /**
+     * Radiance arriving in a region through each of its direction bins, which guiding learns its distributions from.
+     * BSDF samples leaving the region are weighted by the inverse of their pdf.
+     */
+    struct IncidentTraining {
+        std::array<float, BIN_COUNT> radiance{};
+        std::array<float, BIN_COUNT> weight{};
+
+        void decay(float decayFactor) {
+            for (int bin = 0; bin < BIN_COUNT; ++bin) {
+                radiance[bin] *= decayFactor;
+                weight[bin] *= decayFactor;
+            }
+        }
+
+        IncidentTraining &operator+=(const IncidentTraining &other) {
+            for (int bin = 0; bin < BIN_COUNT; ++bin) {
+                radiance[bin] += other.radiance[bin];
+                weight[bin] += other.weight[bin];
+            }
+            return *this;
+        }
+
+        void splat(int bin, float radianceOverPdf) {
+            radiance[bin] += radianceOverPdf;
+            weight[bin] += 1;
+        }
     };
 
+    /**
+     * Index of the technique that was most efficient in a region, -1 if none has been used there often enough.
+     * Ties, e.g. regions that contribute nothing, go to the cheaper technique.
+     */
+    static int bestTechnique(const std::array<TechniqueStatistics, TECHNIQUE_COUNT> &techniques, float minimumWeight) {
+        int best = -1;
+        for (int t = 0; t < TECHNIQUE_COUNT; ++t) {
+            if (techniques[t].weight < std::max(minimumWeight, 1.f))
+                continue;
+            if (best < 0)
+                best = t;
+            float a = techniques[t].inefficiency(), b = techniques[best].inefficiency();
+            if (a < b || (a == b && techniques[t].cost / techniques[t].weight <
+                                    techniques[best].cost / techniques[best].weight))
+                best = t;
+        }
+        return best;
+    }
+
+    /* Statistics splatted into a bin. They accumulate over whole renders, so they stay floats with EARS_COMPACT_CACHE. */
     struct TrainingNode {
         void decay(float decayFactor) {
             m_lrWeight *= decayFactor;
@@ -75,6 +198,18 @@ public:
             m_lrWeight += weight;
         }
 
+        /* Sum of the Lr estimates splatted, to compare how much of a region's radiance goes through which bin. */
+        float getLrEnergy() const {
+            return m_lrFirstMoment.avg();
+        }
+
+        /* A quarter of the Lr statistics, what each quadrant of a newly refined bin starts out with. */
+        TrainingNode quarter() const {
+            TrainingNode result = *this;
+            result.decay(0.25f);
+            return result;
+        }
+
     private:
         float m_lrWeight{0.f};
         Vec3f m_lrFirstMoment{0.f};
@@ -88,42 +223,187 @@ public:
             m_isValid = trainingNode.getWeight() >= config.minimumLeafWeightForSampling;
 
             if (trainingNode.getWeight() > 0) {
-                lrEstimate = trainingNode.getLrEstimate();
+                m_lrEstimate = store(trainingNode.getLrEstimate());
 
                 if (trainingNode.getLrCost() > 0) {
-                    earsFactorR = trainingNode.getLrSecondMoment() / trainingNode.getLrCost();
-                    earsFactorS = trainingNode.getLrVariance() / trainingNode.getLrCost();
+                    m_earsFactorR = store(trainingNode.getLrSecondMoment() / trainingNode.getLrCost());
+                    m_earsFactorS = store(trainingNode.getLrVariance() / trainingNode.getLrCost());
                 } else {
                     /// there can be caches where no work is done
                     /// (e.g., failed strict normals checks meaning no NEE samples or BSDF samples are ever taken)
-                    earsFactorR = Vec3f(0.f);
-                    earsFactorS = Vec3f(0.f);
+                    m_earsFactorR = store(Vec3f(0.f));
+                    m_earsFactorS = store(Vec3f(0.f));
                 }
             }
         }
 
-        Vec3f lrEstimate;
-        Vec3f earsFactorR; // sqrt(2nd-moment / cost)
-        Vec3f earsFactorS; // sqrt(variance / cost)
+        Vec3f lrEstimate() const { return load(m_lrEstimate); }
+        Vec3f earsFactorR() const { return load(m_earsFactorR); } // sqrt(2nd-moment / cost)
+        Vec3f earsFactorS() const { return load(m_earsFactorS); } // sqrt(variance / cost)
+
+        /* Share of the radiance arriving in the region from this bin's directions, 0 unless it learned guiding. */
+        float guidingProbability() const { return loadProbability(m_guidingProbability); }
+
+        /**
+         * Learns the guiding distribution of a region's bins from the radiance that arrived through them. The
+         * stored shares sum to one however they are quantised, so sampling a bin and its pdf agree.
+         */
+        static void learnGuiding(std::array<SamplingNode, BIN_COUNT> &bins,
+                                 const std::array<float, BIN_COUNT> &radiance, float total) {
+#ifdef EARS_COMPACT_CACHE
+            /// quantise the cumulative distribution, each bin stores the step up to its end
+            float cumulative = 0;
+            uint32_t previous = 0;
+            for (int bin = 0; bin < BIN_COUNT; ++bin) {
+                cumulative += radiance[bin] / total;
+                uint32_t end = bin == BIN_COUNT - 1 ? 0xFFFF :
+                               uint32_t(std::clamp(cumulative, 0.f, 1.f) * 0xFFFF + 0.5f);
+                end = std::max(end, previous);
+                bins[bin].m_guidingProbability = uint16_t(end - previous);
+                previous = end;
+            }
+#else
+            for (int bin = 0; bin < BIN_COUNT; ++bin)
+                bins[bin].m_guidingProbability = radiance[bin] / total;
+#endif
+        }
 
     private:
+#ifdef EARS_COMPACT_CACHE
+        /**
+         * RGBE, a mantissa byte per channel and an exponent byte they share. It keeps the float's exponent range,
+         * which second moments over small costs need, at a precision of 2^-8 relative to the largest channel,
+         * plenty for RR and splitting. The values are never negative; infinities and NaNs saturate.
+         */
+        typedef std::array<uint8_t, 4> Stored;
+
+        static Stored store(const Vec3f &v) {
+            float largest = 0.f;
+            for (int i = 0; i < 3; ++i) {
+                if (!(v[i] <= std::numeric_limits<float>::max()))
+                    return {255, 255, 255, 255};
+                largest = std::max(largest, v[i]);
+            }
+            int exponent;
+            std::frexp(largest, &exponent);
+            if (largest == 0.f || exponent + 128 <= 0)
+                return {0, 0, 0, 0};
+            /// the largest channel rounds to [128, 256], one up from an exponent that leaves room for 256
+            if (std::ldexp(largest, 8 - exponent) + 0.5f >= 256.f)
+                exponent++;
+            if (exponent + 128 > 255)
+                return {255, 255, 255, 255};
+            Stored result;
+            for (int i = 0; i < 3; ++i)
+                result[i] = uint8_t(std::ldexp(std::max(v[i], 0.f), 8 - exponent) + 0.5f);
+            result[3] = uint8_t(exponent + 128);
+            return result;
+        }
+
+        static Vec3f load(const Stored &v) {
+            if (v[3] == 0)
+                return Vec3f(0.f);
+            const float scale = std::ldexp(1.f, int(v[3]) - 128 - 8);
+            return Vec3f(float(v[0]), float(v[1]), float(v[2])) * scale;
+        }
+
+        /// in 65535ths
+        typedef uint16_t Probability;
+
+        static float loadProbability(Probability p) { return float(p) * (1.f / 0xFFFF); }
+
+        typedef int8_t TechniqueIndex;
+#else
+        typedef Vec3f Stored;
+
+        static Stored store(const Vec3f &v) { return v; }
+        static Vec3f load(const Stored &v) { return v; }
+
+        typedef float Probability;
+
+        static float loadProbability(Probability p) { return p; }
+
+        typedef int TechniqueIndex;
+#endif
+
+        Stored m_lrEstimate;
+        Stored m_earsFactorR;
+        Stored m_earsFactorS;
         bool m_isValid;
+
+    public:
+        /// after m_isValid so that they pack with it in the compact layout, 16 bytes without padding
+        TechniqueIndex technique{-1}; /// most efficient technique measured in this region for a mixed RRSMethod, -1 if unknown
+
+    private:
+        Probability m_guidingProbability{0};
     };
 
     Configuration configuration;
 
+    /**
+     * Bounds the spatial tree to bytes, and allows the directional quadtrees another quarter of that. Nodes count
+     * with the statistics collected for them, see collectTechniques() and collectIncident().
+     */
     void setMaximumMemory(long bytes) {
-        configuration.maxNodeCount = bytes / sizeof(Node);
+        configuration.maximumMemory = float(bytes);
+        configuration.maxNodeCount = bytes / nodeBytes();
+        configuration.maxDirectionNodeCount = bytes / 4 / sizeof(DirectionNode);
+    }
+
+    /**
+     * Allocates the technique statistics of every region, which only a mixed RRSMethod learns from, or frees them.
+     * Regions keep the technique they learned last either way.
+     */
+    void collectTechniques(bool collect) {
+        m_techniques.resize(collect ? m_nodes.size() : 0);
+        m_techniques.shrink_to_fit();
+        if (configuration.maximumMemory > 0)
+            setMaximumMemory(long(configuration.maximumMemory));
+    }
+
+    bool collectsTechniques() const {
+        return !m_techniques.empty();
+    }
+
+    /* Allocates the incident radiance of every region, which only guiding learns from, or frees it. */
+    void collectIncident(bool collect) {
+        m_incident.resize(collect ? m_nodes.size() : 0);
+        m_incident.shrink_to_fit();
+        if (configuration.maximumMemory > 0)
+            setMaximumMemory(long(configuration.maximumMemory));
+    }
+
+    bool collectsIncident() const {
+        return !m_incident.empty();
     }
 
 private:
     typedef uint32_t NodeIndex;
 
+    /**
+     * Four quadrants of a direction bin in the canonical (cosTheta, phi) domain, refined further where the radiance
+     * is concentrated. Quadrant q covers the half q & 1 in cosTheta and q >> 1 in phi.
+     */
+    struct DirectionNode {
+        struct Quadrant {
+            NodeIndex index{0}; /// into m_directions, 0 if the quadrant is not refined
+            TrainingNode training;
+            SamplingNode sampling;
+        };
+
+        std::array<Quadrant, 4> quadrants;
+    };
+
     struct Node {
         struct Child {
             NodeIndex index{0};
             std::array<TrainingNode, BIN_COUNT> training;
             std::array<SamplingNode, BIN_COUNT> sampling;
+            std::array<NodeIndex, BIN_COUNT> directions{}; /// quadtrees refining the bins of leaves, 0 if not refined
+            bool hasGuiding{false}; /// whether the sampling nodes hold a guiding distribution
+            bool dirty{false}; /// looked up for training since the last build, set on every child along the way
+            uint32_t builtAt{0}; /// m_builds when last relearned, so copies of the tree find what changed since theirs
 
             bool isLeaf() const { return index == 0; }
             float maxTrainingWeight() const {
@@ -138,6 +418,34 @@ private:
     };
 
     std::vector<Node> m_nodes;
+    std::vector<std::array<TechniqueTraining, 8>> m_techniques; /// of the children of m_nodes, empty unless collected
+    std::vector<std::array<IncidentTraining, 8>> m_incident;    /// likewise
+    std::vector<DirectionNode> m_directions{1}; /// the first one is never used, index 0 stands for no refinement
+    std::vector<NodeIndex> m_freeDirections; /// direction nodes of leaves that have since been split, to be reused
+    long m_rebuiltChildren{0};               /// children relearned by the last build, for its summary
+    float m_builtWeight{0};                  /// samples in the tree after the last build, for its summary
+    uint32_t m_builds{0};                    /// builds so far, or those of the tree this one was last synced with
+
+    /* Only written once per build, so threads looking up the same regions don't keep invalidating each other's caches. */
+    static void markDirty(Node::Child &child) {
+        if (!child.dirty)
+            child.dirty = true;
+    }
+
+    /* What a node takes up, including the statistics collected for its children. */
+    long nodeBytes() const {
+        return long(sizeof(Node) + (m_techniques.empty() ? 0 : sizeof(m_techniques[0])) +
+                    (m_incident.empty() ? 0 : sizeof(m_incident[0])));
+    }
+
+    NodeIndex addNode() {
+        m_nodes.emplace_back();
+        if (!m_techniques.empty())
+            m_techniques.emplace_back();
+        if (!m_incident.empty())
+            m_incident.emplace_back();
+        return NodeIndex(m_nodes.size() - 1);
+    }
 
     int stratumIndex(Vec3f &pos) {
         int index = 0;
@@ -158,8 +466,7 @@ private:
             /// we have already reached the maximum node number
             return 0;
 
-        NodeIndex newNodeIndex = NodeIndex(m_nodes.size());
-        m_nodes.emplace_back();
+        NodeIndex newNodeIndex = addNode();
 
         for (int stratum = 0; stratum < 8; ++stratum) {
             /// split recursively if needed
@@ -170,32 +477,204 @@ private:
         return newNodeIndex;
     }
 
-    std::array<TrainingNode, BIN_COUNT> build(NodeIndex index, bool needsSplitting) {
+    /* Sums the quadrants of a refined bin bottom-up, so that every refined quadrant holds the total of its own. */
+    TrainingNode sumDirections(NodeIndex index) {
+        TrainingNode sum;
+        for (int q = 0; q < 4; ++q) {
+            NodeIndex sub = m_directions[index].quadrants[q].index;
+            if (sub)
+                m_directions[index].quadrants[q].training = sumDirections(sub);
+            sum += m_directions[index].quadrants[q].training;
+        }
+        return sum;
+    }
+
+    /**
+     * Refines a bin (or quadrant) with enough samples whose share of the region's Lr exceeds its share of the
+     * sphere, area, by directionalSplitEnergyRatio. Returns the new direction node, 0 if it stays as it is.
+     * training is taken by value, it may be a quadrant in m_directions, which this can reallocate.
+     */
+    NodeIndex refineDirectionIfNecessary(TrainingNode training, float regionEnergy, float area, int depth) {
+        if (depth >= configuration.maxDirectionalDepth ||
+            training.getWeight() < configuration.minimumBinWeightForDirectionalSplit || !(regionEnergy > 0))
+            return 0;
+        if (training.getLrEnergy() / regionEnergy < configuration.directionalSplitEnergyRatio * area)
+            /// radiance is not directional here
+            return 0;
+        if (configuration.maxDirectionNodeCount && directionNodeCount() > configuration.maxDirectionNodeCount)
+            return 0;
+
+        NodeIndex newIndex;
+        if (!m_freeDirections.empty()) {
+            newIndex = m_freeDirections.back();
+            m_freeDirections.pop_back();
+            m_directions[newIndex] = DirectionNode();
+        } else {
+            newIndex = NodeIndex(m_directions.size());
+            m_directions.emplace_back();
+        }
+        for (auto &quadrant : m_directions[newIndex].quadrants) {
+            quadrant.training = training.quarter();
+            quadrant.sampling.learnFrom(quadrant.training, configuration);
+            quadrant.training.decay(configuration.leafDecay);
+        }
+        return newIndex;
+    }
+
+    /* learnFrom() for the quadrants of a refined bin, refining them further where necessary. */
+    void learnDirections(NodeIndex index, float regionEnergy, float area, int depth, int technique,
+                         bool needsSplitting) {
+        for (int q = 0; q < 4; ++q) {
+            /// m_directions may grow below, so the quadrant is looked up again every time
+            auto *quadrant = &m_directions[index].quadrants[q];
+            quadrant->sampling.learnFrom(quadrant->training, configuration);
+            if (technique >= 0)
+                quadrant->sampling.technique = technique;
+
+            if (quadrant->index) {
+                learnDirections(quadrant->index, regionEnergy, area / 4, depth + 1, technique, needsSplitting);
+                quadrant = &m_directions[index].quadrants[q];
+            } else if (needsSplitting) {
+                NodeIndex newIndex = refineDirectionIfNecessary(quadrant->training, regionEnergy, area / 4, depth + 1);
+                quadrant = &m_directions[index].quadrants[q];
+                quadrant->index = newIndex;
+            }
+            quadrant->training.decay(configuration.leafDecay);
+        }
+    }
+
+    /* Returns a quadtree to m_freeDirections once its leaf is split, lookups never reach it again. */
+    void freeDirections(NodeIndex index) {
+        for (const auto &quadrant : m_directions[index].quadrants)
+            if (quadrant.index)
+                freeDirections(quadrant.index);
+        m_freeDirections.push_back(index);
+    }
+
+    long directionNodeCount() const {
+        return long(m_directions.size() - 1 - m_freeDirections.size());
+    }
+
+    /**
+     * Relearns the children that were looked up since the last build and returns the training data of the node,
+     * the sum over its children, adding their technique statistics and incident radiance to techniquesSum and
+     * incidentSum. Children nobody looked up keep what they learned and only add to the sums.
+     */
+    std::array<TrainingNode, BIN_COUNT> build(NodeIndex index, bool needsSplitting, TechniqueTraining &techniquesSum,
+                                              IncidentTraining &incidentSum) {
         std::array<TrainingNode, BIN_COUNT> sum;
 
         for (int stratum = 0; stratum < 8; ++stratum) {
+            if (!m_nodes[index].children[stratum].dirty) {
+                for (int bin = 0; bin < BIN_COUNT; ++bin)
+                    sum[bin] += m_nodes[index].children[stratum].training[bin];
+                if (collectsTechniques())
+                    techniquesSum += m_techniques[index][stratum];
+                if (collectsIncident())
+                    incidentSum += m_incident[index][stratum];
+                continue;
+            }
+            m_nodes[index].children[stratum].dirty = false;
+            m_nodes[index].children[stratum].builtAt = m_builds;
+            m_rebuiltChildren++;
+
             if (m_nodes[index].children[stratum].isLeaf()) {
+                /// refined bins hold the sum of their quadrants, like inner nodes hold the sum of their children
+                for (int bin = 0; bin < BIN_COUNT; ++bin) {
+                    NodeIndex direction = m_nodes[index].children[stratum].directions[bin];
+                    if (direction)
+                        m_nodes[index].children[stratum].training[bin] = sumDirections(direction);
+                }
+
                 if (needsSplitting) {
                     NodeIndex newChildIndex = splitNodeIfNecessary(
                         m_nodes[index].children[stratum].maxTrainingWeight()
                     );
                     m_nodes[index].children[stratum].index = newChildIndex;
+                    if (newChildIndex) {
+                        /// the next build sums up the new children instead, like it would if it rebuilt everything
+                        m_nodes[index].children[stratum].dirty = true;
+                        for (auto &direction : m_nodes[index].children[stratum].directions) {
+                            if (direction)
+                                freeDirections(direction);
+                            direction = 0;
+                        }
+                    }
                 }
             } else {
                 /// build recursively
+                TechniqueTraining techniques;
+                IncidentTraining incident;
                 auto buildResult = build(
                     m_nodes[index].children[stratum].index,
-                    needsSplitting
+                    needsSplitting,
+                    techniques,
+                    incident
                 );
                 m_nodes[index].children[stratum].training = buildResult;
+                if (collectsTechniques())
+                    m_techniques[index][stratum] = techniques;
+                if (collectsIncident())
+                    m_incident[index][stratum] = incident;
+
+                /// stays dirty while children split by this build are
+                bool dirty = false;
+                for (const auto &grandchild : m_nodes[m_nodes[index].children[stratum].index].children)
+                    dirty = dirty || grandchild.dirty;
+                m_nodes[index].children[stratum].dirty = dirty;
             }
 
             auto &child = m_nodes[index].children[stratum];
+
+            /// techniques are chosen per region, whatever direction the vertices were reached from
+            int technique = -1;
+            if (collectsTechniques()) {
+                auto &techniques = m_techniques[index][stratum];
+                technique = bestTechnique(techniques.techniques, configuration.minimumTechniqueWeight);
+                techniquesSum += techniques;
+                techniques.decay(configuration.leafDecay);
+            }
+
+            /// the guiding distribution is only replaced once there is enough new data for it
+            float incident = 0, incidentWeight = 0;
+            if (collectsIncident()) {
+                for (int bin = 0; bin < BIN_COUNT; ++bin) {
+                    incident += m_incident[index][stratum].radiance[bin];
+                    incidentWeight += m_incident[index][stratum].weight[bin];
+                }
+            }
+            bool learnGuiding = incident > 0 && std::isfinite(incident) &&
+                                incidentWeight >= configuration.minimumIncidentWeightForGuiding;
+            if (learnGuiding)
+                child.hasGuiding = true;
+
+            float regionEnergy = 0;
+            for (int bin = 0; bin < BIN_COUNT; ++bin)
+                regionEnergy += child.training[bin].getLrEnergy();
+
+            if (learnGuiding)
+                SamplingNode::learnGuiding(child.sampling, m_incident[index][stratum].radiance, incident);
+
             for (int bin = 0; bin < BIN_COUNT; ++bin) {
                 sum[bin] += child.training[bin];
                 child.sampling[bin].learnFrom(child.training[bin], configuration);
+                if (technique >= 0)
+                    child.sampling[bin].technique = technique;
+
+                if (child.isLeaf()) {
+                    /// m_nodes doesn't grow from here on, but m_directions may
+                    const float area = 1.f / BIN_COUNT;
+                    if (child.directions[bin])
+                        learnDirections(child.directions[bin], regionEnergy, area, 0, technique, needsSplitting);
+                    else if (needsSplitting)
+                        child.directions[bin] = refineDirectionIfNecessary(child.training[bin], regionEnergy, area, 0);
+                }
                 child.training[bin].decay(configuration.leafDecay);
             }
+            if (collectsIncident()) {
+                incidentSum += m_incident[index][stratum];
+                m_incident[index][stratum].decay(configuration.leafDecay);
+            }
         }
 
         return sum;
@@ -217,26 +696,211 @@ public:
     /**
      * Accumulates all the data from training into the sampling nodes, refines the tree and resets the training nodes.
      */
-    void build(bool needsSplitting) {
-        auto sum = build(0, needsSplitting);
-        m_nodes.shrink_to_fit();
+    void build(bool needsSplitting, bool verbose = true) {
+        TimelineScope scope("Octtree build");
+        if (configuration.leafDecay != 1)
+            /// decaying changes what every node learns, whether it was looked up or not
+            markAllDirty();
+        m_builds++;
+        m_rebuiltChildren = 0;
+        TechniqueTraining techniques;
+        IncidentTraining incident;
+        auto sum = build(NodeIndex(0), needsSplitting, techniques, incident);
 
-        float weightSum = 0;
+        m_builtWeight = 0;
         for (int bin = 0; bin < BIN_COUNT; ++bin)
-            weightSum += sum[bin].getWeight();
+            m_builtWeight += sum[bin].getWeight();
+        if (verbose)
+            printBuildSummary();
+    }
 
-        printf("Octtree built [%ld samples, %ld nodes, %.1f MiB]",
-               long(weightSum),
+    /* What the last build() did, printed by it unless it was asked to stay quiet. */
+    void printBuildSummary() const {
+        printf("Octtree built [%ld samples, %ld nodes, %ld regions relearned, %ld direction nodes, %.1f MiB]",
+               long(m_builtWeight),
                m_nodes.size(),
-               m_nodes.capacity() * sizeof(Node) / (1024.f * 1024.f)
+               m_rebuiltChildren,
+               directionNodeCount(),
+               (m_nodes.capacity() * sizeof(Node) + m_techniques.capacity() * sizeof(m_techniques[0]) +
+                m_incident.capacity() * sizeof(m_incident[0]) + m_directions.capacity() * sizeof(DirectionNode)) /
+                   (1024.f * 1024.f)
         );
     }
 
-    void lookup(Vec3f pos, int bin, const SamplingNode *&sampling, TrainingNode *&training) {
+    /* Writes the tree, including its training data, so a render can pick up where it left off. */
+    void saveState(std::ostream &out) const {
+        streamWrite(out, uint32_t(sizeof(Node)));
+        streamWrite(out, configuration);
+        streamWrite(out, m_nodes);
+        streamWrite(out, m_techniques);
+        streamWrite(out, m_incident);
+        streamWrite(out, m_directions);
+        streamWrite(out, m_freeDirections);
+        streamWrite(out, m_builds);
+    }
+
+    void loadState(std::istream &in) {
+        uint32_t nodeSize = 0;
+        streamRead(in, nodeSize);
+        if (in && nodeSize != sizeof(Node)) {
+            /// written by a build with or without EARS_COMPACT_CACHE that this one doesn't match
+            printf("Error: the cache was saved with a different node layout\n");
+            in.setstate(std::ios::failbit);
+        }
+        if (!in)
+            return;
+        streamRead(in, configuration);
+        streamRead(in, m_nodes);
+        streamRead(in, m_techniques);
+        streamRead(in, m_incident);
+        streamRead(in, m_directions);
+        streamRead(in, m_freeDirections);
+        streamRead(in, m_builds);
+        if (m_directions.empty())
+            m_directions.resize(1);
+    }
+
+    /* Makes the next build relearn the whole tree. */
+    void markAllDirty() {
+        for (auto &node : m_nodes)
+            for (auto &child : node.children)
+                child.dirty = true;
+    }
+
+    /**
+     * Drops all training data while keeping the tree and what it has learned, so that a copy of the tree
+     * only collects the samples splatted into it from now on.
+     */
+    void clearTraining() {
+        for (auto &node : m_nodes)
+            for (auto &child : node.children) {
+                child.training.fill(TrainingNode());
+                child.dirty = false;
+            }
+        m_techniques.assign(m_techniques.size(), {});
+        m_incident.assign(m_incident.size(), {});
+        for (auto &direction : m_directions)
+            for (auto &quadrant : direction.quadrants)
+                quadrant.training = TrainingNode();
+    }
+
+    /* Writes only the training data, to be merged into a tree of the same shape with mergeTraining(). */
+    void saveTraining(std::ostream &out) const {
+        streamWrite(out, uint64(m_nodes.size()));
+        for (const auto &node : m_nodes)
+            for (const auto &child : node.children) {
+                streamWrite(out, child.training);
+                streamWrite(out, child.dirty);
+            }
+        streamWrite(out, m_techniques);
+        streamWrite(out, m_incident);
+        streamWrite(out, uint64(m_directions.size()));
+        for (const auto &direction : m_directions)
+            for (const auto &quadrant : direction.quadrants)
+                streamWrite(out, quadrant.training);
+    }
+
+    /**
+     * Adds training data written by saveTraining() to this tree's.
+     * Fails without changing anything if the data was collected on a tree of a different shape.
+     */
+    bool mergeTraining(std::istream &in) {
+        uint64 nodeCount = 0;
+        streamRead(in, nodeCount);
+        if (!in || nodeCount != m_nodes.size())
+            return false;
+
+        std::vector<std::array<TrainingNode, BIN_COUNT>> training(nodeCount * 8);
+        std::vector<char> dirty(nodeCount * 8);
+        for (size_t i = 0; i < training.size(); i++) {
+            bool d = false;
+            streamRead(in, training[i]);
+            streamRead(in, d);
+            dirty[i] = d;
+        }
+        std::vector<std::array<TechniqueTraining, 8>> techniques;
+        streamRead(in, techniques);
+        std::vector<std::array<IncidentTraining, 8>> incident;
+        streamRead(in, incident);
+        if (!in || techniques.size() != m_techniques.size() || incident.size() != m_incident.size())
+            return false;
+        uint64 directionCount = 0;
+        streamRead(in, directionCount);
+        if (!in || directionCount != m_directions.size())
+            return false;
+        std::vector<TrainingNode> quadrants(directionCount * 4);
+        for (auto &t : quadrants)
+            streamRead(in, t);
+        if (!in)
+            return false;
+
+        for (size_t i = 0; i < training.size(); i++) {
+            auto &child = m_nodes[i / 8].children[i % 8];
+            for (int bin = 0; bin < BIN_COUNT; ++bin)
+                child.training[bin] += training[i][bin];
+            /// the worker marked the paths it looked up, which are the ones its training data went into
+            child.dirty = child.dirty || dirty[i];
+        }
+        for (size_t i = 0; i < techniques.size(); i++)
+            for (int stratum = 0; stratum < 8; ++stratum)
+                m_techniques[i][stratum] += techniques[i][stratum];
+        for (size_t i = 0; i < incident.size(); i++)
+            for (int stratum = 0; stratum < 8; ++stratum)
+                m_incident[i][stratum] += incident[i][stratum];
+        for (size_t i = 0; i < quadrants.size(); i++)
+            m_directions[i / 4].quadrants[i % 4].training += quadrants[i];
+        return true;
+    }
+
+    /**
+     * Adds the training data splatted into older, an earlier version of this tree, to this tree's. Regions older
+     * doesn't refine as far as this tree spread their data evenly over this tree's finer ones. Only the regions older
+     * looked up are visited.
+     */
+    void mergeTrainingFrom(const Octtree &older) {
+        mergeRegion(older, 0, 0);
+    }
+
+    /**
+     * Brings this copy of built, whose training data has been merged into built, up to date with what built learned
+     * since, and clears the training data. Only the regions built relearned since this copy was last synced are visited.
+     */
+    void syncFrom(const Octtree &built) {
+        clearDirtyTraining(0);
+
+        configuration = built.configuration;
+        size_t nodeCount = m_nodes.size();
+        m_nodes.resize(built.m_nodes.size());
+        if (collectsTechniques())
+            m_techniques.resize(m_nodes.size());
+        if (collectsIncident())
+            m_incident.resize(m_nodes.size());
+        for (size_t i = nodeCount; i < m_nodes.size(); i++) {
+            m_nodes[i] = built.m_nodes[i];
+            for (auto &child : m_nodes[i].children) {
+                child.training.fill(TrainingNode());
+                child.dirty = false;
+            }
+        }
+        m_directions.resize(built.m_directions.size());
+        m_freeDirections = built.m_freeDirections;
+
+        syncRegion(built, 0);
+        m_builds = built.m_builds;
+    }
+
+    /**
+     * Finds the cache entry for a position in the unit cube and a direction in the canonical (cosTheta, phi) domain:
+     * training is the leaf to splat into, sampling the deepest node along the way that has enough data.
+     */
+    void lookup(Vec3f pos, Vec2f dir, const SamplingNode *&sampling, TrainingNode *&training) {
+        threadCounters().octreeLookups++;
+        int bin = directionBin(dir);
         NodeIndex currentNodeIndex = 0;
         while (true) {
             int stratum = stratumIndex(pos);
             auto &child = m_nodes[currentNodeIndex].children[stratum];
+            markDirty(child);
             if (currentNodeIndex == 0 || child.sampling[bin].isValid())
                 /// a valid node for sampling
                 sampling = &child.sampling[bin];
@@ -244,12 +908,227 @@ public:
             if (child.isLeaf()) {
                 /// reached a leaf node
                 training = &child.training[bin];
+                lookupDirection(child.directions[bin], dir, sampling, training);
                 break;
             }
 
             currentNodeIndex = child.index;
         }
     }
+
+    /**
+     * Like lookup(), additionally finding the leaf's technique statistics and incident radiance, nullptr unless they
+     * are collected, and the direction bins (BIN_COUNT sampling nodes) of the deepest region that has a guiding
+     * distribution, nullptr if none has one yet.
+     */
+    void lookup(Vec3f pos, Vec2f dir, const SamplingNode *&sampling, TrainingNode *&training,
+                TechniqueTraining *&techniques, const SamplingNode *&guiding, IncidentTraining *&incident) {
+        threadCounters().octreeLookups++;
+        int bin = directionBin(dir);
+        guiding = nullptr;
+        NodeIndex currentNodeIndex = 0;
+        while (true) {
+            int stratum = stratumIndex(pos);
+            auto &child = m_nodes[currentNodeIndex].children[stratum];
+            markDirty(child);
+            if (currentNodeIndex == 0 || child.sampling[bin].isValid())
+                sampling = &child.sampling[bin];
+            if (child.hasGuiding)
+                guiding = child.sampling.data();
+
+            if (child.isLeaf()) {
+                training = &child.training[bin];
+                techniques = collectsTechniques() ? &m_techniques[currentNodeIndex][stratum] : nullptr;
+                incident = collectsIncident() ? &m_incident[currentNodeIndex][stratum] : nullptr;
+                lookupDirection(child.directions[bin], dir, sampling, training);
+                break;
+            }
+
+            currentNodeIndex = child.index;
+        }
+    }
+
+private:
+    static int directionBin(Vec2f &dir) {
+        const int res = HISTOGRAM_RESOLUTION;
+        const int x = std::min(int(dir.x() * res), res - 1);
+        const int y = std::min(int(dir.y() * res), res - 1);
+        dir = Vec2f(dir.x() * res - x, dir.y() * res - y);
+        return x + y * res;
+    }
+
+    void mergeRegion(const Octtree &older, NodeIndex olderIndex, NodeIndex index) {
+        for (int stratum = 0; stratum < 8; ++stratum) {
+            const auto &from = older.m_nodes[olderIndex].children[stratum];
+            if (!from.dirty)
+                continue;
+            markDirty(m_nodes[index].children[stratum]);
+            if (!from.isLeaf()) {
+                /// splitting never merges regions, so an inner node in older is the same inner node here
+                mergeRegion(older, from.index, m_nodes[index].children[stratum].index);
+                continue;
+            }
+
+            if (collectsTechniques() && older.collectsTechniques())
+                splatStatistics(m_techniques, index, stratum, older.m_techniques[olderIndex][stratum]);
+            if (collectsIncident() && older.collectsIncident())
+                splatStatistics(m_incident, index, stratum, older.m_incident[olderIndex][stratum]);
+            for (int bin = 0; bin < BIN_COUNT; ++bin) {
+                if (!from.directions[bin])
+                    splatRegion(index, stratum, bin, 0, 0, 0, from.training[bin]);
+                else
+                    /// the Lr of a refined bin was splatted into its quadrants
+                    mergeDirections(older, from.directions[bin], 1, 0, 0, index, stratum, bin);
+            }
+        }
+    }
+
+    void mergeDirections(const Octtree &older, NodeIndex olderIndex, int depth, int x, int y,
+                         NodeIndex index, int stratum, int bin) {
+        for (int q = 0; q < 4; ++q) {
+            const auto &quadrant = older.m_directions[olderIndex].quadrants[q];
+            int qx = 2 * x + (q & 1), qy = 2 * y + (q >> 1);
+            if (quadrant.index)
+                mergeDirections(older, quadrant.index, depth + 1, qx, qy, index, stratum, bin);
+            else
+                splatRegion(index, stratum, bin, depth, qx, qy, quadrant.training);
+        }
+    }
+
+    /**
+     * Adds training to the bin of a child, or to the cell (x, y) of the bin's 2^depth x 2^depth quadrants. Children
+     * and quadrants split further than that get an even share each.
+     */
+    void splatRegion(NodeIndex index, int stratum, int bin, int depth, int x, int y, const TrainingNode &training) {
+        auto &child = m_nodes[index].children[stratum];
+        markDirty(child);
+        if (!child.isLeaf()) {
+            TrainingNode share = training;
+            share.decay(1.f / 8);
+            for (int s = 0; s < 8; ++s)
+                splatRegion(child.index, s, bin, depth, x, y, share);
+            return;
+        }
+
+        if (child.directions[bin])
+            splatDirection(child.directions[bin], depth, x, y, training);
+        else
+            child.training[bin] += training;
+    }
+
+    /* Adds statistics to a child's entry in table, children split further get an even share each. */
+    template<typename Statistics>
+    void splatStatistics(std::vector<std::array<Statistics, 8>> &table, NodeIndex index, int stratum,
+                         const Statistics &statistics) {
+        auto &child = m_nodes[index].children[stratum];
+        markDirty(child);
+        if (child.isLeaf()) {
+            table[index][stratum] += statistics;
+            return;
+        }
+        Statistics share = statistics;
+        share.decay(1.f / 8);
+        for (int s = 0; s < 8; ++s)
+            splatStatistics(table, child.index, s, share);
+    }
+
+    void splatDirection(NodeIndex index, int depth, int x, int y, const TrainingNode &training) {
+        if (depth == 0) {
+            TrainingNode share = training.quarter();
+            for (int q = 0; q < 4; ++q) {
+                auto &quadrant = m_directions[index].quadrants[q];
+                if (quadrant.index)
+                    splatDirection(quadrant.index, 0, 0, 0, share);
+                else
+                    quadrant.training += share;
+            }
+            return;
+        }
+
+        int shift = depth - 1;
+        auto &quadrant = m_directions[index].quadrants[((x >> shift) & 1) | (((y >> shift) & 1) << 1)];
+        if (quadrant.index)
+            splatDirection(quadrant.index, depth - 1, x & ((1 << shift) - 1), y & ((1 << shift) - 1), training);
+        else
+            quadrant.training += training;
+    }
+
+    /* Zeroes the training data along the paths looked up since the last sync. */
+    void clearDirtyTraining(NodeIndex index) {
+        for (int stratum = 0; stratum < 8; ++stratum) {
+            auto &child = m_nodes[index].children[stratum];
+            if (!child.dirty)
+                continue;
+            child.dirty = false;
+            child.training.fill(TrainingNode());
+            if (collectsTechniques())
+                m_techniques[index][stratum] = TechniqueTraining();
+            if (collectsIncident())
+                m_incident[index][stratum] = IncidentTraining();
+            if (!child.isLeaf()) {
+                clearDirtyTraining(child.index);
+                continue;
+            }
+            for (NodeIndex direction : child.directions)
+                if (direction)
+                    clearDirectionTraining(direction);
+        }
+    }
+
+    void clearDirectionTraining(NodeIndex index) {
+        for (auto &quadrant : m_directions[index].quadrants) {
+            quadrant.training = TrainingNode();
+            if (quadrant.index)
+                clearDirectionTraining(quadrant.index);
+        }
+    }
+
+    /* Copies what built relearned since this copy's last sync, leaving out the training data. */
+    void syncRegion(const Octtree &built, NodeIndex index) {
+        for (int stratum = 0; stratum < 8; ++stratum) {
+            const auto &from = built.m_nodes[index].children[stratum];
+            if (from.builtAt <= m_builds)
+                continue;
+
+            auto &child = m_nodes[index].children[stratum];
+            child = from;
+            child.training.fill(TrainingNode());
+            child.dirty = false;
+            if (collectsTechniques())
+                m_techniques[index][stratum] = TechniqueTraining();
+            if (collectsIncident())
+                m_incident[index][stratum] = IncidentTraining();
+            if (!child.isLeaf()) {
+                syncRegion(built, child.index);
+                continue;
+            }
+            for (NodeIndex direction : child.directions)
+                if (direction)
+                    syncDirections(built, direction);
+        }
+    }
+
+    void syncDirections(const Octtree &built, NodeIndex index) {
+        m_directions[index] = built.m_directions[index];
+        for (auto &quadrant : m_directions[index].quadrants) {
+            quadrant.training = TrainingNode();
+            if (quadrant.index)
+                syncDirections(built, quadrant.index);
+        }
+    }
+
+    /* Descends the quadtree of a bin, dir being relative to the bin. */
+    void lookupDirection(NodeIndex index, Vec2f dir, const SamplingNode *&sampling, TrainingNode *&training) {
+        while (index) {
+            int bitX = dir.x() >= 0.5f, bitY = dir.y() >= 0.5f;
+            dir = Vec2f(dir.x() * 2 - bitX, dir.y() * 2 - bitY);
+            auto &quadrant = m_directions[index].quadrants[bitX | (bitY << 1)];
+            if (quadrant.sampling.isValid())
+                sampling = &quadrant.sampling;
+            training = &quadrant.training;
+            index = quadrant.index;
+        }
+    }
 };
 
 };
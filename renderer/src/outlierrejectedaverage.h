@@ -6,6 +6,8 @@
 
 #include "usings.h"
 
+#include "streamio.h"
+
 #include <vector>
 #include <iostream>
 
@@ -190,6 +192,28 @@ public:
         return m_weight;
     }
 
+    void saveState(std::ostream &out) const {
+        streamWrite(out, m_weight);
+        streamWrite(out, m_index);
+        streamWrite(out, m_length);
+        streamWrite(out, m_accumulation);
+        streamWrite(out, m_knownMinimum);
+        streamWrite(out, m_history);
+        streamWrite(out, m_outlierAccumulation);
+        streamWrite(out, m_outlierWeight);
+    }
+
+    void loadState(std::istream &in) {
+        streamRead(in, m_weight);
+        streamRead(in, m_index);
+        streamRead(in, m_length);
+        streamRead(in, m_accumulation);
+        streamRead(in, m_knownMinimum);
+        streamRead(in, m_history);
+        streamRead(in, m_outlierAccumulation);
+        streamRead(in, m_outlierWeight);
+    }
+
 private:
     long m_weight;
     int m_index;
@@ -0,0 +1,144 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline int threadCount() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? int(n) : 1;
+}
+
+/* Process-wide pool of worker threads fed from a single task queue. */
+class ThreadPool {
+public:
+    static ThreadPool &instance() {
+        static ThreadPool pool(threadCount());
+        return pool;
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+        for (auto &t : m_workers)
+            t.join();
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+        m_wakeup.notify_one();
+    }
+
+    /**
+     * Runs one queued task on the calling thread, if there is any.
+     * Lets threads that wait on a TaskGroup help out instead of blocking a worker.
+     */
+    bool tryRunOne() {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_tasks.empty())
+                return false;
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+        return true;
+    }
+
+    int size() const { return int(m_workers.size()); }
+
+private:
+    explicit ThreadPool(int workers) {
+        for (int i = 0; i < workers; i++) {
+            m_workers.emplace_back([this]() {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        m_wakeup.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+                        if (m_stop && m_tasks.empty())
+                            return;
+                        task = std::move(m_tasks.front());
+                        m_tasks.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::deque<std::function<void()>> m_tasks;
+    std::vector<std::thread> m_workers;
+    bool m_stop{false};
+};
+
+/* A set of tasks that can be waited on together. Tasks may spawn further tasks into the same group. */
+class TaskGroup {
+public:
+    TaskGroup() = default;
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    ~TaskGroup() {
+        wait();
+    }
+
+    void run(std::function<void()> task) {
+        m_pending.fetch_add(1);
+        ThreadPool::instance().submit([this, task = std::move(task)]() {
+            task();
+            m_pending.fetch_sub(1);
+        });
+    }
+
+    void wait() {
+        while (m_pending.load() > 0) {
+            if (!ThreadPool::instance().tryRunOne())
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    std::atomic<int> m_pending{0};
+};
+
+/* Runs body(i) for every i in [0, count), distributing contiguous ranges over the thread pool. */
+inline void parallelFor(int count, const std::function<void(int)> &body) {
+    int workers = std::min(threadCount(), count);
+    if (workers <= 1) {
+        for (int i = 0; i < count; i++)
+            body(i);
+        return;
+    }
+
+    TaskGroup group;
+    for (int w = 0; w < workers; w++) {
+        int begin = int(long(count) * w / workers);
+        int end = int(long(count) * (w + 1) / workers);
+        group.run([&body, begin, end]() {
+            for (int i = begin; i < end; i++)
+                body(i);
+        });
+    }
+    group.wait();
+}
+
+#endif
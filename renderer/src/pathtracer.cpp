@@ -81,6 +81,7 @@ Vec3f PathTracer::bsdfSample(const Primitive& light, SurfaceScatterEvent& event,
 
     Ray ray = parentRay.scatter(event.data->p, wo, event.data->epsilon);
     ray.setPrimary(false);
+    threadCounters().bsdfRays++;
 
     Intersection intersection;
     IntersectionData data;
@@ -112,6 +113,7 @@ Vec3f PathTracer::lightSample(const Primitive& light, SurfaceScatterEvent& event
 
     Ray ray = parentRay.scatter(event.data->p, sample.d, event.data->epsilon);
     ray.setPrimary(false);
+    threadCounters().shadowRays++;
 
     Intersection intersection;
     IntersectionData data;
@@ -193,6 +195,8 @@ Vec3f PathTracer::trace(const Vec2i& px, PathSampleGenerator &sampler) {
     bool wasSpecular = true;
     int bounce = 0;
 
+    RenderCounters &counters = threadCounters();
+    counters.cameraRays++;
     bool hit = scene->intersect(ray, intersection, data);
     while (hit && bounce < maxBounces) {
         surfaceEvent = makeLocalScatterEvent(intersection, data, ray, &sampler);
@@ -204,10 +208,12 @@ Vec3f PathTracer::trace(const Vec2i& px, PathSampleGenerator &sampler) {
 
         float roulettePdf = abs(throughput).max();
         if (bounce > 2 && roulettePdf < 0.1f) {
-            if (sampler.nextBoolean(DiscreteRouletteSample, roulettePdf))
+            if (sampler.nextBoolean(DiscreteRouletteSample, roulettePdf)) {
                 throughput /= roulettePdf;
-            else
+            } else {
+                counters.rrKills++;
                 break;
+            }
         }
         if (std::isnan(ray.d().sum() + ray.p().sum()))
             return nanDirColor;
@@ -216,9 +222,13 @@ Vec3f PathTracer::trace(const Vec2i& px, PathSampleGenerator &sampler) {
 
         sampler.advancePath();
         bounce++;
-        if (bounce < maxBounces)
+        if (bounce < maxBounces) {
+            counters.bsdfRays++;
             hit = scene->intersect(ray, intersection, data);
+        }
     }
+    counters.paths++;
+    counters.pathVertices += bounce;
     if (std::isnan(throughput.sum() + emission.sum()))
         return nanEnvDirColor;
     return emission;
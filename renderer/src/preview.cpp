@@ -0,0 +1,47 @@
+#include "preview.h"
+
+#include "stb_image_write.h"
+
+HeadlessPreview::HeadlessPreview(PreviewStream &stream, std::string target, Tonemapper tonemapper) :
+    m_stream(stream),
+    m_target(std::move(target)),
+    m_tonemapper(tonemapper)
+{
+    m_isPng = m_target.size() > 4 && m_target.compare(m_target.size() - 4, 4, ".png") == 0;
+    if (!m_isPng) {
+        m_pipe = fopen(m_target.c_str(), "ab");
+        if (!m_pipe)
+            printf("Error: could not open preview target %s\n", m_target.c_str());
+    }
+    m_worker = std::thread([this]() { run(); });
+}
+
+HeadlessPreview::~HeadlessPreview() {
+    m_stop = true;
+    m_worker.join();
+    if (m_pipe)
+        fclose(m_pipe);
+}
+
+void HeadlessPreview::run() {
+    while (true) {
+        /// read the finished flag first so the last snapshot is not missed
+        bool done = m_stop || m_stream.finished();
+        if (const PreviewFrame *frame = m_stream.acquire())
+            write(*frame);
+        if (done)
+            return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+void HeadlessPreview::write(const PreviewFrame &frame) {
+    m_tonemapper.apply(frame.hdr, m_ldr);
+    if (m_pipe) {
+        fprintf(m_pipe, "P6\n%d %d\n255\n", frame.resx, frame.resy);
+        fwrite(m_ldr.data(), sizeof(Vec3c), m_ldr.size(), m_pipe);
+        fflush(m_pipe);
+    } else if (m_isPng) {
+        stbi_write_png(m_target.c_str(), frame.resx, frame.resy, 3, m_ldr.data(), frame.resx * 3);
+    }
+}
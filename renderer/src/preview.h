@@ -0,0 +1,129 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "usings.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "tonemapper.h"
+
+struct PreviewFrame {
+    int resx{0};
+    int resy{0};
+    int frame{0};
+    int iteration{0};
+    int spp{0};          /// samples per pixel accumulated so far
+    float elapsed{0.0f}; /// seconds since the render started
+    std::chrono::steady_clock::time_point published; /// to time snapshots against a clock of the consumer's own
+    std::vector<Vec3f> hdr;
+};
+
+/**
+ * Intermediate images published by a rendering integrator for a single consumer (viewer, disk dump, pipe).
+ * Snapshots go through three slots exchanged with one atomic: the producer fills its back slot and swaps it
+ * into the middle, the consumer swaps the middle out into its front slot. Neither side ever waits for the
+ * other, and a slow consumer only skips frames.
+ */
+class PreviewStream {
+public:
+    explicit PreviewStream(float interval = 1.0f) :
+        interval(interval)
+    {};
+
+    /* Whether interval seconds have passed since the last publish. Producer side. */
+    bool due() const {
+        return std::chrono::duration<float>(std::chrono::steady_clock::now() - m_lastPublish).count() >= interval;
+    }
+
+    /* Copies hdr into the back slot and makes it the newest snapshot. Producer side. */
+    void publish(const std::vector<Vec3f> &hdr, int resx, int resy, int frame, int iteration, int spp, float elapsed) {
+        PreviewFrame &back = m_slots[m_back];
+        back.hdr.assign(hdr.begin(), hdr.end());
+        back.resx = resx;
+        back.resy = resy;
+        back.frame = frame;
+        back.iteration = iteration;
+        back.spp = spp;
+        back.elapsed = elapsed;
+        back.published = std::chrono::steady_clock::now();
+
+        int previous = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel);
+        m_back = previous & SLOT_MASK;
+        m_lastPublish = std::chrono::steady_clock::now();
+    }
+
+    /**
+     * Returns the newest snapshot if one arrived since the last call, nullptr otherwise.
+     * The snapshot stays valid until the next call. Consumer side.
+     */
+    const PreviewFrame *acquire() {
+        if (!(m_middle.load(std::memory_order_relaxed) & FRESH))
+            return nullptr;
+        int previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = previous & SLOT_MASK;
+        return &m_slots[m_front];
+    }
+
+    /* Asks the producer to finish early. Safe from any thread. */
+    void requestStop() {
+        m_stop.store(true, std::memory_order_relaxed);
+    }
+
+    bool stopRequested() const {
+        return m_stop.load(std::memory_order_relaxed);
+    }
+
+    /* Set by the producer once it will not publish anything else. */
+    void finish() {
+        m_finished.store(true, std::memory_order_release);
+    }
+
+    bool finished() const {
+        return m_finished.load(std::memory_order_acquire);
+    }
+
+    float interval; /// seconds between snapshots, 0 publishes after every iteration
+
+private:
+    static constexpr int SLOT_MASK = 3;
+    static constexpr int FRESH = 4;
+
+    PreviewFrame m_slots[3];
+    int m_back{0};                    /// producer only
+    int m_front{1};                   /// consumer only
+    std::atomic<int> m_middle{2};     /// slot index, FRESH if the producer has swapped since the last acquire
+    std::atomic<bool> m_stop{false};
+    std::atomic<bool> m_finished{false};
+    std::chrono::steady_clock::time_point m_lastPublish{};
+};
+
+/**
+ * Headless preview consumer. Polls a stream on its own thread and writes each new snapshot to target:
+ * a .png path is overwritten with the latest snapshot, any other path (e.g. a named pipe) gets binary
+ * PPM frames appended, ready for `ffmpeg -f image2pipe`.
+ */
+class HeadlessPreview {
+public:
+    HeadlessPreview(PreviewStream &stream, std::string target, Tonemapper tonemapper = {});
+    ~HeadlessPreview();
+
+    HeadlessPreview(const HeadlessPreview &) = delete;
+    HeadlessPreview &operator=(const HeadlessPreview &) = delete;
+
+private:
+    void run();
+    void write(const PreviewFrame &frame);
+
+    PreviewStream &m_stream;
+    std::string m_target;
+    Tonemapper m_tonemapper;
+    std::vector<Vec3c> m_ldr;
+    FILE *m_pipe{nullptr};
+    bool m_isPng{false};
+    std::atomic<bool> m_stop{false};
+    std::thread m_worker;
+};
+
+#endif
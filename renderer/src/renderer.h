@@ -3,6 +3,8 @@
 
 #include "usings.h"
 
+#include <filesystem>
+
 #include "framebuffer.h"
 #include "integrator.h"
 #include "scene.h"
@@ -20,15 +22,140 @@ public:
         SceneParser::FromMitsubaXML(scene, frame, integrator, filename);
     }
 
+    /**
+     * Renders the current frame. The EARS integrator is kept between calls, so rendering the same scene
+     * again starts from the cache trained by the previous render instead of pretraining from scratch.
+     */
     void render() {
-        integrator = make_unique<EARSIntegrator>();
         frame.setSpp(1);
-        integrator->render(scene, frame);
+        renderFrame(true);
+        publishFinal(0);
+        if (!outputPath.empty())
+            writeOutput(std::filesystem::path(outputPath).replace_extension().string());
+        if (preview)
+            preview->finish();
+        removeCheckpoint();
+    }
+
+    /* Writes the final image to path, as a tonemapped PNG or a float EXR or PFM depending on its extension. */
+    bool writeImage(const std::string &path) {
+        const std::string extension = std::filesystem::path(path).extension().string();
+        /// EARS keeps its last estimate in the OIDN buffer, only the OIDN integrator denoises into it
+        const bool denoised = sceneIntegrator && dynamic_cast<const OIDNIntegrator *>(integrator.get());
+        const FrameBuffer::buffer b = denoised ? FrameBuffer::OIDN : FrameBuffer::COLOR;
+        if (extension == ".png")
+            frame.toPng(path.c_str(), b);
+        else if (extension == ".exr")
+            frame.toExr(path.c_str(), b);
+        else if (extension == ".pfm")
+            frame.toPfm(path.c_str(), b);
+        else
+            return false;
+        return true;
+    }
+
+    /**
+     * Renders every frame of the scene's animation. Primitives are re-posed and the acceleration
+     * structures refitted between frames instead of reloading the scene.
+     */
+    void renderSequence() {
+        /// the checkpoint carries the cache over from the frames before it
+        int firstFrame = checkpointPath.empty() ? 0 : std::max(EARSIntegrator::checkpointFrame(checkpointPath), 0);
+        for (int f = firstFrame; f < scene.animation.frames; f++) {
+            std::cout << "Frame " << f + 1 << "/" << scene.animation.frames << std::endl;
+            scene.setFrame(f);
+            Tonemapper tonemapper = frame.tonemapper;
+            frame = FrameBuffer(scene.camera.resx, scene.camera.resy);
+            frame.tonemapper = tonemapper;
+            frame.setSpp(1);
+            renderFrame(f == firstFrame);
+            publishFinal(f);
+
+            char fname[32];
+            snprintf(fname, sizeof(fname), "frame_%04d", f);
+            writeOutput((std::filesystem::path(outputPath).parent_path() / fname).string());
+
+            if (preview && preview->stopRequested())
+                break;
+        }
+        if (preview)
+            preview->finish();
+        removeCheckpoint();
     }
 
     Scene scene;
     FrameBuffer frame;
     unique_ptr<Integrator> integrator;
+    unique_ptr<EARSIntegrator> ears; /// kept between renders along with its trained cache
+    bool debugImages{true}; /// write per-iteration debug PNGs, and OIDN's auxiliaries
+    PreviewStream *preview{nullptr};
+    TileCluster *cluster{nullptr}; /// worker processes to trace on, rendering stays local without
+    std::string checkpointPath; /// empty disables checkpointing
+    int checkpointInterval{1};
+    std::string statsPath; /// JSON report of the ray and path counters, empty disables it
+    EARS::RRSMethod rrs = EARS::RRSMethod::ADRRS(); /// RR/splitting technique of the EARS integrator
+    bool guiding{false}; /// EARS samples directions from its cache too
+    bool asyncCacheBuild{false}; /// EARS builds its cache while the next iteration renders
+    bool sceneIntegrator{false}; /// render with the integrator the scene file configures instead of EARS
+    /// final image of render(), its extension picks the float format, .png writes the tonemapped image alone.
+    /// Frames of a sequence are written next to it as frame_%04d. Empty writes nothing for single frames.
+    std::string outputPath{"render.exr"};
+    std::string tiledOutputPath; /// tiled EXR the path_tracer integrator writes its blocks to while it renders
+
+private:
+    /* resume: whether EARS may pick up the checkpoint, true for the first frame a run renders */
+    void renderFrame(bool resume) {
+        if (sceneIntegrator && !integrator) {
+            printf("Error: the scene configures no path_tracer or oidn integrator, rendering with EARS\n");
+            sceneIntegrator = false;
+        }
+        if (!sceneIntegrator) {
+            earsIntegrator().configuration.resumeCheckpoint = resume;
+            ears->render(scene, frame);
+            return;
+        }
+        integrator->preview = preview;
+        integrator->statsPath = statsPath;
+        if (auto *pathTracer = dynamic_cast<PathTraceIntegrator *>(integrator.get()))
+            pathTracer->tiledOutputPath = tiledOutputPath;
+        if (auto *oidn = dynamic_cast<OIDNIntegrator *>(integrator.get()))
+            oidn->debugImages = debugImages;
+        integrator->render(scene, frame);
+    }
+
+    EARSIntegrator &earsIntegrator() {
+        if (!ears)
+            ears = make_unique<EARSIntegrator>();
+        ears->configuration.debugImages = debugImages;
+        ears->preview = preview;
+        ears->cluster = cluster;
+        ears->configuration.checkpointPath = checkpointPath;
+        ears->configuration.checkpointInterval = std::max(checkpointInterval, 1);
+        ears->statsPath = statsPath;
+        ears->configuration.rrs = rrs;
+        ears->configuration.guiding = guiding;
+        ears->configuration.asyncCacheBuild = asyncCacheBuild;
+        return *ears;
+    }
+
+    /* A tonemapped PNG for viewing, plus the float image in outputPath's format. */
+    void writeOutput(const std::string &stem) {
+        writeImage(stem + ".png");
+        const std::string extension = std::filesystem::path(outputPath).extension().string();
+        if (extension != ".png" && !writeImage(stem + extension))
+            writeImage(stem + ".exr");
+    }
+
+    void removeCheckpoint() const {
+        if (!checkpointPath.empty())
+            std::remove(checkpointPath.c_str());
+    }
+
+    void publishFinal(int frameIndex) {
+        if (!preview)
+            return;
+        preview->publish(frame.color, frame.resx, frame.resy, frameIndex, -1, frame.spp, 0.0f);
+    }
 };
 
 #endif
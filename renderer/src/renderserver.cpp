@@ -0,0 +1,306 @@
+#include "renderserver.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+/**
+ * FNV-1a over the absolute path and the contents, the path because the files a scene refers to resolve against it.
+ * The meshes it loads add their path, size and modification time, hashing their contents would cost about as much
+ * as loading them again.
+ */
+static bool hashSceneFile(const std::string &path, uint64 &hash) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    std::stringstream contents;
+    contents << in.rdbuf();
+
+    hash = 0xcbf29ce484222325ull;
+    auto mix = [&hash](const std::string &bytes) {
+        for (unsigned char c : bytes) {
+            hash ^= c;
+            hash *= 0x100000001b3ull;
+        }
+    };
+    mix(std::filesystem::absolute(path).string());
+    mix(contents.str());
+
+    for (const std::string &mesh : SceneParser::TungstenMeshFiles(path.c_str())) {
+        std::error_code sizeError, timeError;
+        const auto size = std::filesystem::file_size(mesh, sizeError);
+        const auto time = std::filesystem::last_write_time(mesh, timeError);
+        mix(std::filesystem::absolute(mesh).string());
+        /// a missing mesh hashes apart from every version of it that exists
+        mix(sizeError ? std::string("missing") : std::to_string(size));
+        mix(timeError ? std::string("missing") : std::to_string(time.time_since_epoch().count()));
+    }
+    return true;
+}
+
+static std::vector<std::string> splitWords(const std::string &line) {
+    std::vector<std::string> words;
+    std::istringstream in(line);
+    std::string word;
+    while (in >> word)
+        words.push_back(word);
+    return words;
+}
+
+static bool hasExtension(const std::string &path, const char *extension) {
+    size_t length = strlen(extension);
+    return path.size() >= length && path.compare(path.size() - length, length, extension) == 0;
+}
+
+#ifndef _WIN32
+
+static bool sendLine(int fd, const std::string &line) {
+    std::string data = line + "\n";
+    const char *p = data.data();
+    size_t size = data.size();
+    while (size > 0) {
+        ssize_t written = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        p += written;
+        size -= size_t(written);
+    }
+    return true;
+}
+
+/* Reads up to the next newline, keeping whatever followed it in pending. */
+static bool receiveLine(int fd, std::string &pending, std::string &line) {
+    size_t end;
+    while ((end = pending.find('\n')) == std::string::npos) {
+        char buffer[1024];
+        ssize_t received = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        pending.append(buffer, size_t(received));
+    }
+    line = pending.substr(0, end);
+    pending.erase(0, end + 1);
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    return true;
+}
+
+bool RenderServer::serve(int port) {
+    signal(SIGPIPE, SIG_IGN);
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    if (server < 0) {
+        printf("Error: could not create a socket: %s\n", strerror(errno));
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    /// jobs name files on this machine, so only local clients are accepted
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(uint16(port));
+    if (bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || ::listen(server, 4) != 0) {
+        printf("Error: could not listen on port %d: %s\n", port, strerror(errno));
+        ::close(server);
+        return false;
+    }
+
+    printf("Serving renders on port %d, caching up to %zu scenes\n", port, m_capacity);
+    bool running = true;
+    bool failed = false;
+    while (running) {
+        int fd = accept(server, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("Error: accepting a client failed: %s\n", strerror(errno));
+            failed = true;
+            break;
+        }
+
+        std::string pending, line;
+        bool closeConnection = false;
+        while (running && !closeConnection && receiveLine(fd, pending, line))
+            running = execute(line, fd, closeConnection);
+        ::close(fd);
+    }
+    ::close(server);
+    return !failed;
+}
+
+#else
+
+static bool sendLine(int, const std::string &) { return false; }
+
+bool RenderServer::serve(int) {
+    printf("Error: the render server is not supported on this platform\n");
+    return false;
+}
+
+#endif
+
+bool RenderServer::execute(const std::string &command, int fd, bool &closeConnection) {
+    std::vector<std::string> args = splitWords(command);
+    if (args.empty())
+        return true;
+
+    std::string reply;
+    bool running = true;
+    if (args[0] == "render") {
+        render(args, fd, reply);
+    } else if (args[0] == "stats") {
+        std::ostringstream out;
+        out << "ok entries " << m_entries.size() << " capacity " << m_capacity
+            << " hits " << m_hits << " misses " << m_misses;
+        reply = out.str();
+    } else if (args[0] == "quit") {
+        reply = "ok";
+        closeConnection = true;
+    } else if (args[0] == "shutdown") {
+        reply = "ok";
+        running = false;
+    } else {
+        reply = "error unknown command " + args[0];
+    }
+
+    if (!sendLine(fd, reply))
+        closeConnection = true;
+    return running;
+}
+
+bool RenderServer::render(const std::vector<std::string> &args, int fd, std::string &reply) {
+    if (args.size() < 3) {
+        reply = "error usage: render <scene.json> <output.png|.exr|.pfm> [spp <n>] [iterations <n>]";
+        return false;
+    }
+    const std::string &output = args[2];
+    if (!hasExtension(output, ".png") && !hasExtension(output, ".exr") && !hasExtension(output, ".pfm")) {
+        reply = "error unsupported output format " + output;
+        return false;
+    }
+
+    EARSIntegrator::Configuration configuration;
+    configuration.debugImages = false;
+    for (size_t i = 3; i + 1 < args.size(); i += 2) {
+        int value = atoi(args[i + 1].c_str());
+        if (args[i] == "spp" && value > 0) {
+            configuration.spp = value;
+        } else if (args[i] == "iterations" && value > 0) {
+            /// a cached scene continues with sequence iterations, both stand for the length of this job
+            configuration.iterations = value;
+            configuration.sequenceIterations = value;
+        } else {
+            reply = "error bad option " + args[i] + " " + args[i + 1];
+            return false;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string error;
+    bool cached = false;
+    Renderer *renderer = acquire(args[1], cached, error);
+    if (!renderer) {
+        reply = "error " + error;
+        return false;
+    }
+
+    if (!renderer->ears)
+        renderer->ears = make_unique<EARSIntegrator>();
+    renderer->ears->configuration = configuration;
+    renderer->debugImages = false;
+    renderer->outputPath.clear(); /// written below once the job is known not to be cancelled
+
+    /// progress goes out from a thread of its own, a client that hangs up cancels the job
+    PreviewStream stream(0.0f);
+    renderer->preview = &stream;
+    std::atomic<bool> done{false};
+    std::thread progress([&stream, &done, fd]() {
+        while (true) {
+            bool last = done.load(std::memory_order_acquire);
+            if (const PreviewFrame *snapshot = stream.acquire()) {
+                if (snapshot->iteration >= 0) {
+                    char line[96];
+                    snprintf(line, sizeof(line), "progress %d %d %.2f",
+                             snapshot->iteration, snapshot->spp, snapshot->elapsed);
+                    if (!sendLine(fd, line))
+                        stream.requestStop();
+                }
+            }
+            if (last)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    });
+
+    renderer->frame = FrameBuffer(renderer->scene.camera.resx, renderer->scene.camera.resy);
+    renderer->render();
+    done.store(true, std::memory_order_release);
+    progress.join();
+    renderer->preview = nullptr;
+
+    if (stream.stopRequested()) {
+        reply = "error cancelled";
+        return false;
+    }
+
+    renderer->writeImage(output);
+
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    char line[64];
+    snprintf(line, sizeof(line), " %s %.2f", cached ? "cached" : "loaded", seconds);
+    reply = "ok " + output + line;
+    return true;
+}
+
+Renderer *RenderServer::acquire(const std::string &path, bool &cached, std::string &error) {
+    uint64 hash = 0;
+    if (!hashSceneFile(path, hash)) {
+        error = "could not read " + path;
+        return nullptr;
+    }
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->hash != hash)
+            continue;
+        m_entries.splice(m_entries.begin(), m_entries, it);
+        m_hits++;
+        cached = true;
+        return m_entries.front().renderer.get();
+    }
+
+    /// an entry for the same file with another hash was made from an older version of it
+    m_entries.remove_if([&path](const Entry &entry) { return entry.path == path; });
+
+    auto renderer = make_unique<Renderer>();
+    try {
+        renderer->loadTungstenJSON(path.c_str());
+    } catch (const std::exception &e) {
+        /// the JSON parser throws on malformed scenes, which must not take the server down
+        error = "could not load " + path + ": " + e.what();
+        return nullptr;
+    }
+    m_misses++;
+    cached = false;
+
+    m_entries.push_front(Entry{ hash, path, std::move(renderer) });
+    while (m_entries.size() > m_capacity)
+        m_entries.pop_back();
+    return m_entries.front().renderer.get();
+}
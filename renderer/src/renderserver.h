@@ -0,0 +1,55 @@
+#ifndef RENDERSERVER_H
+#define RENDERSERVER_H
+
+#include "usings.h"
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "renderer.h"
+
+/**
+ * Long running render service for tools that re-render the same scenes over and over. Clients connect to a port
+ * on the loopback interface and send one command per line:
+ *
+ *   render <scene.json> <output.png|.exr|.pfm> [spp <n>] [iterations <n>]
+ *   stats
+ *   quit       closes the connection
+ *   shutdown   stops the server
+ *
+ * render streams "progress <iteration> <spp> <seconds>" lines while it runs, every command ends with one line
+ * starting with "ok" or "error". Parsed scenes are kept together with their EARS integrator in an LRU keyed by a
+ * hash of the scene file, so rendering a scene again skips parsing and starts from the trained cache instead of
+ * pretraining. The meshes the scene loads are part of the hash by size and modification time.
+ */
+class RenderServer {
+public:
+    explicit RenderServer(size_t capacity = 4) :
+        m_capacity(std::max<size_t>(capacity, 1))
+    {};
+
+    /* Serves clients one at a time until one of them sends shutdown. Returns false if the server failed. */
+    bool serve(int port);
+
+private:
+    struct Entry {
+        uint64 hash;
+        std::string path;
+        unique_ptr<Renderer> renderer;
+    };
+
+    /* Runs one command, sending progress and the reply to fd. Returns false once the server should stop. */
+    bool execute(const std::string &command, int fd, bool &closeConnection);
+    bool render(const std::vector<std::string> &args, int fd, std::string &reply);
+
+    /* Finds or loads the scene at path, making it the most recently used entry. */
+    Renderer *acquire(const std::string &path, bool &cached, std::string &error);
+
+    std::list<Entry> m_entries; /// most recently used first
+    size_t m_capacity;
+    long m_hits{0};
+    long m_misses{0};
+};
+
+#endif
@@ -17,8 +17,12 @@ struct RRSMethod {
         EGWTW,
         EADRRS,
         EEARS,
+        EMixed, /// one of the candidates per region, whichever was measured to be most efficient there
     } technique;
 
+    /// share of vertices a mixed method gives to a random candidate, so all of them keep being measured
+    static constexpr float MIXED_EXPLORATION = 0.2f;
+
     float splittingMin;
     float splittingMax;
 
@@ -74,6 +78,82 @@ struct RRSMethod {
         return rrs;
     }
 
+    static RRSMethod GWTW() {
+        RRSMethod rrs;
+        rrs.technique = EGWTW;
+        rrs.splittingMin = 0.05f;
+        rrs.splittingMax = 20;
+        rrs.rrDepth = 5;
+        rrs.useAbsoluteThroughput = true;
+        return rrs;
+    }
+
+    static RRSMethod Mixed() {
+        RRSMethod rrs;
+        rrs.technique = EMixed;
+        rrs.splittingMin = 0.05f;
+        rrs.splittingMax = 20;
+        rrs.rrDepth = 1;
+        rrs.useAbsoluteThroughput = false;
+        return rrs;
+    }
+
+    /* The techniques a mixed method chooses between, indexed like Octtree::TechniqueStatistics. */
+    static RRSMethod candidate(int index) {
+        switch (index) {
+        case 0:  return Classic();
+        case 1:  return GWTW();
+        case 2:  return ADRRS();
+        default: return EARS();
+        }
+    }
+
+    /**
+     * For a mixed method, the candidate to use at a vertex given a uniform random number: the best one measured in
+     * the region, or a random one for MIXED_EXPLORATION of the vertices and wherever no best is known yet.
+     */
+    int selectCandidate(const Octtree::SamplingNode *samplingNode, float xi) const {
+        const int count = Octtree::TECHNIQUE_COUNT;
+        if (samplingNode->technique < 0)
+            return std::min(int(xi * count), count - 1);
+        if (xi < MIXED_EXPLORATION)
+            return std::min(int(xi / MIXED_EXPLORATION * count), count - 1);
+        return samplingNode->technique;
+    }
+
+    /* Parses none, classic, gwtw, adrrs, ears or mixed. Returns false for anything else. */
+    static bool fromName(const std::string &name, RRSMethod &rrs) {
+        if (name == "none")
+            rrs = None();
+        else if (name == "classic")
+            rrs = Classic();
+        else if (name == "gwtw")
+            rrs = GWTW();
+        else if (name == "adrrs")
+            rrs = ADRRS();
+        else if (name == "ears")
+            rrs = EARS();
+        else if (name == "mixed")
+            rrs = Mixed();
+        else
+            return false;
+        return true;
+    }
+
+    const char *name() const {
+        switch (technique) {
+        case ENone:    return "none";
+        case EClassic: return "classic";
+        case EGWTW:    return "gwtw";
+        case EADRRS:   return "adrrs";
+        case EEARS:    return "ears";
+        case EMixed:   return "mixed";
+        }
+
+        /// make gcc happy
+        return "";
+    }
+
     float evaluate(
         const Octtree::SamplingNode *samplingNode,
         float imageEarsFactor,
@@ -83,7 +163,8 @@ struct RRSMethod {
         bool bsdfHasSmoothComponent,
         int depth
     ) const {
-        if (depth < rrDepth) {
+        /// depth counts bounces from 0 at the first hit, rrDepth counts vertices from 1 as in Mitsuba
+        if (depth + 1 < rrDepth) {
             /// do not perform RR or splitting at this depth.
             return 1;
         }
@@ -111,7 +192,7 @@ struct RRSMethod {
 
         case EADRRS: {
             /// "Adjoint-driven Russian Roulette and Splitting"
-            const Vec3f LiEstimate = samplingNode->lrEstimate;
+            const Vec3f LiEstimate = samplingNode->lrEstimate();
             if (bsdfHasSmoothComponent && LiEstimate.max() > 0) {
                 return clamp(weightWindow((throughput * LiEstimate).avg()));
             } else {
@@ -121,9 +202,13 @@ struct RRSMethod {
 
         case EEARS: {
             /// "Efficiency-Aware Russian Roulette and Splitting"
+            if (!(imageEarsFactor > 0)) {
+                /// no image statistics yet (or none usable), nothing to scale the node factors by
+                return clamp(1);
+            }
             if (bsdfHasSmoothComponent) {
-                const float splittingFactorS = std::sqrt( (throughput * throughput * samplingNode->earsFactorS).avg() ) * imageEarsFactor;
-                const float splittingFactorR = std::sqrt( (throughput * throughput * samplingNode->earsFactorR).avg() ) * imageEarsFactor;
+                const float splittingFactorS = std::sqrt( (throughput * throughput * samplingNode->earsFactorS()).avg() ) * imageEarsFactor;
+                const float splittingFactorR = std::sqrt( (throughput * throughput * samplingNode->earsFactorR()).avg() ) * imageEarsFactor;
 
                 if (splittingFactorR > 1) {
                     if (splittingFactorS < 1) {
@@ -131,16 +216,23 @@ struct RRSMethod {
                         return clamp(1);
                     } else {
                         /// use variance only if both modes recommend splitting.
-                        return clamp(splittingFactorS);
+                        return clamp(std::isfinite(splittingFactorS) ? splittingFactorS : 1);
                     }
-                } else {
+                } else if (std::isfinite(splittingFactorR)) {
                     /// use second moment only if it recommends RR.
                     return clamp(splittingFactorR);
+                } else {
+                    return clamp(1);
                 }
             } else {
                 return clamp(1);
             }
         }
+
+        case EMixed: {
+            /// the tracer evaluates the candidate picked by selectCandidate() instead
+            return clamp(1);
+        }
         }
 
         /// make gcc happy
@@ -154,6 +246,7 @@ struct RRSMethod {
         case EGWTW:    return false;
         case EADRRS:   return true;
         case EEARS:    return true;
+        case EMixed:   return true;
         }
 
         /// make gcc happy
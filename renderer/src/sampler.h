@@ -6,6 +6,8 @@
 
 #include "usings.h"
 
+#include "streamio.h"
+
 enum SampleBlockStructure
 {
     NumContinuousSamples = 6,
@@ -53,6 +55,9 @@ public:
     virtual float next1D(SampleBlock block) = 0;
     virtual float next1D() = 0;
     virtual Vec2f next2D(SampleBlock block) = 0;
+
+    virtual void saveState(std::ostream &out) = 0;
+    virtual void loadState(std::istream &in) = 0;
 };
 
 class UniformSampler
@@ -117,6 +122,18 @@ public:
     {
         return _sequence;
     }
+
+    void saveState(std::ostream &out) const
+    {
+        streamWrite(out, _state);
+        streamWrite(out, _sequence);
+    }
+
+    void loadState(std::istream &in)
+    {
+        streamRead(in, _state);
+        streamRead(in, _sequence);
+    }
 };
 
 class UniformPathSampler : public PathSampleGenerator
@@ -161,6 +178,15 @@ public:
         return {_sampler.next1D(), _sampler.next1D()};
     }
 
+    void saveState(std::ostream &out) override
+    {
+        _sampler.saveState(out);
+    }
+    void loadState(std::istream &in) override
+    {
+        _sampler.loadState(in);
+    }
+
     [[nodiscard]] const UniformSampler& sampler() const
     {
         return _sampler;
@@ -4,32 +4,121 @@
 #include "usings.h"
 
 #include "aabb.h"
+#include "animation.h"
+#include "bvh.h"
 #include "camera.h"
+#include "counters.h"
 #include "material.h"
 #include "primitive.h"
 #include "ray.h"
 
 class Scene {
 public:
+    struct Animation {
+        int frames{1};
+        float rebuildThreshold{1.5f}; /// rebuild a refitted BVH once its SAH cost grows by this factor
+        std::vector<std::pair<shared_ptr<Primitive>, Track<TransformKey>>> primitives;
+        Track<CameraKey> camera;
+
+        bool isAnimated() const {
+            return frames > 1;
+        }
+    };
+
     Scene() = default;
 
     Scene(Camera cam,
           AABB aabb,
           unordered_map<std::string, shared_ptr<Material>> mats,
           unordered_map<std::string, shared_ptr<Primitive>> prims,
-          unordered_map<std::string, shared_ptr<Primitive>> lights) :
+          unordered_map<std::string, shared_ptr<Primitive>> lights,
+          BVH::Builder builder = BVH::Builder::BinnedSAH) :
             camera(cam),
             bounds(aabb),
             materials(std::move(mats)),
             primitives(std::move(prims)),
-            lights(std::move(lights)) {};
+            lights(std::move(lights)) {
+        buildAccel(builder);
+    };
+
+    /**
+     * Builds the per-shape acceleration structures and a top level BVH over all primitives.
+     */
+    void buildAccel(BVH::Builder builder) {
+        primitiveList.clear();
+        std::vector<AABB> primitiveBounds;
+        for (const auto& pair : primitives) {
+            pair.second->shape->buildAccel(builder);
+            primitiveList.push_back(pair.second.get());
+            primitiveBounds.push_back(pair.second->shape->bounds());
+        }
+        bvh.build(primitiveBounds, builder);
+        bvh.printStats();
+    }
+
+    /**
+     * Refits the acceleration structures after primitives moved.
+     * Each BVH is rebuilt only when refitting has degraded its SAH cost beyond the animation's threshold.
+     */
+    void updateAccel(const std::vector<Shape*> &movedShapes) {
+        for (Shape* shape : movedShapes)
+            shape->refitAccel(animation.rebuildThreshold);
+
+        std::vector<AABB> primitiveBounds;
+        primitiveBounds.reserve(primitiveList.size());
+        for (const Primitive* primitive : primitiveList)
+            primitiveBounds.push_back(primitive->shape->bounds());
+
+        bvh.refit(primitiveBounds);
+        if (bvh.needsRebuild(animation.rebuildThreshold)) {
+            bvh.build(primitiveBounds, bvh.stats().builder);
+            bvh.printStats();
+        }
+    }
+
+    /**
+     * Poses primitives and camera for the given frame of the animation.
+     */
+    void setFrame(int frame) {
+        currentFrame = frame;
+        std::vector<Shape*> moved;
+        for (auto& [primitive, track] : animation.primitives) {
+            TransformKey key = track.evaluate(float(frame));
+            primitive->shape->setTransform(key.pos, key.scale, key.rot);
+            moved.push_back(primitive->shape.get());
+        }
+
+        if (!animation.camera.empty()) {
+            CameraKey key = animation.camera.evaluate(float(frame));
+            camera = Camera(camera.resx, camera.resy, camera.fovd, key.eye, key.center, key.up);
+        }
+
+        if (!moved.empty())
+            updateAccel(moved);
+    }
+
+    /**
+     * Grows the scene bounds to cover every frame so the EARS cache keeps a fixed world-to-cache mapping.
+     */
+    void growBoundsOverAnimation() {
+        for (int f = 0; f < animation.frames; f++) {
+            for (auto& [primitive, track] : animation.primitives) {
+                TransformKey key = track.evaluate(float(f));
+                primitive->shape->setTransform(key.pos, key.scale, key.rot);
+                primitive->shape->setbb(bounds);
+            }
+        }
+    }
 
     bool intersect(Ray& ray, Intersection& intersection, IntersectionData& data) const {
         intersection.primitive = nullptr;
         data.primitive = nullptr;
-        for (const auto& pair : primitives) {
-            pair.second->intersect(ray, intersection);
-        }
+        uint64 tests = 0;
+        bvh.intersect(ray, [&](uint32 i, Ray& r) {
+            tests++;
+            return primitiveList[i]->intersect(r, intersection);
+        });
+        threadCounters().intersectionTests += tests;
         if (intersection.primitive) {
             data.p = ray.p() + ray.d() * ray.tfar();
             data.w = ray.d();
@@ -45,6 +134,10 @@ public:
     unordered_map<std::string, shared_ptr<Material>> materials;
     unordered_map<std::string, shared_ptr<Primitive>> primitives;
     unordered_map<std::string, shared_ptr<Primitive>> lights;
+    std::vector<const Primitive*> primitiveList;
+    BVH bvh;
+    Animation animation;
+    int currentFrame{0}; /// last frame passed to setFrame()
 };
 
 #endif
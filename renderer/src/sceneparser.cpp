@@ -1,28 +1,50 @@
 #include "sceneparser.h"
 
-Vec3f as_vec3(const xml_node &node) {
-    std::istringstream stream(node.attribute("value").value());
-    std::string token;
-    float buf[3];
-    for (float &i: buf) {
-        stream >> token;
-        i = stof(token);
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "floatparser.h"
+#include "meshloader.h"
+#include "timeline.h"
+
+/* Reads the count numbers of a node's value attribute into out, which keeps its defaults if they don't fit. */
+void parse_value(const xml_node &node, float *out, int count) {
+    const char *value = node.attribute("value").value();
+    float buf[17];
+    /// one more than asked for, to notice extra numbers
+    int parsed = parseFloats(value, value + std::strlen(value), buf, count + 1);
+    if (parsed != count) {
+        if (node)
+            printf("Error: <%s> value \"%s\" should hold %d numbers\n", node.name(), value, count);
+        return;
     }
+    std::copy(buf, buf + count, out);
+}
+
+Vec3f as_vec3(const xml_node &node) {
+    float buf[3] = {0.0f, 0.0f, 0.0f};
+    parse_value(node, buf, 3);
     return Vec3f(buf);
 }
 
 Vec3f as_vec3(const value_type &value) {
-    return Vec3f(value.get<std::vector<float>>().data());
+    std::vector<float> v = value.get<std::vector<float>>();
+    if (v.size() != 3) {
+        printf("Error: %s should hold 3 numbers\n", value.dump().c_str());
+        return Vec3f(0.0f);
+    }
+    return Vec3f(v.data());
 }
 
 Mat4f as_mat4(const xml_node &node) {
-    std::istringstream stream(node.attribute("value").value());
-    std::string token;
-    float buf[16];
-    for (float &i: buf) {
-        stream >> token;
-        i = stof(token);
-    }
+    float buf[16] = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    };
+    parse_value(node, buf, 16);
     return {
          buf[0],  buf[1],  buf[2],  buf[3],
          buf[4],  buf[5],  buf[6],  buf[7],
@@ -35,8 +57,16 @@ bool is_shape(const xml_node &shape_node, const std::string &type) {
     return ((std::string) shape_node.attribute("type").value()) == type;
 }
 
+std::string resolve_path(const char *sceneFile, const std::string &path) {
+    std::filesystem::path p(path);
+    if (p.is_absolute())
+        return p.string();
+    return (std::filesystem::path(sceneFile).parent_path() / p).string();
+}
+
 void SceneParser::FromMitsubaXML(Scene &scene, FrameBuffer &frame, unique_ptr<Integrator> &integrator,
                                  const char *filename) {
+    TimelineScope scope("Scene parse");
     xml_document doc;
     xml_parse_result result = doc.load_file(filename);
 
@@ -82,8 +112,17 @@ void SceneParser::FromMitsubaXML(Scene &scene, FrameBuffer &frame, unique_ptr<In
             shape = make_shared<Rectangle>(transform);
         } else if (is_shape(_shape, "cube")) {
             shape = make_shared<Cube>(transform);
+        } else if (is_shape(_shape, "obj") || is_shape(_shape, "ply")) {
+            std::string file = _shape.find_child_by_attribute("string", "name", "filename")
+                    .attribute("value").value();
+            MeshData mesh;
+            if (MeshLoader::load(resolve_path(filename, file).c_str(), mesh))
+                shape = make_shared<TriangleMesh>(transform, std::move(mesh));
         }
 
+        if (!shape)
+            continue;
+
         primitives[shapeId] = make_shared<Primitive>(
                 shape,
                 materials[matId],
@@ -104,6 +143,7 @@ void SceneParser::FromMitsubaXML(Scene &scene, FrameBuffer &frame, unique_ptr<In
 
 void SceneParser::FromTungstenJSON(Scene &scene, FrameBuffer &frame, unique_ptr<Integrator> &integrator,
                                    const char *filename) {
+    TimelineScope scope("Scene parse");
     std::ifstream f(filename);
     json data = json::parse(f);
 
@@ -112,6 +152,7 @@ void SceneParser::FromTungstenJSON(Scene &scene, FrameBuffer &frame, unique_ptr<
 
     Camera camera{};
     AABB aabb{};
+    Scene::Animation animation;
     unordered_map<std::string, shared_ptr<Material>> materials;
     unordered_map<std::string, shared_ptr<Primitive>> primitives;
     unordered_map<std::string, shared_ptr<Primitive>> lights;
@@ -121,6 +162,10 @@ void SceneParser::FromTungstenJSON(Scene &scene, FrameBuffer &frame, unique_ptr<
         if (_bsdf["type"] == "lambert") {
             Vec3f albedo = as_vec3(_bsdf["albedo"]);
             materials[name] = make_shared<Lambertian>(albedo);
+        } else if (_bsdf["type"] == "phong") {
+            Vec3f albedo = as_vec3(_bsdf["albedo"]);
+            float exponent = _bsdf.contains("exponent") ? float(_bsdf["exponent"]) : 64.0f;
+            materials[name] = make_shared<Phong>(albedo, exponent);
         } else if (_bsdf["type"] == "null") {
             float albedo = _bsdf["albedo"];
             materials[name] = make_shared<Lambertian>(Vec3f(albedo, albedo, albedo));
@@ -148,8 +193,16 @@ void SceneParser::FromTungstenJSON(Scene &scene, FrameBuffer &frame, unique_ptr<
             shape = make_shared<Rectangle>(pos, scale, rot);
         } else if (_prim["type"] == "cube") {
             shape = make_shared<Cube>(pos, scale, rot);
+        } else if (_prim["type"] == "mesh") {
+            std::string file = _prim["file"];
+            MeshData mesh;
+            if (MeshLoader::load(resolve_path(filename, file).c_str(), mesh))
+                shape = make_shared<TriangleMesh>(pos, scale, rot, std::move(mesh), _prim.contains("animation"));
         }
 
+        if (!shape)
+            continue;
+
         shape->setbb(aabb);
 
         primitives[name] = make_shared<Primitive>(
@@ -164,6 +217,22 @@ void SceneParser::FromTungstenJSON(Scene &scene, FrameBuffer &frame, unique_ptr<
             primitives[name]->material = make_shared<Lambertian>(Vec3f(0.0f));
             lights[name] = primitives[name];
         }
+
+        if (_prim.contains("animation")) {
+            Track<TransformKey> track;
+            for (value_type _key: _prim["animation"]) {
+                TransformKey key{_key["frame"], pos, scale, rot};
+                if (_key.contains("position"))
+                    key.pos = as_vec3(_key["position"]);
+                if (_key.contains("scale"))
+                    key.scale = as_vec3(_key["scale"]);
+                if (_key.contains("rotation"))
+                    key.rot = as_vec3(_key["rotation"]);
+                track.add(key);
+            }
+            if (!track.empty())
+                animation.primitives.emplace_back(primitives[name], track);
+        }
     }
 
     if (data.contains("camera")) {
@@ -174,14 +243,78 @@ void SceneParser::FromTungstenJSON(Scene &scene, FrameBuffer &frame, unique_ptr<
         Vec3f cent = as_vec3(data["camera"]["transform"]["look_at"]);
         Vec3f up = as_vec3(data["camera"]["transform"]["up"]);
         camera = Camera(resx, resy, fovx, eye, cent, up);
+
+        if (data["camera"].contains("animation")) {
+            for (value_type _key: data["camera"]["animation"]) {
+                CameraKey key{_key["frame"], eye, cent, up};
+                if (_key.contains("position"))
+                    key.eye = as_vec3(_key["position"]);
+                if (_key.contains("look_at"))
+                    key.center = as_vec3(_key["look_at"]);
+                if (_key.contains("up"))
+                    key.up = as_vec3(_key["up"]);
+                animation.camera.add(key);
+            }
+        }
+    }
+
+    if (data.contains("animation")) {
+        animation.frames = data["animation"].value("frames", 1);
+        animation.rebuildThreshold = data["animation"].value("bvh_rebuild_threshold", animation.rebuildThreshold);
+    }
+
+    AdaptiveSampler::Configuration adaptive;
+    if (data.contains("renderer")) {
+        auto& _renderer = data["renderer"];
+        adaptive.enabled = _renderer.value("adaptive_sampling", adaptive.enabled);
+        adaptive.spp = _renderer.value("spp", adaptive.spp);
+        adaptive.sppStep = _renderer.value("spp_step", adaptive.sppStep);
+        adaptive.minSpp = std::min(_renderer.value("adaptive_min_spp", adaptive.minSpp), adaptive.spp);
+        adaptive.maxSpp = _renderer.value("adaptive_max_spp", adaptive.maxSpp);
+        adaptive.errorThreshold = _renderer.value("adaptive_threshold", adaptive.errorThreshold);
     }
 
     if (data.contains("integrator")) {
         if (data["integrator"]["type"] == "path_tracer") {
-            integrator = make_unique<PathTraceIntegrator>();
+            auto pathTracer = make_unique<PathTraceIntegrator>();
+            pathTracer->adaptive = adaptive;
+            integrator = std::move(pathTracer);
+        } else if (data["integrator"]["type"] == "oidn") {
+            auto oidn = make_unique<OIDNIntegrator>();
+            oidn->adaptive = adaptive;
+            integrator = std::move(oidn);
         }
     }
 
-    scene = Scene(camera, aabb, materials, primitives, lights);
+    BVH::Builder builder = BVH::Builder::BinnedSAH;
+    if (data.contains("renderer") && data["renderer"].contains("bvh_builder")) {
+        builder = BVH::builderFromString(data["renderer"]["bvh_builder"]);
+    }
+
+    scene = Scene(camera, aabb, materials, primitives, lights, builder);
+    scene.animation = animation;
+    if (scene.animation.isAnimated()) {
+        scene.growBoundsOverAnimation();
+        scene.setFrame(0);
+    }
     frame = FrameBuffer(camera.resx, camera.resy);
+    if (data.contains("camera")) {
+        if (data["camera"].contains("tonemap"))
+            frame.tonemapper.op = Tonemapper::operatorFromString(data["camera"]["tonemap"]);
+        frame.tonemapper.exposure = data["camera"].value("exposure", 0.0f);
+    }
+}
+
+std::vector<std::string> SceneParser::TungstenMeshFiles(const char *filename) {
+    std::vector<std::string> files;
+    std::ifstream f(filename);
+    json data = json::parse(f, nullptr, false);
+    if (data.is_discarded() || !data.contains("primitives"))
+        return files;
+
+    for (const value_type &_prim: data["primitives"]) {
+        if (_prim.value("type", "") == "mesh" && _prim.contains("file") && _prim["file"].is_string())
+            files.push_back(resolve_path(filename, _prim["file"]));
+    }
+    return files;
 }
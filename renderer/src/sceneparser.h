@@ -31,6 +31,9 @@ public:
 
     static void
     FromTungstenJSON(Scene &scene, FrameBuffer &frame, unique_ptr<Integrator> &integrator, const char *filename);
+
+    /* Mesh files a Tungsten JSON scene loads, resolved like FromTungstenJSON does. */
+    static std::vector<std::string> TungstenMeshFiles(const char *filename);
 };
 
 #endif
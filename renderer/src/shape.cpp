@@ -1,5 +1,9 @@
 #include "shape.h"
 
+#include <algorithm>
+
+#include "parallel.h"
+
 bool Rectangle::intersect(Ray& ray, Intersection& intersection) const {
     float nDotW = ray.d().dot(frame.normal);
     if (std::abs(nDotW) < 1e-6f)
@@ -58,11 +62,11 @@ bool Cube::intersect(Ray& ray, Intersection& intersection) const {
     return false;
 }
 
-void Rectangle::setIntersectionData(Intersection &intersection, IntersectionData &data) const {
+void Rectangle::setIntersectionData(Intersection &/*intersection*/, IntersectionData &data) const {
     data.Ng = data.Ns = frame.normal;
 }
 
-void Cube::setIntersectionData(Intersection &intersection, IntersectionData &data) const {
+void Cube::setIntersectionData(Intersection &/*intersection*/, IntersectionData &data) const {
     Vec3f p = invRot * (data.p - pos);
     Vec3f n(0.0f);
     int dim = (abs(p) - scale).maxDim();
@@ -70,3 +74,145 @@ void Cube::setIntersectionData(Intersection &intersection, IntersectionData &dat
     data.Ns = data.Ng = rot4 * n;
     return;
 }
+
+void TriangleMesh::computeGeometry(const Mat4f &transform) {
+    /// bake the transform into the vertex buffer, in place unless there are object space vertices to start from
+    const std::vector<Vec3f> &source = objectVertices.empty() ? vertices : objectVertices;
+    vertices.resize(source.size());
+    const int blocks = int(std::min<size_t>(threadCount() * 4, vertices.size() / 65536 + 1));
+    parallelFor(blocks, [&](int b) {
+        size_t begin = vertices.size() * b / blocks;
+        size_t end = vertices.size() * (b + 1) / blocks;
+        for (size_t i = begin; i < end; i++)
+            vertices[i] = transform * source[i];
+    });
+
+    double sum = 0.0;
+    areaCdf.resize(triangles.size());
+    for (size_t i = 0; i < triangles.size(); i++) {
+        const Vec3u &tri = triangles[i];
+        Vec3f e0 = vertices[tri.y()] - vertices[tri.x()];
+        Vec3f e1 = vertices[tri.z()] - vertices[tri.x()];
+        sum += 0.5 * e0.cross(e1).length();
+        areaCdf[i] = float(sum);
+    }
+    area = float(sum);
+}
+
+bool TriangleMesh::sampleDirect(const Vec3f& p, PathSampleGenerator& sampler, LightSample& sample) const {
+    if (triangles.empty() || area <= 0.0f)
+        return false;
+
+    /// pick a triangle by area, what is left of xi.x within its share places the point on it
+    Vec2f xi = sampler.next2D(EmitterSample);
+    float target = xi.x() * area;
+    size_t index = size_t(std::upper_bound(areaCdf.begin(), areaCdf.end(), target) - areaCdf.begin());
+    index = std::min(index, triangles.size() - 1);
+    float lower = index == 0 ? 0.0f : areaCdf[index - 1];
+    float u = std::clamp((target - lower) / (areaCdf[index] - lower), 0.0f, 1.0f);
+
+    const Vec3u &tri = triangles[index];
+    const Vec3f &p0 = vertices[tri.x()];
+    Vec3f e0 = vertices[tri.y()] - p0;
+    Vec3f e1 = vertices[tri.z()] - p0;
+    float su = std::sqrt(u);
+    Vec3f q = p0 + e0 * (su * (1.0f - xi.y())) + e1 * (su * xi.y());
+    Vec3f n = e0.cross(e1).normalized();
+
+    sample.d = q - p;
+    float rSq = sample.d.lengthSq();
+    sample.dist = std::sqrt(rSq);
+    sample.d /= sample.dist;
+    float cosTheta = -n.dot(sample.d);
+    if (cosTheta <= 0.0f)
+        return false;
+    sample.pdf = rSq / (cosTheta * area);
+
+    return true;
+}
+
+bool TriangleMesh::intersectTriangle(uint32 index, Ray& ray, Intersection& intersection) const {
+    const Vec3u &tri = triangles[index];
+    const Vec3f &p0 = vertices[tri.x()];
+    Vec3f e0 = vertices[tri.y()] - p0;
+    Vec3f e1 = vertices[tri.z()] - p0;
+
+    Vec3f pvec = ray.d().cross(e1);
+    float det = e0.dot(pvec);
+    if (std::abs(det) < 1e-12f)
+        return false;
+    float invDet = 1.0f / det;
+
+    Vec3f tvec = ray.p() - p0;
+    float u = tvec.dot(pvec) * invDet;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    Vec3f qvec = tvec.cross(e0);
+    float v = ray.d().dot(qvec) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    float t = e1.dot(qvec) * invDet;
+    if (t < ray.tnear() || t > ray.tfar())
+        return false;
+
+    ray.tfar(t);
+    intersection.p = ray.p() + t * ray.d();
+    intersection.backface = det < 0.0f;
+    MeshIntersection *isect = intersection.as<MeshIntersection>();
+    isect->triangle = index;
+    isect->u = u;
+    isect->v = v;
+
+    return true;
+}
+
+std::vector<AABB> TriangleMesh::triangleBounds() const {
+    std::vector<AABB> result(triangles.size());
+    const int blocks = int(std::min<size_t>(threadCount() * 4, triangles.size() / 65536 + 1));
+    parallelFor(blocks, [&](int b) {
+        size_t begin = triangles.size() * b / blocks;
+        size_t end = triangles.size() * (b + 1) / blocks;
+        for (size_t i = begin; i < end; i++) {
+            AABB &aabb = result[i] = AABB::empty();
+            for (int k = 0; k < 3; k++)
+                aabb.grow(vertices[triangles[i][k]]);
+        }
+    });
+    return result;
+}
+
+void TriangleMesh::buildAccel(BVH::Builder builder) {
+    bvh.build(triangleBounds(), builder);
+    bvh.printStats();
+}
+
+void TriangleMesh::refitAccel(float rebuildThreshold) {
+    std::vector<AABB> bounds = triangleBounds();
+    bvh.refit(bounds);
+    if (bvh.needsRebuild(rebuildThreshold)) {
+        bvh.build(bounds, bvh.stats().builder);
+        bvh.printStats();
+    }
+}
+
+bool TriangleMesh::intersect(Ray& ray, Intersection& intersection) const {
+    if (bvh.nodes.empty()) {
+        bool hit = false;
+        for (uint32 i = 0; i < uint32(triangles.size()); i++)
+            hit |= intersectTriangle(i, ray, intersection);
+        return hit;
+    }
+    return bvh.intersect(ray, [&](uint32 i, Ray& r) {
+        return intersectTriangle(i, r, intersection);
+    });
+}
+
+void TriangleMesh::setIntersectionData(Intersection &intersection, IntersectionData &data) const {
+    const Vec3u &tri = triangles[intersection.as<MeshIntersection>()->triangle];
+    const Vec3f &p0 = vertices[tri.x()];
+    Vec3f n = (vertices[tri.y()] - p0).cross(vertices[tri.z()] - p0);
+    data.Ng = data.Ns = n.normalized();
+    data.uv = Vec2f(intersection.as<MeshIntersection>()->u, intersection.as<MeshIntersection>()->v);
+}
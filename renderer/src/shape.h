@@ -7,8 +7,10 @@
 #include "usings.h"
 
 #include "aabb.h"
+#include "bvh.h"
 #include "ray.h"
 #include "intersection.h"
+#include "meshloader.h"
 
 class Shape {
 public:
@@ -23,10 +25,40 @@ public:
 
     Shape(const Vec3f &pos,
           const Vec3f &scale,
-          const Vec3f &rot3) :
-            pos(pos),
-            scale(scale),
-            rot3(rot3) {
+          const Vec3f &rot3) {
+        computeTransform(pos, scale, rot3);
+    };
+
+    virtual ~Shape() = default;
+
+    /**
+     * Moves the shape, e.g. between the frames of an animation. Derived shapes recompute their cached geometry.
+     */
+    virtual void setTransform(const Vec3f &pos_, const Vec3f &scale_, const Vec3f &rot3_) {
+        computeTransform(pos_, scale_, rot3_);
+    }
+
+    virtual void setbb(AABB& aabb) const = 0;
+    virtual bool intersect(Ray& ray, Intersection& intersection) const = 0;
+    virtual void setIntersectionData(Intersection& intersection, IntersectionData& data) const = 0;
+    virtual bool sampleDirect(const Vec3f& p, PathSampleGenerator& sampler, LightSample& sample) const = 0;
+    /* Whether sampleDirect() can sample the shape at all, emitters it can't are only reached by BSDF sampling. */
+    virtual bool canSampleDirect() const { return true; }
+    virtual float pdf(const Intersection& intersection, const IntersectionData& data, const Vec3f& p) const = 0;
+    virtual void buildAccel(BVH::Builder /*builder*/) {}
+    virtual void refitAccel(float /*rebuildThreshold*/) {}
+
+    AABB bounds() const {
+        AABB aabb = AABB::empty();
+        setbb(aabb);
+        return aabb;
+    }
+
+protected:
+    void computeTransform(const Vec3f &pos_, const Vec3f &scale_, const Vec3f &rot3_) {
+        pos = pos_;
+        scale = scale_;
+        rot3 = rot3_;
 
         Vec3f x(1.0f, 0.0f, 0.0f);
         Vec3f y(0.0f, 1.0f, 0.0f);
@@ -49,13 +81,7 @@ public:
             0.0f, 0.0f, 0.0f, 1.0f
         );
         to_obj = to_world.invert();
-    };
-
-    virtual void setbb(AABB& aabb) const = 0;
-    virtual bool intersect(Ray& ray, Intersection& intersection) const = 0;
-    virtual void setIntersectionData(Intersection& intersection, IntersectionData& data) const = 0;
-    virtual bool sampleDirect(const Vec3f& p, PathSampleGenerator& sampler, LightSample& sample) const = 0;
-    virtual float pdf(const Intersection& intersection, const IntersectionData& data, const Vec3f& p) const = 0;
+    }
 
 public:
     Vec3f pos;
@@ -75,20 +101,14 @@ public:
               const Vec3f &scale,
               const Vec3f &rot3) :
             Shape(pos, scale, rot3) {
-        base = to_world * Vec3f(0.0f);
-        edge0 = to_world.transformVector(Vec3f(1.0f, 0.0f, 0.0f));
-        edge1 = to_world.transformVector(Vec3f(0.0f, 0.0f, 1.0f));
-        base -= edge0 * 0.5f;
-        base -= edge1 * 0.5f;
-        Vec3f n = edge1.cross(edge0);
-        area = n.length();
-        invArea = 1.0f / area;
-        n /= area;
-        invUvSq = 1.0f / Vec2f(edge0.lengthSq(), edge1.lengthSq());
-        normal = n;
-        frame = TangentFrame(n, edge0.normalized(), edge1.normalized());
+        computeGeometry();
     };
 
+    void setTransform(const Vec3f &pos_, const Vec3f &scale_, const Vec3f &rot3_) override {
+        computeTransform(pos_, scale_, rot3_);
+        computeGeometry();
+    }
+
     void setbb(AABB& aabb) const override {
         aabb.grow(base);
         aabb.grow(base + edge0);
@@ -115,7 +135,7 @@ public:
         return true;
     }
 
-    float pdf(const Intersection& intersection, const IntersectionData& data, const Vec3f& p) const override {
+    float pdf(const Intersection& /*intersection*/, const IntersectionData& data, const Vec3f& p) const override {
         float cosTheta = std::abs(frame.normal.dot(data.w));
         float t = frame.normal.dot(base - p) / frame.normal.dot(data.w);
         return t * t / (cosTheta * area);
@@ -129,6 +149,22 @@ public:
     float invArea;
     Vec3f normal;
     TangentFrame frame;
+
+private:
+    void computeGeometry() {
+        base = to_world * Vec3f(0.0f);
+        edge0 = to_world.transformVector(Vec3f(1.0f, 0.0f, 0.0f));
+        edge1 = to_world.transformVector(Vec3f(0.0f, 0.0f, 1.0f));
+        base -= edge0 * 0.5f;
+        base -= edge1 * 0.5f;
+        Vec3f n = edge1.cross(edge0);
+        area = n.length();
+        invArea = 1.0f / area;
+        n /= area;
+        invUvSq = 1.0f / Vec2f(edge0.lengthSq(), edge1.lengthSq());
+        normal = n;
+        frame = TangentFrame(n, edge0.normalized(), edge1.normalized());
+    }
 };
 
 class Cube : public Shape {
@@ -139,14 +175,14 @@ public:
          const Vec3f &scale,
          const Vec3f &rot3) :
             Shape(pos, scale*0.5f, rot3) {
-        Vec3f faceCdf = 4.0f * Vec3f(
-            scale.y() * scale.z(),
-            scale.z() * scale.x(),
-            scale.x() * scale.y()
-        );
-        area = 2.0f * faceCdf.z();
+        computeArea(scale);
     };
 
+    void setTransform(const Vec3f &pos_, const Vec3f &scale_, const Vec3f &rot3_) override {
+        computeTransform(pos_, scale_ * 0.5f, rot3_);
+        computeArea(scale_);
+    }
+
     void setbb(AABB& aabb) const override {
         for (int i = 0; i < 8; i++) {
             aabb.grow(pos + rot4 * Vec3f(
@@ -160,16 +196,95 @@ public:
     bool intersect(Ray& ray, Intersection& intersection) const override;
     void setIntersectionData(Intersection &intersection, IntersectionData &data) const override;
 
-    bool sampleDirect(const Vec3f& p, PathSampleGenerator& sampler, LightSample& sample) const override {
+    bool sampleDirect(const Vec3f& /*p*/, PathSampleGenerator& /*sampler*/, LightSample& /*sample*/) const override {
         return false;
     }
+    bool canSampleDirect() const override { return false; }
 
-    float pdf(const Intersection& intersection, const IntersectionData& data, const Vec3f& p) const override {
+    float pdf(const Intersection& /*intersection*/, const IntersectionData& data, const Vec3f& p) const override {
         return (p - data.p).lengthSq() / (-data.w.dot(data.Ng) * area);
     }
 
 public:
     float area;
+
+private:
+    void computeArea(const Vec3f &size) {
+        Vec3f faceCdf = 4.0f * Vec3f(
+            size.y() * size.z(),
+            size.z() * size.x(),
+            size.x() * size.y()
+        );
+        area = 2.0f * faceCdf.z();
+    }
+};
+
+class TriangleMesh : public Shape {
+public:
+    TriangleMesh(const Mat4f &transform, MeshData mesh) :
+            Shape(transform),
+            vertices(std::move(mesh.vertices)),
+            triangles(std::move(mesh.triangles)) {
+        computeGeometry(to_world);
+    };
+
+    /* An animated mesh keeps a copy of its object space vertices to pose it for every frame. */
+    TriangleMesh(const Vec3f &pos,
+                 const Vec3f &scale,
+                 const Vec3f &rot3,
+                 MeshData mesh,
+                 bool animated = false) :
+            Shape(pos, scale, rot3),
+            vertices(std::move(mesh.vertices)),
+            triangles(std::move(mesh.triangles)) {
+        if (animated)
+            objectVertices = vertices;
+        computeGeometry(to_world);
+    };
+
+    void setTransform(const Vec3f &pos_, const Vec3f &scale_, const Vec3f &rot3_) override {
+        const Mat4f previousToObj = to_obj;
+        computeTransform(pos_, scale_, rot3_);
+        /// without object space vertices the world space ones are moved from the previous pose
+        computeGeometry(objectVertices.empty() ? to_world * previousToObj : to_world);
+    }
+
+    void setbb(AABB& aabb) const override {
+        for (const auto &v : vertices)
+            aabb.grow(v);
+    }
+
+    bool intersect(Ray& ray, Intersection& intersection) const override;
+    void setIntersectionData(Intersection& intersection, IntersectionData& data) const override;
+
+    /* Samples the mesh uniformly by area, only the front of a triangle emits. */
+    bool sampleDirect(const Vec3f& p, PathSampleGenerator& sampler, LightSample& sample) const override;
+
+    float pdf(const Intersection& /*intersection*/, const IntersectionData& data, const Vec3f& p) const override {
+        return (p - data.p).lengthSq() / (-data.w.dot(data.Ng) * area);
+    }
+
+    void buildAccel(BVH::Builder builder) override;
+    void refitAccel(float rebuildThreshold) override;
+
+    bool intersectTriangle(uint32 index, Ray& ray, Intersection& intersection) const;
+
+public:
+    struct MeshIntersection {
+        uint32 triangle;
+        float u, v;
+    };
+
+    std::vector<Vec3f> objectVertices; // only kept for animated meshes
+    std::vector<Vec3f> vertices; // world space
+    std::vector<Vec3u> triangles;
+    float area{0.0f};
+    std::vector<float> areaCdf; // running sum of the triangle areas, to sample a triangle by area
+    BVH bvh;
+
+private:
+    void computeGeometry(const Mat4f &transform);
+    std::vector<AABB> triangleBounds() const;
 };
 
 #endif
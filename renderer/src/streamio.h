@@ -0,0 +1,45 @@
+/* Adapted from Benedikt Bitterli's Tungsten
+ * https://github.com/tunabrain/tungsten */
+
+#ifndef STREAMIO_H
+#define STREAMIO_H
+
+#include "usings.h"
+
+#include <iostream>
+#include <type_traits>
+
+/* Raw binary (de)serialisation of trivially copyable values and vectors of them, used for checkpoints. */
+
+template<typename T>
+inline void streamWrite(std::ostream &out, const T &src) {
+    static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable types can be written raw");
+    out.write(reinterpret_cast<const char *>(&src), sizeof(T));
+}
+
+template<typename T>
+inline void streamWrite(std::ostream &out, const std::vector<T> &src) {
+    static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable types can be written raw");
+    uint64 size = src.size();
+    streamWrite(out, size);
+    out.write(reinterpret_cast<const char *>(src.data()), std::streamsize(size * sizeof(T)));
+}
+
+template<typename T>
+inline void streamRead(std::istream &in, T &dst) {
+    static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable types can be read raw");
+    in.read(reinterpret_cast<char *>(&dst), sizeof(T));
+}
+
+template<typename T>
+inline void streamRead(std::istream &in, std::vector<T> &dst) {
+    static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable types can be read raw");
+    uint64 size = 0;
+    streamRead(in, size);
+    if (!in)
+        return;
+    dst.resize(size);
+    in.read(reinterpret_cast<char *>(dst.data()), std::streamsize(size * sizeof(T)));
+}
+
+#endif
@@ -0,0 +1,80 @@
+#include "timeline.h"
+
+#include <fstream>
+
+#include <nlohmann/json.hpp>
+
+int Timeline::threadIndex() {
+    static std::atomic<int> threads{0};
+    thread_local int index = threads.fetch_add(1);
+    return index;
+}
+
+void Timeline::start(const std::string &path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_path = path;
+    m_start = std::chrono::steady_clock::now();
+    m_events.clear();
+    m_enabled.store(true, std::memory_order_relaxed);
+}
+
+bool Timeline::stop() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_enabled.load(std::memory_order_relaxed))
+        return true;
+    m_enabled.store(false, std::memory_order_relaxed);
+
+    nlohmann::json events = nlohmann::json::array();
+    for (const auto &[thread, name] : m_threadNames) {
+        events.push_back({
+            { "name", "thread_name" }, { "ph", "M" }, { "pid", 1 }, { "tid", thread },
+            { "args", { { "name", name } } }
+        });
+    }
+    for (const Event &event : m_events) {
+        nlohmann::json entry = {
+            { "name", event.name }, { "ph", "X" }, { "pid", 1 }, { "tid", event.thread },
+            { "ts", event.begin }, { "dur", event.duration }
+        };
+        if (event.argName)
+            entry["args"] = { { event.argName, event.argValue } };
+        events.push_back(std::move(entry));
+    }
+    m_events.clear();
+
+    std::ofstream out(m_path);
+    out << nlohmann::json{ { "traceEvents", events }, { "displayTimeUnit", "ms" } }.dump() << std::endl;
+    if (!out) {
+        printf("Error: could not write the timeline to %s\n", m_path.c_str());
+        return false;
+    }
+    printf("Timeline written to %s\n", m_path.c_str());
+    return true;
+}
+
+void Timeline::nameThread(const char *name) {
+    int thread = threadIndex();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &entry : m_threadNames) {
+        if (entry.first == thread) {
+            entry.second = name;
+            return;
+        }
+    }
+    m_threadNames.emplace_back(thread, name);
+}
+
+void Timeline::record(const char *name, std::chrono::steady_clock::time_point begin,
+                      std::chrono::steady_clock::time_point end, const char *argName, int argValue) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    int thread = threadIndex();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_enabled.load(std::memory_order_relaxed))
+        return;
+    m_events.push_back({
+        name, argName, argValue, thread,
+        duration_cast<microseconds>(begin - m_start).count(),
+        duration_cast<microseconds>(end - begin).count()
+    });
+}
@@ -0,0 +1,89 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include "usings.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+/**
+ * Records how long the phases of a render take on which thread and writes them as a Chrome trace-event file,
+ * to be opened in chrome://tracing or Perfetto. Nothing is recorded until start() is called, a disabled
+ * timeline costs a TimelineScope one relaxed load.
+ */
+class Timeline {
+public:
+    static Timeline &instance() {
+        static Timeline timeline;
+        return timeline;
+    }
+
+    Timeline(const Timeline &) = delete;
+    Timeline &operator=(const Timeline &) = delete;
+
+    /* Starts recording, the events are written to path by stop(). */
+    void start(const std::string &path);
+
+    /* Stops recording and writes the file. Returns false if it could not be written. */
+    bool stop();
+
+    bool enabled() const {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    /* Names the calling thread in the trace. */
+    void nameThread(const char *name);
+
+    /* Adds a complete event. name and argName must outlive the timeline, e.g. string literals. */
+    void record(const char *name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end,
+                const char *argName = nullptr, int argValue = 0);
+
+private:
+    Timeline() = default;
+
+    struct Event {
+        const char *name;
+        const char *argName;
+        int argValue;
+        int thread;
+        int64_t begin; /// microseconds since start()
+        int64_t duration;
+    };
+
+    static int threadIndex();
+
+    std::atomic<bool> m_enabled{false};
+    std::mutex m_mutex;
+    std::string m_path;
+    std::chrono::steady_clock::time_point m_start;
+    std::vector<Event> m_events;
+    std::vector<std::pair<int, std::string>> m_threadNames;
+};
+
+/* Records the time from construction to destruction as one event, if the timeline is enabled. */
+class TimelineScope {
+public:
+    explicit TimelineScope(const char *name, const char *argName = nullptr, int argValue = 0) :
+        m_name(name), m_argName(argName), m_argValue(argValue), m_enabled(Timeline::instance().enabled()) {
+        if (m_enabled)
+            m_begin = std::chrono::steady_clock::now();
+    }
+
+    ~TimelineScope() {
+        if (m_enabled)
+            Timeline::instance().record(m_name, m_begin, std::chrono::steady_clock::now(), m_argName, m_argValue);
+    }
+
+    TimelineScope(const TimelineScope &) = delete;
+    TimelineScope &operator=(const TimelineScope &) = delete;
+
+private:
+    const char *m_name;
+    const char *m_argName;
+    int m_argValue;
+    bool m_enabled;
+    std::chrono::steady_clock::time_point m_begin;
+};
+
+#endif
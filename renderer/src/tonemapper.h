@@ -0,0 +1,52 @@
+#ifndef TONEMAPPER_H
+#define TONEMAPPER_H
+
+#include "usings.h"
+
+/* Maps linear HDR radiance to 8-bit display values.
+ * Works on the flat float stream of a Vec3f buffer, four channels at a time with SSE when available,
+ * and splits large images over the thread pool. Output goes into a caller-provided buffer. */
+class Tonemapper {
+public:
+    enum class Operator {
+        Filmic,   /// Hejl-Burgess-Dawson filmic curve, display gamma is part of the fit
+        Reinhard, /// x / (1 + x), then sRGB
+        ACES,     /// Narkowicz's ACES fit, then sRGB
+        Linear    /// clamp, then sRGB
+    };
+
+    Tonemapper() = default;
+
+    Tonemapper(Operator op, float exposure = 0.0f) :
+        op(op),
+        exposure(exposure)
+    {};
+
+    static Operator operatorFromString(const std::string &name) {
+        if (name == "reinhard")
+            return Operator::Reinhard;
+        if (name == "aces")
+            return Operator::ACES;
+        if (name == "linear" || name == "gamma" || name == "clamp")
+            return Operator::Linear;
+        return Operator::Filmic;
+    }
+
+    /* Tonemaps count pixels of hdr into ldr, which must hold count pixels. */
+    void apply(const Vec3f *hdr, Vec3c *ldr, size_t count) const;
+
+    /* Same as above, resizing ldr only when the pixel count changed so it can be reused between calls. */
+    void apply(const std::vector<Vec3f> &hdr, std::vector<Vec3c> &ldr) const {
+        if (ldr.size() != hdr.size())
+            ldr.resize(hdr.size());
+        apply(hdr.data(), ldr.data(), hdr.size());
+    }
+
+    Operator op{Operator::Filmic};
+    float exposure{0.0f}; /// in stops
+
+private:
+    void applyRange(const float *in, uint8 *out, size_t begin, size_t end) const;
+};
+
+#endif
@@ -96,6 +96,7 @@ private:
         Ray ray;
         int depth;
         bool wasSpecular { true };
+        Vec3f pixelNorm { 1.f }; /// what weight is divided by when it is relative to the pixel estimate
     };
 
     struct LiOutput {
@@ -110,6 +111,9 @@ private:
         void markAsLeaf(int depth) {
             depthAcc = depth;
             depthWeight = 1;
+            RenderCounters &counters = threadCounters();
+            counters.paths++;
+            counters.pathVertices += depth;
         }
 
         float averagePathLength() const {
@@ -149,6 +153,13 @@ public:
         return { (cosTheta + 1) / 2, phi / (2 * PI) };
     }
 
+    Vec3f canonicalToDir(const Vec2f& p) {
+        const float cosTheta = 2 * p.x() - 1;
+        const float phi = 2 * PI * p.y();
+        const float sinTheta = std::sqrt(std::max(1 - cosTheta * cosTheta, 0.0f));
+        return { sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta };
+    }
+
     int mapOutgoingDirectionToHistogramBin(const Vec3f& wo) {
         const Vec2f p = dirToCanonical(wo);
         const int res = EARS::Octtree::HISTOGRAM_RESOLUTION;
@@ -166,9 +177,14 @@ public:
         return result;
     }
 
-    void updateImageStatistics(float actualTotalCost) {
-        imageStatistics.reset(actualTotalCost);
-        imageEarsFactor = imageStatistics.earsFactor();
+    void updateImageStatistics(float actualTotalCost, const RenderCounters &counters) {
+        imageStatistics.reset(actualTotalCost, counters);
+        float earsFactor = imageStatistics.earsFactor();
+        if (earsFactor > 0)
+            imageEarsFactor = earsFactor;
+        else
+            printf("Warning: no usable image statistics this iteration, keeping the EARS factor at %.3e\n",
+                   imageEarsFactor);
     }
 
     void resetBlockAccumulators() {
@@ -178,6 +194,16 @@ public:
         samplesTaken = 0;
     }
 
+    /**
+     * Guided BSDF sampling: with probability guidingBsdfFraction the BSDF is sampled, otherwise a direction from the
+     * region's incident radiance histogram (guiding, BIN_COUNT bins as found by Octtree::lookup). The event's pdf is
+     * that of the mixture, its weight eval / pdf. Without a histogram this is plain BSDF sampling.
+     */
+    bool sampleGuided(SurfaceScatterEvent& event, const EARS::Octtree::SamplingNode* guiding);
+
+    /* Pdf of the mixture sampleGuided() draws event.wo from. */
+    float guidedPdf(const SurfaceScatterEvent& event, const EARS::Octtree::SamplingNode* guiding);
+
     LiOutput Li(LiInput &input, PathSampleGenerator& sampler);
     Vec3f LrEstimate(const Vec2i& px, PathSampleGenerator& sampler);
 
@@ -187,6 +213,8 @@ public:
     EARS::RRSMethod rrs;
     Film imageEstimate;
     float imageEarsFactor;
+    bool guiding{false};             /// sample directions from the cache's incident radiance histograms too
+    float guidingBsdfFraction{0.5f}; /// share of guided samples that sample the BSDF instead
     float depthAcc;
     float depthWeight;
     float primarySplit;
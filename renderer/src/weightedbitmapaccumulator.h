@@ -5,13 +5,16 @@
 #define WEIGHTEDBITMAPACCUMULATOR_H
 
 #include "framebuffer.h"
+#include "streamio.h"
+
+#include <memory>
 
 namespace EARS {
 
 struct WeightedBitmapAccumulator {
     void clear() {
-        m_scrap = nullptr;
-        m_bitmap = nullptr;
+        m_scrap.reset();
+        m_bitmap.reset();
         m_spp = 0;
         m_weight = 0;
     }
@@ -30,7 +33,7 @@ struct WeightedBitmapAccumulator {
         const long floatCount = size.x() * size.y() * long(3);
 
         if (!m_scrap) {
-            m_scrap = new Film(film.size());
+            m_scrap = std::make_unique<Film>(film.size());
         }
         for (int i = 0; i < film.buffer.size(); i++) {
             m_scrap->buffer[i] = film.buffer[i];
@@ -39,7 +42,7 @@ struct WeightedBitmapAccumulator {
         ///
 
         if (!m_bitmap) {
-            m_bitmap = new Film(film.size());
+            m_bitmap = std::make_unique<Film>(film.size());
             for (int i = 0; i < film.buffer.size(); i++) {
                 m_bitmap->buffer[i] = Vec3f(0.0f);
             }
@@ -76,11 +79,36 @@ struct WeightedBitmapAccumulator {
         }
     }
 
+    void saveState(std::ostream &out) const {
+        streamWrite(out, m_weight);
+        streamWrite(out, m_spp);
+        bool hasBitmap = m_bitmap != nullptr;
+        streamWrite(out, hasBitmap);
+        if (hasBitmap) {
+            streamWrite(out, m_bitmap->size());
+            streamWrite(out, m_bitmap->buffer);
+        }
+    }
+
+    void loadState(std::istream &in) {
+        clear();
+        streamRead(in, m_weight);
+        streamRead(in, m_spp);
+        bool hasBitmap = false;
+        streamRead(in, hasBitmap);
+        if (hasBitmap) {
+            Vec2i size;
+            streamRead(in, size);
+            m_bitmap = std::make_unique<Film>(size);
+            streamRead(in, m_bitmap->buffer);
+        }
+    }
+
 private:
-    Film* m_scrap;
-    Film* m_bitmap;
-    float m_weight;
-    int m_spp;
+    std::unique_ptr<Film> m_scrap;
+    std::unique_ptr<Film> m_bitmap;
+    float m_weight{0};
+    int m_spp{0};
 };
 
 };
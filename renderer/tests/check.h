@@ -0,0 +1,17 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+/* Minimal assertions for the test executables: failures are counted and reported, main returns the count. */
+static int failures = 0;
+
+#define CHECK(condition)                                                               \
+    do {                                                                               \
+        if (!(condition)) {                                                            \
+            printf("Error: %s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                                \
+        }                                                                              \
+    } while (0)
+
+#endif
@@ -0,0 +1,100 @@
+#include "check.h"
+
+#include "sceneparser.h"
+#include "tracer.h"
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+/* Renders a floor under two emitters with the EARS tracer, light sampling one of them. */
+
+static std::string tempPath(const char *name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+/* The unit quad as two triangles, facing +y like a quad primitive. */
+static std::string writeQuadMesh(const char *name) {
+    const std::string path = tempPath(name);
+    std::ofstream out(path);
+    out << "v -0.5 0 -0.5\nv 0.5 0 -0.5\nv 0.5 0 0.5\nv -0.5 0 0.5\nf 1 3 2\nf 1 4 3\n";
+    return path;
+}
+
+/**
+ * A lambert floor under two quads facing it, a bright one at x = 0.4 and a dim one at x = -0.4. The one named
+ * "Light" is the one the tracer samples directly, the other one is only found by BSDF sampling. brightMesh
+ * builds the bright one from a mesh file instead.
+ */
+static std::string writeScene(const char *name, bool lightIsBright, const std::string &brightMesh = "") {
+    const char *bright = lightIsBright ? "Light" : "Lamp";
+    const char *dim = lightIsBright ? "Lamp" : "Light";
+    const std::string path = tempPath(name);
+    std::ofstream out(path);
+    out << R"({"bsdfs": [{"name": "Floor", "albedo": [0.5, 0.5, 0.5], "type": "lambert"},)"
+        << R"( {"name": "Light", "albedo": 1, "type": "null"}, {"name": "Lamp", "albedo": 1, "type": "null"}],)"
+        << R"( "primitives": [{"transform": {"scale": [4, 1, 4], "rotation": [0, 90, 0]}, "type": "quad", "bsdf": "Floor"},)"
+        << R"( {"transform": {"position": [0.4, 0.5, 0], "scale": [0.5, 1, 0.5], "rotation": [0, 180, 180]},)"
+        << R"( "emission": [10, 10, 10], )"
+        << (brightMesh.empty() ? std::string(R"("type": "quad")") : R"("type": "mesh", "file": ")" + brightMesh + "\"")
+        << R"(, "bsdf": ")" << bright << R"("},)"
+        << R"( {"transform": {"position": [-0.4, 0.5, 0], "scale": [0.5, 1, 0.5], "rotation": [0, 180, 180]},)"
+        << R"( "emission": [0.01, 0.01, 0.01], "type": "quad", "bsdf": ")" << dim << R"("}],)"
+        << R"( "camera": {"resolution": [8, 8], "transform": {"position": [0, 3, 0.01], "look_at": [0, 0, 0],)"
+        << R"( "up": [0, 1, 0]}, "fov": 40}})";
+    return path;
+}
+
+static double renderMean(const std::string &path) {
+    Scene scene;
+    FrameBuffer frame;
+    unique_ptr<Integrator> integrator;
+    SceneParser::FromTungstenJSON(scene, frame, integrator, path.c_str());
+
+    EARSTracer tracer(scene);
+    UniformPathSampler sampler(7);
+    double sum = 0;
+    const int spp = 2048;
+    for (int y = 0; y < scene.camera.resy; y++) {
+        for (int x = 0; x < scene.camera.resx; x++) {
+            for (int s = 0; s < spp; s++) {
+                sum += tracer.trace(Vec2i(x, y), sampler).avg();
+            }
+        }
+    }
+    return sum / (double(spp) * scene.camera.resx * scene.camera.resy);
+}
+
+/* Which emitter is light sampled changes the variance, not the image: none of them may lose energy to MIS. */
+static void testEmittersCountInFull() {
+    const std::string lightIsBright = writeScene("roulette_earstracer_light.json", true);
+    const std::string lampIsBright = writeScene("roulette_earstracer_lamp.json", false);
+    const double sampled = renderMean(lightIsBright);
+    const double unsampled = renderMean(lampIsBright);
+    CHECK(sampled > 0);
+    CHECK(std::abs(unsampled - sampled) < 0.03 * sampled);
+    std::filesystem::remove(lightIsBright);
+    std::filesystem::remove(lampIsBright);
+}
+
+/* A light sampled mesh has to light the scene like the quad it is built to match. */
+static void testMeshLight() {
+    const std::string mesh = writeQuadMesh("roulette_earstracer_quad.obj");
+    const std::string quadLight = writeScene("roulette_earstracer_quad.json", true);
+    const std::string meshLight = writeScene("roulette_earstracer_mesh.json", true, mesh);
+    const double quad = renderMean(quadLight);
+    const double triangles = renderMean(meshLight);
+    CHECK(quad > 0);
+    CHECK(std::abs(triangles - quad) < 0.03 * quad);
+    std::filesystem::remove(mesh);
+    std::filesystem::remove(quadLight);
+    std::filesystem::remove(meshLight);
+}
+
+int main() {
+    testEmittersCountInFull();
+    testMeshLight();
+    if (failures == 0)
+        printf("earstracer: all checks passed\n");
+    return failures;
+}
@@ -0,0 +1,92 @@
+#include "check.h"
+
+#include "imageio.h"
+
+#include <filesystem>
+#include <thread>
+
+/* Writes an image whose size isn't a multiple of the tile size through every writer and reads it back. */
+
+static std::vector<Vec3f> testImage(int resx, int resy) {
+    std::vector<Vec3f> image(size_t(resx) * resy);
+    for (int y = 0; y < resy; y++)
+        for (int x = 0; x < resx; x++)
+            image[size_t(y) * resx + x] = Vec3f(float(x), float(y) * 0.5f, float(x * y) + 0.25f);
+    return image;
+}
+
+static std::string tempPath(const char *name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+static void testPfm(const std::vector<Vec3f> &image, int resx, int resy) {
+    const std::string path = tempPath("roulette_imageio_test.pfm");
+    CHECK(ImageIO::writePfm(path.c_str(), image.data(), resx, resy));
+    std::vector<Vec3f> read;
+    int readx = 0, ready = 0;
+    CHECK(ImageIO::readPfm(path.c_str(), read, readx, ready));
+    CHECK(readx == resx && ready == resy);
+    CHECK(read == image);
+    std::filesystem::remove(path);
+}
+
+static void testExr(const std::vector<Vec3f> &image, int resx, int resy) {
+    const std::string path = tempPath("roulette_imageio_test.exr");
+    CHECK(ImageIO::writeExr(path.c_str(), image.data(), resx, resy));
+    std::vector<Vec3f> read;
+    int readx = 0, ready = 0;
+    CHECK(ImageIO::readExr(path.c_str(), read, readx, ready));
+    CHECK(readx == resx && ready == resy);
+    CHECK(read == image);
+    std::filesystem::remove(path);
+}
+
+static void testTiledExr(const std::vector<Vec3f> &image, int resx, int resy) {
+    const std::string path = tempPath("roulette_imageio_test_tiled.exr");
+    const int tileSize = 16;
+    ImageIO::TiledExrWriter writer;
+    CHECK(writer.open(path.c_str(), resx, resy, tileSize));
+
+    /// two threads writing interleaved tiles back to front, with tile (1, 1) left out and (0, 0) written twice
+    auto writeTiles = [&](int parity) {
+        for (int t = writer.tilesX() * writer.tilesY() - 1; t >= 0; t--) {
+            const int tx = t % writer.tilesX(), ty = t / writer.tilesX();
+            if (t % 2 != parity || (tx == 1 && ty == 1))
+                continue;
+            CHECK(writer.writeTile(tx, ty, &image[size_t(ty) * tileSize * resx + tx * tileSize], resx));
+        }
+    };
+    std::vector<Vec3f> stale(size_t(tileSize) * tileSize, Vec3f(-1.0f));
+    CHECK(writer.writeTile(0, 0, stale.data(), tileSize));
+    std::thread other(writeTiles, 1);
+    writeTiles(0);
+    other.join();
+    CHECK(!writer.writeTile(writer.tilesX(), 0, image.data(), resx));
+    CHECK(writer.close());
+
+    std::vector<Vec3f> read;
+    int readx = 0, ready = 0;
+    CHECK(ImageIO::readExr(path.c_str(), read, readx, ready));
+    CHECK(readx == resx && ready == resy);
+    if (read.size() != image.size())
+        return;
+    for (int y = 0; y < resy; y++) {
+        for (int x = 0; x < resx; x++) {
+            const bool missing = x / tileSize == 1 && y / tileSize == 1;
+            const size_t i = size_t(y) * resx + x;
+            CHECK(read[i] == (missing ? Vec3f(0.0f) : image[i]));
+        }
+    }
+    std::filesystem::remove(path);
+}
+
+int main() {
+    const int resx = 70, resy = 45;
+    const std::vector<Vec3f> image = testImage(resx, resy);
+    testPfm(image, resx, resy);
+    testExr(image, resx, resy);
+    testTiledExr(image, resx, resy);
+    if (failures == 0)
+        printf("imageio: all checks passed\n");
+    return failures;
+}
@@ -0,0 +1,103 @@
+#include "check.h"
+
+#include "octtree.h"
+
+#include <cmath>
+
+/* Refines the direction bins of a region by training it with radiance arriving from a single direction. */
+
+using EARS::Octtree;
+
+static const Vec3f position(0.3f, 0.3f, 0.3f);
+static const Vec2f direction(0.01f, 0.01f); /// the corner of the first bin, and of the first quadrant at every depth
+static const float radiance = 100.0f;
+
+static void train(Octtree &tree, int samples) {
+    for (int i = 0; i < samples; i++) {
+        const Octtree::SamplingNode *sampling = nullptr;
+        Octtree::TrainingNode *training = nullptr;
+        tree.lookup(position, direction, sampling, training);
+        training->splatLrEstimate(Vec3f(radiance), Vec3f(radiance * radiance), 1.0f, 1.0f);
+    }
+}
+
+/* Whether the deepest quadrant the radiance arrives through learned it, and kept its training data. */
+static bool learned(Octtree &tree) {
+    const Octtree::SamplingNode *sampling = nullptr;
+    Octtree::TrainingNode *training = nullptr;
+    tree.lookup(position, direction, sampling, training);
+    return std::abs(sampling->lrEstimate().avg() - radiance) < 1e-3f * radiance &&
+           training->getWeight() >= tree.configuration.minimumLeafWeightForSampling &&
+           std::abs(training->getLrEstimate().avg() - radiance) < 1e-3f * radiance;
+}
+
+/**
+ * A quadrant that refines further hands a quarter of its training data to its new quadrants while the pool of
+ * direction nodes grows. A copy of the tree allocates the pool to fit, so growing it always moves the quadrant,
+ * and the new quadrants must not learn from where it was.
+ */
+static void testRefinementMovesDirections() {
+    Octtree tree;
+    tree.configuration.leafDecay = 1;
+    tree.configuration.minimumLeafWeightForSampling = 16;
+    tree.configuration.minimumLeafWeightForTraining = 1e30f;
+    tree.configuration.minimumBinWeightForDirectionalSplit = 64;
+    tree.configuration.maxDirectionalDepth = 3;
+
+    /// refines the bin
+    train(tree, 1000);
+    tree.build(true, false);
+    CHECK(learned(tree));
+
+    for (int depth = 1; depth < tree.configuration.maxDirectionalDepth; depth++) {
+        /// refines the quadrant the radiance arrives through
+        train(tree, 1000);
+        Octtree copy = tree;
+        copy.build(true, false);
+        CHECK(learned(copy));
+        tree = copy;
+    }
+}
+
+/**
+ * The guiding distribution of a region has to sum to one, the tracer samples a bin by its share and gives the last
+ * one what is left. Shares spanning many orders of magnitude stress the compact layout's quantisation.
+ */
+static void testGuidingSumsToOne() {
+    Octtree tree;
+    tree.collectIncident(true);
+    for (int sample = 0; sample < 256; sample++) {
+        const Octtree::SamplingNode *sampling = nullptr, *guiding = nullptr;
+        Octtree::TrainingNode *training = nullptr;
+        Octtree::TechniqueTraining *techniques = nullptr;
+        Octtree::IncidentTraining *incident = nullptr;
+        tree.lookup(position, direction, sampling, training, techniques, guiding, incident);
+        const int bin = sample % Octtree::BIN_COUNT;
+        incident->splat(bin, std::pow(10.0f, float(bin - 12)));
+    }
+    tree.build(false, false);
+
+    const Octtree::SamplingNode *sampling = nullptr, *guiding = nullptr;
+    Octtree::TrainingNode *training = nullptr;
+    Octtree::TechniqueTraining *techniques = nullptr;
+    Octtree::IncidentTraining *incident = nullptr;
+    tree.lookup(position, direction, sampling, training, techniques, guiding, incident);
+    CHECK(guiding != nullptr);
+    if (!guiding)
+        return;
+    float sum = 0;
+    for (int bin = 0; bin < Octtree::BIN_COUNT; bin++) {
+        CHECK(guiding[bin].guidingProbability() >= 0);
+        sum += guiding[bin].guidingProbability();
+    }
+    CHECK(std::abs(sum - 1.0f) < 1e-5f);
+    CHECK(guiding[Octtree::BIN_COUNT - 1].guidingProbability() > 0.85f);
+}
+
+int main() {
+    testRefinementMovesDirections();
+    testGuidingSumsToOne();
+    if (failures == 0)
+        printf("octtree: all checks passed\n");
+    return failures;
+}